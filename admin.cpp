@@ -0,0 +1,231 @@
+#include "admin.hpp"
+#include "log.hpp"
+#include "memory_accounting.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+
+namespace Admin
+{
+	static constexpr size_t kMaxLine = 512;
+	static constexpr int kMaxArgs = 16;
+	// an admin client that stops talking is dropped after this long, so it
+	// cannot hold the socket forever
+	static constexpr int kIdleTimeoutSeconds = 30;
+	// back-off bounds while accept() keeps failing, eg. out of fds
+	static constexpr long kAcceptRetryMinMs = 10;
+	static constexpr long kAcceptRetryMaxMs = 1000;
+
+	struct ServerArgs
+	{
+		int listenfd;
+		const Command* commands;
+		unsigned int command_count;
+		char path[108];
+	};
+
+	// the running server, for StopServer(); it lives as long as the process
+	static ServerArgs* server = nullptr;
+	static std::atomic_bool stopping(false);
+
+	static bool WriteAll(int fd, const std::string& text)
+	{
+		size_t written = 0;
+		while (written < text.size())
+		{
+			ssize_t n = write(fd, text.data() + written, text.size() - written);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) return false;
+			written += n;
+		}
+		return true;
+	}
+
+	// splits `line` in place on spaces and tabs
+	static int Tokenize(char* line, char** argv)
+	{
+		int argc = 0;
+		char* save = nullptr;
+		for (char* token = strtok_r(line, " \t\r\n", &save);
+			 token && argc < kMaxArgs;
+			 token = strtok_r(nullptr, " \t\r\n", &save))
+		{
+			argv[argc++] = token;
+		}
+		return argc;
+	}
+
+	static void Execute(const ServerArgs* args, char* line, std::string& reply)
+	{
+		char* argv[kMaxArgs];
+		int argc = Tokenize(line, argv);
+		if (argc == 0) return;
+
+		if (strcmp(argv[0], "help") == 0)
+		{
+			for (unsigned int i = 0; i < args->command_count; i++)
+			{
+				reply += args->commands[i].name;
+				reply += " ";
+				reply += args->commands[i].usage;
+				reply += "\n";
+			}
+			reply += "ok\n";
+			return;
+		}
+
+		for (unsigned int i = 0; i < args->command_count; i++)
+		{
+			if (strcmp(argv[0], args->commands[i].name) != 0) continue;
+
+			std::string output;
+			if (args->commands[i].handler(argc, argv, output))
+			{
+				reply += output;
+				reply += "ok\n";
+			}
+			else
+			{
+				reply += "error: ";
+				reply += output;
+				reply += "\n";
+			}
+			LOG_INFO("admin: %s\n", argv[0]);
+			return;
+		}
+		reply += "error: unknown command \"";
+		reply += argv[0];
+		reply += "\", try help\n";
+	}
+
+	static void Serve(const ServerArgs* args, int connfd)
+	{
+		char buffer[kMaxLine];
+		size_t used = 0;
+		std::string reply;
+
+		while (true)
+		{
+			ssize_t n = read(connfd, buffer + used, sizeof(buffer) - 1 - used);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) return;
+			used += n;
+
+			char* line = buffer;
+			char* newline;
+			while ((newline = (char*)memchr(line, '\n', buffer + used - line)))
+			{
+				*newline = '\0';
+				reply.clear();
+				Execute(args, line, reply);
+				if (!WriteAll(connfd, reply)) return;
+				line = newline + 1;
+			}
+
+			used = buffer + used - line;
+			memmove(buffer, line, used);
+			if (used == sizeof(buffer) - 1)
+			{
+				WriteAll(connfd, "error: line too long\n");
+				return;
+			}
+		}
+	}
+
+	static void* ServerThread(void* argsPtr)
+	{
+		ServerArgs* args = (ServerArgs*)argsPtr;
+		Memory::Scope memory_scope(Memory::Tag::diagnostics);
+
+		long retry_ms = kAcceptRetryMinMs;
+		while (!stopping.load())
+		{
+			int connfd = accept(args->listenfd, nullptr, nullptr);
+			if (connfd < 0)
+			{
+				if (errno == EINTR || errno == ECONNABORTED) continue;
+				if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+				{
+					// the condition usually passes; do not spin while it lasts
+					LOG_WARN("Admin socket: accept failed: %s, retrying in %ld ms\n",
+							 strerror(errno), retry_ms);
+					struct timespec delay = { retry_ms / 1000, (retry_ms % 1000) * 1000000 };
+					nanosleep(&delay, nullptr);
+					retry_ms = std::min(retry_ms * 2, kAcceptRetryMaxMs);
+					continue;
+				}
+				// the socket was shut down (StopServer) or is unusable
+				if (!stopping.load())
+				{
+					LOG_ERROR("Admin socket: accept failed: %s, admin commands stop\n",
+							  strerror(errno));
+				}
+				break;
+			}
+			retry_ms = kAcceptRetryMinMs;
+
+			struct timeval timeout = { kIdleTimeoutSeconds, 0 };
+			setsockopt(connfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+			setsockopt(connfd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+			Serve(args, connfd);
+			close(connfd);
+		}
+		unlink(args->path);
+		return nullptr;
+	}
+
+	void StopServer()
+	{
+		if (server == nullptr || stopping.exchange(true)) return;
+		// wakes the accept() in ServerThread
+		shutdown(server->listenfd, SHUT_RDWR);
+		unlink(server->path);
+	}
+
+	bool StartServer(const char* path, const Command* commands, unsigned int command_count)
+	{
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if (strlen(path) >= sizeof(addr.sun_path)) return false;
+		strcpy(addr.sun_path, path);
+
+		int listenfd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (listenfd < 0) return false;
+		unlink(path);
+		if (bind(listenfd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+			listen(listenfd, 4) != 0)
+		{
+			LOG_ERROR("Admin socket: cannot listen on %s: %s\n", path, strerror(errno));
+			close(listenfd);
+			return false;
+		}
+
+		ServerArgs* args = new ServerArgs{ listenfd, commands, command_count, {} };
+		strcpy(args->path, path);
+		pthread_t tid;
+		if (pthread_create(&tid, nullptr, ServerThread, args) != 0)
+		{
+			close(listenfd);
+			unlink(path);
+			delete args;
+			return false;
+		}
+		pthread_detach(tid);
+		server = args;
+		// the socket file goes with the process on a normal exit
+		atexit(StopServer);
+		return true;
+	}
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string>
+
+// Local admin control socket.
+//
+// A Unix stream socket that takes one command per line and answers each with
+// zero or more lines of output, then a status line: "ok" or "error: <why>".
+// Several commands can be sent over one connection, eg.
+//
+//   socat - UNIX-CONNECT:/tmp/simple-network-game-<pid>.admin
+//
+// Connections are served one at a time by a single background thread, so
+// nothing here ever runs on the game loop or the client threads.
+namespace Admin
+{
+	// Runs command `argv[0]` with its arguments. Output goes to `reply`; on
+	// failure `reply` holds the reason and the handler returns false.
+	typedef bool (*Handler)(int argc, char** argv, std::string& reply);
+
+	struct Command
+	{
+		const char* name;
+		const char* usage; // arguments and a one-line description, for "help"
+		Handler handler;
+	};
+
+	// `commands` must stay valid for the life of the process; "help" is built
+	// in. Returns false if the socket cannot be created. One server per
+	// process.
+	bool StartServer(const char* path, const Command* commands, unsigned int command_count);
+
+	// Stops taking connections and removes the socket file. Also runs at
+	// exit.
+	void StopServer();
+}
@@ -0,0 +1,98 @@
+/*
+ * Loopback end-to-end latency benchmark
+ *
+ * For each client count N, starts `server` as a child process on a free
+ * loopback port, connects N clients and takes them through the START flow.
+ * Then one client at a time (in turn) writes a CLT_REQ_MOVE, and the sample
+ * is the time until every client has read the matching SRV_RES_MOVE. Only
+ * one move is in flight, so nothing is coalesced; the server's input rate
+ * limits are lifted through its admin socket for the run.
+ *
+ * This is the baseline for networking changes: run it before and after.
+ *
+ * usage: bench_e2e [-s server_binary] [-n samples] [client_count...]
+ */
+
+#include "bench_client.hpp"
+#include "hdr_histogram.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <unistd.h>
+
+
+static constexpr int kWarmupSamples = 100;
+
+static bool RunClientCount(const char* server, unsigned int count, int samples)
+{
+	int port = BenchClient::FreeLoopbackPort();
+	pid_t pid = BenchClient::StartServer(server, port, count);
+	std::vector<BenchClient::Connection> clients(count);
+	bool ok = BenchClient::JoinGame(clients, port) &&
+		BenchClient::AdminCommand(pid, "rate-limit client 0 0\n") &&
+		BenchClient::AdminCommand(pid, "rate-limit move 0 0\n");
+
+	HdrHistogram latency;
+	int lost = 0;
+	for (int i = 0; ok && i < kWarmupSamples + samples; i++)
+	{
+		// alternate directions so the movers stay inside the arena
+		float step = ((i / count) & 1) ? -0.001f : 0.001f;
+		int64_t sample_ns = BenchClient::Sample(clients, count, i % count, step);
+		if (sample_ns < 0)
+		{
+			if (++lost > samples / 10) ok = false;
+			continue;
+		}
+		if (i >= kWarmupSamples) latency.Record(sample_ns);
+	}
+
+	for (BenchClient::Connection& client : clients) client.Close();
+	BenchClient::StopServer(pid);
+
+	if (!ok)
+	{
+		printf("%7u  failed (server did not start the game or stopped answering)\n", count);
+		return false;
+	}
+	printf("%7u  %7lu  %9.1f  %9.1f  %9.1f  %9.1f  %5d\n", count,
+		   (unsigned long)latency.Count(),
+		   latency.ValueAtPercentile(50) / 1e3, latency.ValueAtPercentile(99) / 1e3,
+		   latency.ValueAtPercentile(99.9) / 1e3, latency.Max() / 1e3, lost);
+	fflush(stdout);
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	const char* server = "./server";
+	int samples = 2000;
+	int opt;
+	while ((opt = getopt(argc, argv, "s:n:")) != -1)
+	{
+		switch (opt)
+		{
+		case 's': server = optarg; break;
+		case 'n': samples = atoi(optarg); break;
+		default:
+			fprintf(stderr, "usage: %s [-s server_binary] [-n samples] [client_count...]\n",
+					argv[0]);
+			return 1;
+		}
+	}
+
+	std::vector<unsigned int> counts;
+	for (int i = optind; i < argc; i++) counts.push_back(atoi(argv[i]));
+	if (counts.empty()) counts = { 2, 4, 8, 16, 32, 64 };
+
+	printf("move to all clients, microseconds (%d samples each)\n", samples);
+	printf("clients  samples        p50        p99      p99.9        max   lost\n");
+	bool ok = true;
+	for (unsigned int count : counts)
+	{
+		if (count < 1 || count > (unsigned int)GameSettings::kMaxPlayers) continue;
+		ok = RunClientCount(server, count, samples) && ok;
+	}
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,98 @@
+/*
+ * Game room specialization benchmark
+ *
+ * Runs the same workload (a room with `players` players) against every room
+ * policy that can hold it, so the inline/unrolled rooms can be compared with
+ * the heap-backed large room. The timed loops run under the hot path
+ * allocation guard, and the benchmark fails if any of them allocates.
+ *
+ * usage: bench_game_room [players] [iterations]
+ */
+
+#include "game.hpp"
+#include "instrumented_mutex.hpp"
+#include "log.hpp"
+#include "memory_accounting.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include <vector>
+
+
+static double NowSeconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+template <typename Settings>
+static void RunRoom(const char* name, unsigned int player_count, long iterations)
+{
+	if (player_count > Settings::kMaxPlayers) return;
+
+	Game<Settings> game;
+	std::vector<Player> players(player_count);
+	for (auto& player : players) game.AddPlayer(&player);
+
+	Memory::HotPath hot_path;
+
+	// nobody is ready, so every call walks the whole player table
+	double start = NowSeconds();
+	for (long i = 0; i < iterations; i++) game.TryStartGame();
+	double try_start_ns = (NowSeconds() - start) * 1e9 / iterations;
+
+	for (auto& player : players) game.PlayerSetReady(&player);
+	game.TryStartGame();
+
+	// a tick with no projectiles is dominated by publishing the snapshot
+	start = NowSeconds();
+	for (long i = 0; i < iterations; i++) game.Tick(1.0f / Settings::kTickRate, true);
+	double tick_ns = (NowSeconds() - start) * 1e9 / iterations;
+
+	start = NowSeconds();
+	for (long i = 0; i < iterations; i++)
+	{
+		float step = (i & 1) ? 0.01f : -0.01f;
+		game.MovePlayer(&players[i % player_count], step, step);
+	}
+	double move_ns = (NowSeconds() - start) * 1e9 / iterations;
+
+	volatile unsigned int sink = 0;
+	start = NowSeconds();
+	for (long i = 0; i < iterations; i++) sink += game.GetSnapshot().player_count;
+	double snapshot_ns = (NowSeconds() - start) * 1e9 / iterations;
+
+	printf("%-6s capacity=%-3u inline=%d  TryStartGame %7.1f ns  Tick %7.1f ns  "
+		   "MovePlayer %7.1f ns  GetSnapshot %7.1f ns\n",
+		   name, Settings::kMaxPlayers, (int)Settings::kInlineStorage,
+		   try_start_ns, tick_ns, move_ns, snapshot_ns);
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int player_count = (argc > 1) ? atoi(argv[1]) : 2;
+	long iterations = (argc > 2) ? atol(argv[2]) : 2000000;
+	if (player_count < 1 || iterations < 1)
+	{
+		fprintf(stderr, "usage: %s [players] [iterations]\n", argv[0]);
+		return 1;
+	}
+
+	printf("%u players, %ld iterations per operation\n", player_count, iterations);
+	Memory::SetAllocationGuard(Memory::GuardMode::report);
+	RunRoom<DuelRoomSettings>("duel", player_count, iterations);
+	RunRoom<SmallRoomSettings>("small", player_count, iterations);
+	RunRoom<LargeRoomSettings>("large", player_count, iterations);
+
+	std::string lock_report;
+	AppendLockReport(lock_report);
+	Log::Flush();
+	printf("\n%s", lock_report.c_str());
+
+	uint64_t hot_path_allocations = Memory::HotPathAllocations();
+	printf("\nhot path allocations: %lu\n", (unsigned long)hot_path_allocations);
+	return hot_path_allocations == 0 ? 0 : 1;
+}
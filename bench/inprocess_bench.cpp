@@ -0,0 +1,358 @@
+/*
+ * In-process room benchmark
+ *
+ * Runs a whole room inside this process over in-memory transports (see
+ * transport.hpp): no sockets, no child process, no kernel buffers. Like
+ * bench_e2e, one client at a time writes a CLT_REQ_MOVE and the sample is
+ * the time until every client has read the matching SRV_RES_MOVE, so the
+ * difference between the two is what the network stack costs.
+ *
+ * Every run also checks that each client read the same move broadcasts in
+ * the same order, and fails if one was lost or reordered. With one move in
+ * flight that order is fixed, so the run ends with a burst: every client
+ * writes kBurstMoves moves back to back, all at once, and then one closing
+ * move. Queues may coalesce a player's moves, so clients can read different
+ * subsets, but each must read every player's moves in the order they were
+ * made, ending with the closing one. Together that makes it a repeatable
+ * regression check for the broadcast and outbound queue paths.
+ *
+ * After the warmup the hot path allocation guard (see memory_accounting.hpp)
+ * is armed, and a run fails if the room allocated on its request path.
+ *
+ * usage: bench_inprocess [-n samples] [client_count...]
+ */
+
+#include "server.hpp"
+#include "transport.hpp"
+#include "bench_client.hpp"
+#include "hdr_histogram.hpp"
+#include "protocol.hpp"
+#include "rate_limiter.hpp"
+#include "memory_accounting.hpp"
+#include "log.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+
+
+static constexpr int kWarmupSamples = 100;
+// burst moves only go up, kBurstStep at a time, so their y orders them; the
+// closing move also steps x
+static constexpr int kBurstMoves = 100;
+static constexpr float kBurstStep = 0.0001f;
+
+// what a client last read of one player's position
+struct PlayerView
+{
+	float x = 0.0f;
+	float y = 0.0f;
+	// of the burst: the x before it, and whether the closing move arrived
+	float burst_x = 0.0f;
+	bool burst_closed = false;
+};
+
+struct InProcessClient : BenchClient::MemoryClient
+{
+	pthread_t reader;
+
+	// every SRV_RES_MOVE this client read before the burst, hashed in
+	// order (FNV-1a)
+	uint64_t moves_hash = 14695981039346656037ull;
+	uint64_t moves_read = 0;
+	int last_sample = -1;
+
+	std::unordered_map<PlayerId, PlayerView> players;
+	// a burst move read out of order, or after the closing one
+	bool burst_disordered = false;
+};
+
+// The sample in flight, shared with the reader threads.
+static pthread_mutex_t sample_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sample_done = PTHREAD_COND_INITIALIZER;
+static int current_sample = -1;
+static char current_prefix[32];
+static size_t current_prefix_length = 0;
+static size_t remaining = 0;
+static int64_t last_read_ns = 0;
+// set once every sample was read; `remaining` then counts closing moves
+static bool in_burst = false;
+
+// Checks a burst move against what `client` read of the player before.
+// Caller holds sample_mutex.
+static void ReadBurstMove(InProcessClient* client, PlayerView& view, float x, float y)
+{
+	if (view.burst_closed || y <= view.y) client->burst_disordered = true;
+	if (!view.burst_closed && x != view.burst_x)
+	{
+		view.burst_closed = true;
+		if (--remaining == 0) pthread_cond_signal(&sample_done);
+	}
+}
+
+static void* ReaderThread(void* clientPtr)
+{
+	InProcessClient* client = (InProcessClient*)clientPtr;
+	char line[Protocol::kMaxMessageLength];
+	int64_t rx_ns;
+	while (client->transport->ReadLine(line, sizeof(line), &rx_ns) > 0)
+	{
+		PlayerId player_id;
+		float x, y;
+		if (sscanf(line, "SRV_RES_MOVE %u %f %f", &player_id, &x, &y) != 3) continue;
+
+		pthread_mutex_lock(&sample_mutex);
+		PlayerView& view = client->players[player_id];
+		if (in_burst)
+		{
+			ReadBurstMove(client, view, x, y);
+		}
+		else
+		{
+			for (const char* c = line; *c; c++)
+			{
+				client->moves_hash = (client->moves_hash ^ (unsigned char)*c) * 1099511628211ull;
+			}
+			client->moves_read++;
+			view.burst_x = x;
+		}
+		view.x = x;
+		view.y = y;
+
+		if (!in_burst && client->last_sample != current_sample &&
+			strncmp(line, current_prefix, current_prefix_length) == 0)
+		{
+			client->last_sample = current_sample;
+			last_read_ns = BenchClient::NowNs();
+			if (--remaining == 0) pthread_cond_signal(&sample_done);
+		}
+		pthread_mutex_unlock(&sample_mutex);
+	}
+	return nullptr;
+}
+
+struct RoomArgs
+{
+	MemoryListener* listener;
+	int clients;
+};
+
+static void* RoomThread(void* argsPtr)
+{
+	RoomArgs* args = (RoomArgs*)argsPtr;
+	ServeRoom(*args->listener, "memory", args->clients);
+	return nullptr;
+}
+
+// Connects all clients and takes them through START; returns false if the
+// game did not start.
+static bool JoinGame(MemoryListener& listener, std::vector<InProcessClient>& clients)
+{
+	for (InProcessClient& client : clients) client.transport = listener.Connect();
+	return BenchClient::StartGame(clients);
+}
+
+// One move by `mover`; returns the ns until the last client read it, or -1.
+static int64_t Sample(std::vector<InProcessClient>& clients, int sample, unsigned int mover,
+					  float step)
+{
+	char request[Protocol::kMaxMessageLength];
+	Protocol::CreateMoveRequest(request, step, step);
+
+	pthread_mutex_lock(&sample_mutex);
+	current_sample = sample;
+	current_prefix_length = snprintf(current_prefix, sizeof(current_prefix),
+									 "SRV_RES_MOVE %u ", clients[mover].player_id);
+	remaining = clients.size();
+	pthread_mutex_unlock(&sample_mutex);
+
+	const int64_t start_ns = BenchClient::NowNs();
+	if (clients[mover].transport->Write(request, strlen(request), 0) < 0) return -1;
+
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += BenchClient::kTimeoutMs / 1000;
+	int64_t result = -1;
+	pthread_mutex_lock(&sample_mutex);
+	while (remaining > 0)
+	{
+		if (pthread_cond_timedwait(&sample_done, &sample_mutex, &deadline) == ETIMEDOUT) break;
+	}
+	if (remaining == 0) result = last_read_ns - start_ns;
+	pthread_mutex_unlock(&sample_mutex);
+	return result;
+}
+
+// Every client writes kBurstMoves moves up, interleaved with the others, and
+// then its closing move; returns false if a client did not read every
+// closing move, or read a burst move out of order.
+static bool Burst(std::vector<InProcessClient>& clients)
+{
+	pthread_mutex_lock(&sample_mutex);
+	in_burst = true;
+	remaining = clients.size() * clients.size();
+	pthread_mutex_unlock(&sample_mutex);
+
+	char request[Protocol::kMaxMessageLength];
+	Protocol::CreateMoveRequest(request, 0.0f, kBurstStep);
+	for (int i = 0; i < kBurstMoves; i++)
+	{
+		for (InProcessClient& client : clients)
+		{
+			if (!client.Send(request)) return false;
+		}
+	}
+	Protocol::CreateMoveRequest(request, kBurstStep, kBurstStep);
+	for (InProcessClient& client : clients)
+	{
+		if (!client.Send(request)) return false;
+	}
+
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += BenchClient::kTimeoutMs / 1000;
+	bool ok = true;
+	pthread_mutex_lock(&sample_mutex);
+	while (remaining > 0)
+	{
+		if (pthread_cond_timedwait(&sample_done, &sample_mutex, &deadline) == ETIMEDOUT) break;
+	}
+	ok = remaining == 0;
+	for (InProcessClient& client : clients) ok = ok && !client.burst_disordered;
+	in_burst = false;
+	pthread_mutex_unlock(&sample_mutex);
+	return ok;
+}
+
+static bool RunClientCount(unsigned int count, int samples)
+{
+	MemoryListener listener;
+	RoomArgs args = { &listener, (int)count };
+	pthread_t room;
+	pthread_create(&room, nullptr, RoomThread, &args);
+
+	std::vector<InProcessClient> clients(count);
+	if (!JoinGame(listener, clients))
+	{
+		// the room may still be waiting for players and cannot be stopped
+		printf("%7u  failed (the game did not start)\n", count);
+		exit(1);
+	}
+	bool ok = true;
+	for (InProcessClient& client : clients)
+	{
+		pthread_create(&client.reader, nullptr, ReaderThread, &client);
+	}
+
+	HdrHistogram latency;
+	int lost = 0;
+	uint64_t allocations_before = 0;
+	for (int i = 0; ok && i < kWarmupSamples + samples; i++)
+	{
+		if (i == kWarmupSamples)
+		{
+			allocations_before = Memory::HotPathAllocations();
+			Memory::SetAllocationGuard(Memory::GuardMode::report);
+		}
+		// alternate directions so the movers stay inside the arena
+		float step = ((i / count) & 1) ? -0.001f : 0.001f;
+		int64_t sample_ns = Sample(clients, i, i % count, step);
+		if (sample_ns < 0)
+		{
+			lost++;
+			ok = false;
+			continue;
+		}
+		if (i >= kWarmupSamples) latency.Record(sample_ns);
+	}
+	const bool ordered = ok && Burst(clients);
+	Memory::SetAllocationGuard(Memory::GuardMode::off);
+	const uint64_t allocations = Memory::HotPathAllocations() - allocations_before;
+
+	// the room disconnects everyone on the way out, which ends the readers
+	StopRoom();
+	pthread_join(room, nullptr);
+	for (InProcessClient& client : clients) pthread_join(client.reader, nullptr);
+
+	bool consistent = true;
+	for (InProcessClient& client : clients)
+	{
+		consistent = consistent && client.moves_read == clients[0].moves_read &&
+			client.moves_hash == clients[0].moves_hash;
+	}
+
+	if (!ok)
+	{
+		printf("%7u  failed (a move broadcast did not reach every client)\n", count);
+		return false;
+	}
+	if (!consistent)
+	{
+		printf("%7u  failed (clients read different move broadcasts)\n", count);
+		return false;
+	}
+	if (!ordered)
+	{
+		printf("%7u  failed (a client read a player's burst of moves out of order, "
+			   "or not its last move)\n", count);
+		return false;
+	}
+	if (allocations > 0)
+	{
+		printf("%7u  failed (%lu allocations on the request path, see stderr)\n", count,
+			   (unsigned long)allocations);
+		return false;
+	}
+	printf("%7u  %7lu  %9.1f  %9.1f  %9.1f  %9.1f  %5d\n", count,
+		   (unsigned long)latency.Count(),
+		   latency.ValueAtPercentile(50) / 1e3, latency.ValueAtPercentile(99) / 1e3,
+		   latency.ValueAtPercentile(99.9) / 1e3, latency.Max() / 1e3, lost);
+	fflush(stdout);
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	int samples = 2000;
+	int opt;
+	while ((opt = getopt(argc, argv, "n:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n': samples = atoi(optarg); break;
+		default:
+			fprintf(stderr, "usage: %s [-n samples] [client_count...]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	std::vector<unsigned int> counts;
+	for (int i = optind; i < argc; i++) counts.push_back(atoi(argv[i]));
+	if (counts.empty()) counts = { 2, 4, 8, 16, 32, 64 };
+
+	// the room's log would interleave with the table; rooms over four
+	// players warn about every join
+	Log::SetLevel(Log::Level::error);
+	// one move in flight never floods, but the default limits would still
+	// throttle a single fast mover
+	rate_limits.SetClientLimit({ 0, 0 });
+	rate_limits.SetRequestLimit(Protocol::ClientRequest::move, { 0, 0 });
+
+	printf("move to all clients in process, microseconds (%d samples each)\n", samples);
+	printf("clients  samples        p50        p99      p99.9        max   lost\n");
+	bool ok = true;
+	for (unsigned int count : counts)
+	{
+		if (count < 1 || count > (unsigned int)GameSettings::kMaxPlayers) continue;
+		ok = RunClientCount(count, samples) && ok;
+	}
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,395 @@
+/*
+ * Hot path microbenchmarks
+ *
+ * Times the pieces every request goes through: formatting and parsing
+ * protocol lines, Game::MovePlayer alone and with other threads moving in
+ * the same room, creating RespondMessages, pushing through an OutboundQueue
+ * and reading lines with rio_readlineb.
+ *
+ * Every benchmark is calibrated to run for at least kMinBatchSeconds, then
+ * repeated kRepetitions times; the median is reported. Results go to stdout
+ * as JSON laid out like Google Benchmark's (real_time in ns per operation),
+ * and progress goes to stderr:
+ *
+ *   make bench > before.json
+ *
+ * usage: bench_micro [name_filter]
+ */
+
+#include "csapp.h"
+#include "protocol.hpp"
+#include "game.hpp"
+#include "outbound_queue.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+
+
+static constexpr double kMinBatchSeconds = 0.05;
+static constexpr int kRepetitions = 5;
+
+static int64_t NowNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// keeps the compiler from optimizing a result away
+template <typename T>
+static void DoNotOptimize(const T& value)
+{
+	asm volatile("" : : "r"(&value) : "memory");
+}
+
+// Runs the operation `iterations` times and returns the nanoseconds the
+// timed part took, so setup can be left out.
+typedef std::function<int64_t(long iterations)> Batch;
+
+struct Result
+{
+	std::string name;
+	long iterations;
+	double ns_per_op; // median over the repetitions
+	double min_ns;
+	double max_ns;
+};
+
+static std::vector<Result> results;
+static const char* name_filter = nullptr;
+
+static void Run(const std::string& name, const Batch& batch)
+{
+	if (name_filter && name.find(name_filter) == std::string::npos) return;
+
+	// double the batch until it is long enough to time reliably
+	long iterations = 1;
+	while (batch(iterations) < kMinBatchSeconds * 1e9 && iterations < (1L << 30))
+	{
+		iterations *= 2;
+	}
+
+	std::vector<double> samples;
+	for (int i = 0; i < kRepetitions; i++)
+	{
+		samples.push_back((double)batch(iterations) / iterations);
+	}
+	std::sort(samples.begin(), samples.end());
+	results.push_back({ name, iterations, samples[kRepetitions / 2],
+						samples.front(), samples.back() });
+	fprintf(stderr, "%-40s %10.1f ns/op\n", name.c_str(), samples[kRepetitions / 2]);
+}
+
+// Times `body(i)` for i in [0, iterations).
+template <typename Body>
+static Batch Loop(Body body)
+{
+	return [body](long iterations) mutable
+	{
+		int64_t start = NowNs();
+		for (long i = 0; i < iterations; i++) body(i);
+		return NowNs() - start;
+	};
+}
+
+
+//
+// PROTOCOL
+
+static void BenchProtocol()
+{
+	static char buffer[Protocol::kMaxMessageLength];
+
+	Run("Protocol::CreateMoveRequest", Loop([](long i)
+	{
+		Protocol::CreateMoveRequest(buffer, 0.01f * (i & 7), -0.01f);
+		DoNotOptimize(buffer);
+	}));
+	Run("Protocol::CreateMoveResponse", Loop([](long i)
+	{
+		Protocol::CreateMoveResponse(buffer, (PlayerId)i, 0.123456f, -0.654321f);
+		DoNotOptimize(buffer);
+	}));
+	Run("Protocol::CreateNewPlayerResponse", Loop([](long i)
+	{
+		Protocol::CreateNewPlayerResponse(buffer, (PlayerId)i, 0.5f, -0.5f);
+		DoNotOptimize(buffer);
+	}));
+	Run("Protocol::CreateYourNewPlayerResponse", Loop([](long i)
+	{
+		Protocol::CreateYourNewPlayerResponse(buffer, (PlayerId)i, 0.5f, -0.5f,
+											  0.25f, 0.5f, 0.75f);
+		DoNotOptimize(buffer);
+	}));
+	Run("Protocol::CreateProjectileResponse", Loop([](long i)
+	{
+		DoNotOptimize(Protocol::CreateProjectileResponse(buffer, (ProjectileHandle)i,
+														 (PlayerId)i, 0.123456f, -0.654321f));
+	}));
+	Run("Protocol::CreateProjectileResponse/compact", Loop([](long i)
+	{
+		DoNotOptimize(Protocol::CreateProjectileResponse(buffer, (ProjectileHandle)i,
+														 (PlayerId)i, 0.123456f, -0.654321f, 3));
+	}));
+
+	// server side: every request line is classified by ParseClientRequest.
+	// The lines sit in receive buffers, as they would after a read.
+	static char move_line[Protocol::kMaxMessageLength] = "CLT_REQ_MOVE 0.010000 -0.010000\n";
+	static char start_line[Protocol::kMaxMessageLength] = "CLT_REQ_START\n";
+	static char unknown_line[Protocol::kMaxMessageLength] = "CLT_REQ_BOGUS 1 2\n";
+	Run("Protocol::ParseClientRequest/move", Loop([](long)
+	{
+		float x, y;
+		DoNotOptimize(Protocol::ParseClientRequest(move_line, &x, &y));
+		DoNotOptimize(x);
+	}));
+	Run("Protocol::ParseClientRequest/start", Loop([](long)
+	{
+		float x, y;
+		DoNotOptimize(Protocol::ParseClientRequest(start_line, &x, &y));
+	}));
+	Run("Protocol::ParseClientRequest/unknown", Loop([](long)
+	{
+		float x, y;
+		DoNotOptimize(Protocol::ParseClientRequest(unknown_line, &x, &y));
+	}));
+
+	// client side: the same sscanf the client runs on every SRV_RES_MOVE
+	static char response_line[Protocol::kMaxMessageLength] =
+		"SRV_RES_MOVE 65536 0.123456 -0.654321\n";
+	Run("sscanf/SRV_RES_MOVE", Loop([](long)
+	{
+		unsigned int id;
+		float x, y;
+		DoNotOptimize(sscanf(response_line, "SRV_RES_MOVE %u %f %f\n", &id, &x, &y));
+		DoNotOptimize(x);
+	}));
+}
+
+
+//
+// GAME
+
+struct MoveThreadArgs
+{
+	GameRoom* game;
+	Player* player;
+	std::atomic<bool>* stop;
+};
+
+static void* ContendingMoveThread(void* argsPtr)
+{
+	MoveThreadArgs* args = (MoveThreadArgs*)argsPtr;
+	for (long i = 0; !args->stop->load(std::memory_order_relaxed); i++)
+	{
+		float step = (i & 1) ? 0.001f : -0.001f;
+		args->game->MovePlayer(args->player, step, step);
+	}
+	return nullptr;
+}
+
+// Game::MovePlayer on one player, while `contenders` other threads keep
+// moving their own players in the same room.
+static void BenchMovePlayer(unsigned int contenders)
+{
+	const unsigned int player_count = contenders + 1;
+	GameRoom* game = CreateGameRoom(std::max(2u, player_count));
+	std::vector<Player> players(std::max(2u, player_count));
+	for (auto& player : players) game->AddPlayer(&player);
+	for (auto& player : players) game->PlayerSetReady(&player);
+	game->TryStartGame();
+
+	std::atomic<bool> stop(false);
+	std::vector<pthread_t> threads(contenders);
+	std::vector<MoveThreadArgs> args(contenders);
+	for (unsigned int i = 0; i < contenders; i++)
+	{
+		args[i] = { game, &players[i + 1], &stop };
+		pthread_create(&threads[i], nullptr, ContendingMoveThread, &args[i]);
+	}
+
+	char name[64];
+	snprintf(name, sizeof(name), "Game::MovePlayer/contenders:%u", contenders);
+	Player* player = &players[0];
+	Run(name, Loop([game, player](long i)
+	{
+		float step = (i & 1) ? 0.001f : -0.001f;
+		DoNotOptimize(game->MovePlayer(player, step, step));
+	}));
+
+	stop.store(true);
+	for (pthread_t thread : threads) pthread_join(thread, nullptr);
+	delete game;
+}
+
+
+//
+// OUTBOUND PATH
+
+static void BenchOutbound()
+{
+	char move_line[Protocol::kMaxMessageLength];
+	Protocol::CreateMoveResponse(move_line, 65536, 0.123456f, -0.654321f);
+	std::string move(move_line);
+
+	Run("NewRespondMessage/generic", Loop([move](long)
+	{
+		DoNotOptimize(NewRespondMessage(move.c_str()));
+	}));
+	Run("NewRespondMessage/move", Loop([move](long i)
+	{
+		DoNotOptimize(NewRespondMessage(move.c_str(), RespondMessage::Kind::move,
+										(PlayerId)(i & 63)));
+	}));
+	Run("NewRespondMessage/frame", Loop([](long)
+	{
+		// a tick frame of 16 projectiles
+		static char frame[16 * Protocol::kMaxMessageLength];
+		static size_t length = 0;
+		if (length == 0)
+		{
+			for (int p = 0; p < 16; p++)
+			{
+				length += Protocol::CreateProjectileResponse(frame + length, p, 1, 0.1f, 0.2f);
+			}
+		}
+		DoNotOptimize(NewRespondMessage(frame, length));
+	}));
+
+	// one broadcast message through a queue, like every client of a room
+	std::atomic<size_t> global_bytes(0);
+	OutboundQueue queue(&global_bytes);
+	auto message = NewRespondMessage(move.c_str());
+	Run("OutboundQueue::Push+Pop", Loop([&queue, &message](long)
+	{
+		queue.Push(message);
+		DoNotOptimize(queue.Pop());
+	}));
+
+	// moves of 8 players: every push after the first round is coalesced
+	std::vector<std::shared_ptr<RespondMessage>> moves;
+	for (PlayerId p = 0; p < 8; p++)
+	{
+		moves.push_back(NewRespondMessage(move.c_str(), RespondMessage::Kind::move, p));
+	}
+	Run("OutboundQueue::Push/coalesced", Loop([&queue, &moves](long i)
+	{
+		DoNotOptimize(queue.Push(moves[i & 7]));
+	}));
+	queue.Clear();
+
+	Run("OutboundQueue::Push+Pop/batch64", [&queue, &message](long iterations)
+	{
+		int64_t start = NowNs();
+		for (long i = 0; i < iterations; i += 64)
+		{
+			for (int j = 0; j < 64; j++) queue.Push(message);
+			for (int j = 0; j < 64; j++) DoNotOptimize(queue.Pop());
+		}
+		return NowNs() - start;
+	});
+}
+
+
+//
+// RIO
+
+// rio_readlineb over a socket pair; the lines are written untimed, in
+// chunks that fit into the socket buffer.
+static void BenchReadline()
+{
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) return;
+
+	const char* line = "CLT_REQ_MOVE 0.010000 -0.010000\n";
+	const size_t line_length = strlen(line);
+	const long kChunkLines = 1024;
+	std::string chunk;
+	for (long i = 0; i < kChunkLines; i++) chunk += line;
+	int buffer_size = chunk.size() * 2;
+	setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+	setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+
+	rio_t rio;
+	rio_readinitb(&rio, fds[1]);
+	Run("rio_readlineb", [&](long iterations)
+	{
+		char buf[Protocol::kMaxMessageLength];
+		int64_t elapsed = 0;
+		for (long done = 0; done < iterations; done += kChunkLines)
+		{
+			long lines = std::min(kChunkLines, iterations - done);
+			rio_writen(fds[0], (void*)chunk.data(), lines * line_length);
+
+			int64_t start = NowNs();
+			for (long i = 0; i < lines; i++)
+			{
+				DoNotOptimize(rio_readlineb(&rio, buf, sizeof(buf)));
+			}
+			elapsed += NowNs() - start;
+		}
+		return elapsed;
+	});
+
+	close(fds[0]);
+	close(fds[1]);
+}
+
+
+static void PrintJson()
+{
+	char date[64];
+	time_t now = time(nullptr);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+	char host[256] = "";
+	gethostname(host, sizeof(host) - 1);
+
+	printf("{\n  \"context\": {\n");
+	printf("    \"date\": \"%s\",\n", date);
+	printf("    \"host_name\": \"%s\",\n", host);
+	printf("    \"num_cpus\": %ld,\n", sysconf(_SC_NPROCESSORS_ONLN));
+	printf("    \"repetitions\": %d,\n", kRepetitions);
+	printf("    \"aggregate\": \"median\"\n");
+	printf("  },\n  \"benchmarks\": [\n");
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const Result& result = results[i];
+		printf("    {\"name\": \"%s\", \"run_type\": \"iteration\", \"iterations\": %ld, "
+			   "\"real_time\": %.3f, \"min_time\": %.3f, "
+			   "\"max_time\": %.3f, \"time_unit\": \"ns\"}%s\n",
+			   result.name.c_str(), result.iterations, result.ns_per_op,
+			   result.min_ns, result.max_ns, i + 1 < results.size() ? "," : "");
+	}
+	printf("  ]\n}\n");
+}
+
+int main(int argc, char** argv)
+{
+	if (argc > 2)
+	{
+		fprintf(stderr, "usage: %s [name_filter]\n", argv[0]);
+		return 1;
+	}
+	if (argc == 2) name_filter = argv[1];
+	// stdout is for the JSON only
+	Log::SetLevel(Log::Level::error);
+
+	BenchProtocol();
+	BenchMovePlayer(0);
+	BenchMovePlayer(1);
+	BenchMovePlayer(3);
+	BenchOutbound();
+	BenchReadline();
+
+	PrintJson();
+	return 0;
+}
@@ -0,0 +1,312 @@
+/*
+ * Offscreen client rendering benchmark
+ *
+ * Renders the client's scene without a window or display: an EGL context
+ * with no surface (Mesa's llvmpipe works) draws into a 300x300 framebuffer
+ * object, the client's window size. Every frame moves N synthetic entities
+ * and goes through the client's render path: one glBufferSubData of the
+ * whole vertex buffer, then glDrawArrays(GL_POINTS) through the geometry
+ * shader in shaders/cube_shader, which expands each point into a quad.
+ *
+ * Per frame it reports the CPU frame time (from the start of the frame
+ * until glFinish returns, the offscreen stand-in for SwapBuffers), the CPU
+ * time of the upload, and the draw time from glDrawArrays until glFinish
+ * returns. The draw is timed on the CPU because a GL_TIME_ELAPSED query
+ * misses most of llvmpipe's work, which runs when the frame is finished.
+ * The client caps N at GameSettings::kMaxPlayers; larger counts show how
+ * the path scales.
+ *
+ * It does not use shaders.hpp or window.hpp: those need GLEW and GLFW,
+ * which want an X display. The shaders are the client's own files.
+ *
+ * usage: bench_render [-f frames] [-s shader_dir] [entity_count...]
+ */
+
+#define GL_GLEXT_PROTOTYPES
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GL/glcorearb.h>
+
+#include "fileIO.hpp"
+#include "game_settings.hpp"
+#include "hdr_histogram.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+
+static constexpr int kWarmupFrames = 50;
+static constexpr int kFramebufferSize = 300;
+// (posX, posY, colorR, colorG, colorB), as in client.cpp
+static constexpr int kFloatsPerEntity = 5;
+
+static int64_t NowNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Creates a surfaceless OpenGL 3.3 core context and makes it current.
+static bool CreateContext()
+{
+	EGLDisplay display = EGL_NO_DISPLAY;
+	auto get_platform_display =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (get_platform_display)
+	{
+		display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY,
+									   nullptr);
+	}
+	if (display == EGL_NO_DISPLAY) display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	if (display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr))
+	{
+		fprintf(stderr, "no EGL display\n");
+		return false;
+	}
+	if (!eglBindAPI(EGL_OPENGL_API))
+	{
+		fprintf(stderr, "EGL has no desktop OpenGL\n");
+		return false;
+	}
+
+	// the default EGL_WINDOW_BIT would rule out every surfaceless config
+	const EGLint config_attributes[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_NONE
+	};
+	EGLConfig config;
+	EGLint config_count = 0;
+	if (!eglChooseConfig(display, config_attributes, &config, 1, &config_count) ||
+		config_count == 0)
+	{
+		fprintf(stderr, "no EGL config for OpenGL\n");
+		return false;
+	}
+
+	// the client asks GLFW for the same
+	const EGLint context_attributes[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attributes);
+	if (context == EGL_NO_CONTEXT ||
+		!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+	{
+		fprintf(stderr, "cannot create a surfaceless OpenGL 3.3 core context (0x%x)\n",
+				eglGetError());
+		return false;
+	}
+	return true;
+}
+
+static GLuint CompileShader(GLenum type, const std::string& path)
+{
+	std::string source = FileIO::readFileContents(path.c_str());
+	const char* text = source.c_str();
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, 1, &text, nullptr);
+	glCompileShader(shader);
+
+	GLint ok = GL_FALSE;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+	if (!ok)
+	{
+		char log[1024];
+		glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+		fprintf(stderr, "%s: %s\n", path.c_str(), log);
+		return 0;
+	}
+	return shader;
+}
+
+// Links the vertex, geometry and fragment shader in `dir`, like the client's
+// Shaders::SHADERS_VGF.
+static GLuint LoadShaders(const std::string& dir)
+{
+	GLuint vertex = CompileShader(GL_VERTEX_SHADER, dir + "vertex.shd");
+	GLuint geometry = CompileShader(GL_GEOMETRY_SHADER, dir + "geometry.shd");
+	GLuint fragment = CompileShader(GL_FRAGMENT_SHADER, dir + "fragment.shd");
+	if (!vertex || !geometry || !fragment) return 0;
+
+	GLuint program = glCreateProgram();
+	glAttachShader(program, vertex);
+	glAttachShader(program, geometry);
+	glAttachShader(program, fragment);
+	glLinkProgram(program);
+	glDeleteShader(vertex);
+	glDeleteShader(geometry);
+	glDeleteShader(fragment);
+
+	GLint ok = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &ok);
+	if (!ok)
+	{
+		char log[1024];
+		glGetProgramInfoLog(program, sizeof(log), nullptr, log);
+		fprintf(stderr, "linking %s: %s\n", dir.c_str(), log);
+		return 0;
+	}
+	return program;
+}
+
+static void SetVertexAttributes()
+{
+	// position
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * kFloatsPerEntity,
+						  (GLvoid*)0);
+	glEnableVertexAttribArray(0);
+	// color
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * kFloatsPerEntity,
+						  (GLvoid*)(sizeof(GLfloat) * 2));
+	glEnableVertexAttribArray(1);
+}
+
+// Every entity circles its own center, so each frame changes every vertex.
+static void MoveEntities(std::vector<GLfloat>& vertices, unsigned int count, int frame)
+{
+	for (unsigned int i = 0; i < count; i++)
+	{
+		float center_x = -0.9f + 1.8f * ((i * 37) % 101) / 100.0f;
+		float center_y = -0.9f + 1.8f * ((i * 59) % 103) / 102.0f;
+		float angle = 0.05f * frame + i;
+		vertices[i * kFloatsPerEntity + 0] = center_x + 0.05f * cosf(angle);
+		vertices[i * kFloatsPerEntity + 1] = center_y + 0.05f * sinf(angle);
+	}
+}
+
+static bool RunEntityCount(GLuint program, unsigned int count, int frames)
+{
+	std::vector<GLfloat> vertices(count * kFloatsPerEntity, 0.0f);
+	for (unsigned int i = 0; i < count; i++)
+	{
+		vertices[i * kFloatsPerEntity + 2] = (i % 7) / 6.0f;
+		vertices[i * kFloatsPerEntity + 3] = (i % 5) / 4.0f;
+		vertices[i * kFloatsPerEntity + 4] = (i % 3) / 2.0f;
+	}
+	const GLsizeiptr buffer_bytes = vertices.size() * sizeof(GLfloat);
+
+	GLuint vao, vbo;
+	glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+	glGenBuffers(1, &vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glBufferData(GL_ARRAY_BUFFER, buffer_bytes, vertices.data(), GL_DYNAMIC_DRAW);
+	SetVertexAttributes();
+	glBindVertexArray(0);
+
+	HdrHistogram frame_time, upload_time, draw_time;
+	for (int frame = 0; frame < kWarmupFrames + frames; frame++)
+	{
+		const int64_t frame_start_ns = NowNs();
+		MoveEntities(vertices, count, frame);
+
+		glClear(GL_COLOR_BUFFER_BIT);
+
+		// the client's upload, see its game loop
+		const int64_t upload_start_ns = NowNs();
+		glBindVertexArray(vao);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glFlush();
+		glBufferSubData(GL_ARRAY_BUFFER, 0, buffer_bytes, vertices.data());
+		SetVertexAttributes();
+		glBindVertexArray(0);
+		const int64_t upload_ns = NowNs() - upload_start_ns;
+
+		const int64_t draw_start_ns = NowNs();
+		glUseProgram(program);
+		glBindVertexArray(vao);
+		glDrawArrays(GL_POINTS, 0, count);
+		glBindVertexArray(0);
+		glUseProgram(0);
+		glFinish();
+		const int64_t end_ns = NowNs();
+
+		if (frame < kWarmupFrames) continue;
+		frame_time.Record(end_ns - frame_start_ns);
+		upload_time.Record(upload_ns);
+		draw_time.Record(end_ns - draw_start_ns);
+	}
+
+	GLenum error = glGetError();
+	glDeleteBuffers(1, &vbo);
+	glDeleteVertexArrays(1, &vao);
+	if (error != GL_NO_ERROR)
+	{
+		printf("%8u  failed (GL error 0x%x)\n", count, error);
+		return false;
+	}
+
+	printf("%8u  %9.1f  %9.1f  %9.1f  %9.1f  %9.1f  %9.1f\n", count,
+		   frame_time.ValueAtPercentile(50) / 1e3, frame_time.ValueAtPercentile(99) / 1e3,
+		   upload_time.ValueAtPercentile(50) / 1e3, upload_time.ValueAtPercentile(99) / 1e3,
+		   draw_time.ValueAtPercentile(50) / 1e3, draw_time.ValueAtPercentile(99) / 1e3);
+	fflush(stdout);
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	int frames = 500;
+	std::string shader_dir = FileIO::getPlatformPath("shaders|cube_shader");
+	int opt;
+	while ((opt = getopt(argc, argv, "f:s:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'f': frames = atoi(optarg); break;
+		case 's': shader_dir = std::string(optarg) + FileIO::getPlatformSeparator(); break;
+		default:
+			fprintf(stderr, "usage: %s [-f frames] [-s shader_dir] [entity_count...]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	std::vector<unsigned int> counts;
+	for (int i = optind; i < argc; i++) counts.push_back(atoi(argv[i]));
+	if (counts.empty()) counts = { (unsigned int)GameSettings::kMaxPlayers, 256, 1024, 4096 };
+
+	if (!CreateContext()) return 1;
+	GLuint program = LoadShaders(shader_dir);
+	if (!program) return 1;
+
+	// the client's window, as a framebuffer object
+	GLuint framebuffer, color;
+	glGenFramebuffers(1, &framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glGenRenderbuffers(1, &color);
+	glBindRenderbuffer(GL_RENDERBUFFER, color);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, kFramebufferSize, kFramebufferSize);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		fprintf(stderr, "cannot create the offscreen framebuffer\n");
+		return 1;
+	}
+	glViewport(0, 0, kFramebufferSize, kFramebufferSize);
+	glClearColor(0.2f, 0.3f, 0.5f, 1.0f);
+
+	printf("%s, %s, %dx%d, %d frames each\n", (const char*)glGetString(GL_RENDERER),
+		   (const char*)glGetString(GL_VERSION), kFramebufferSize, kFramebufferSize, frames);
+	printf("                 frame (us)          upload (us)           draw (us)\n");
+	printf("entities        p50        p99        p50        p99        p50        p99\n");
+	bool ok = true;
+	for (unsigned int count : counts)
+	{
+		if (count < 1) continue;
+		ok = RunEntityCount(program, count, frames) && ok;
+	}
+
+	glDeleteRenderbuffers(1, &color);
+	glDeleteFramebuffers(1, &framebuffer);
+	glDeleteProgram(program);
+	return ok ? 0 : 1;
+}
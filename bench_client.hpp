@@ -0,0 +1,309 @@
+#pragma once
+
+#include "protocol.hpp"
+#include "server_settings.hpp"
+#include "transport.hpp"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+// Client side of the benchmarks and tools that drive a server: loopback or
+// in-memory connections, a server child process and its admin socket, and
+// the START flow and move sample every one of them needs.
+
+namespace BenchClient
+{
+	// per line read, per admin reply and per poll of a move sample
+	constexpr int kTimeoutMs = 2000;
+
+	inline int64_t NowNs()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	}
+
+	// Line reader over a blocking socket; waits at most kTimeoutMs per line.
+	struct Connection
+	{
+		int fd = -1;
+		PlayerId player_id = kInvalidPlayerId;
+		char buffer[8192];
+		size_t buffered = 0;
+
+		// one recv into the buffer; false on EOF or error
+		bool Fill()
+		{
+			if (buffered == sizeof(buffer)) return false; // no line fits
+			ssize_t n = recv(fd, buffer + buffered, sizeof(buffer) - buffered, 0);
+			if (n <= 0) return false;
+			buffered += n;
+			return true;
+		}
+
+		// takes a complete line out of the buffer, if there is one
+		bool NextLine(std::string& line)
+		{
+			char* newline = (char*)memchr(buffer, '\n', buffered);
+			if (!newline) return false;
+			line.assign(buffer, newline - buffer);
+			size_t consumed = newline - buffer + 1;
+			memmove(buffer, buffer + consumed, buffered - consumed);
+			buffered -= consumed;
+			return true;
+		}
+
+		// returns false on EOF, error or timeout
+		bool ReadLine(std::string& line)
+		{
+			while (!NextLine(line))
+			{
+				struct pollfd pfd = { fd, POLLIN, 0 };
+				if (poll(&pfd, 1, kTimeoutMs) != 1 || !Fill()) return false;
+			}
+			return true;
+		}
+
+		bool Send(const char* line)
+		{
+			size_t length = strlen(line);
+			return send(fd, line, length, MSG_NOSIGNAL) == (ssize_t)length;
+		}
+
+		void Close()
+		{
+			if (fd >= 0) close(fd);
+			fd = -1;
+			buffered = 0;
+		}
+	};
+
+	// Client end of an in-memory connection (see MemoryListener::Connect()).
+	// Reads block without a timeout.
+	struct MemoryClient
+	{
+		std::unique_ptr<MemoryTransport> transport;
+		PlayerId player_id = kInvalidPlayerId;
+
+		// returns false on EOF; `line` is without its newline
+		bool ReadLine(std::string& line)
+		{
+			char buf[Protocol::kMaxMessageLength];
+			int64_t rx_ns;
+			ssize_t n = transport->ReadLine(buf, sizeof(buf), &rx_ns);
+			if (n <= 0) return false;
+			line.assign(buf, buf[n - 1] == '\n' ? n - 1 : n);
+			return true;
+		}
+
+		bool Send(const char* line)
+		{
+			return transport->Write(line, strlen(line), 0) >= 0;
+		}
+	};
+
+	inline int FreeLoopbackPort()
+	{
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		socklen_t length = sizeof(addr);
+		if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+			getsockname(fd, (struct sockaddr*)&addr, &length) != 0)
+		{
+			close(fd);
+			return -1;
+		}
+		close(fd);
+		return ntohs(addr.sin_port);
+	}
+
+	inline int ConnectLoopback(int port)
+	{
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = htons(port);
+		if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+		{
+			close(fd);
+			return -1;
+		}
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		return fd;
+	}
+
+	// Runs `server <port> <players>` as a child, with its stdout discarded.
+	inline pid_t StartServer(const char* server, int port, unsigned int players)
+	{
+		pid_t pid = fork();
+		if (pid == 0)
+		{
+			int devnull = open("/dev/null", O_WRONLY);
+			dup2(devnull, STDOUT_FILENO);
+			char port_arg[16], players_arg[16];
+			snprintf(port_arg, sizeof(port_arg), "%d", port);
+			snprintf(players_arg, sizeof(players_arg), "%u", players);
+			execl(server, server, port_arg, players_arg, (char*)nullptr);
+			fprintf(stderr, "cannot run %s: %s\n", server, strerror(errno));
+			_exit(127);
+		}
+		return pid;
+	}
+
+	inline void StopServer(pid_t pid)
+	{
+		kill(pid, SIGTERM);
+		waitpid(pid, nullptr, 0);
+
+		// an older server leaves its sockets behind when killed
+		char path[108];
+		snprintf(path, sizeof(path), ServerSettings::kMetricsSocketFormat, (int)pid);
+		unlink(path);
+		snprintf(path, sizeof(path), ServerSettings::kAdminSocketFormat, (int)pid);
+		unlink(path);
+	}
+
+	// Sends one admin command; true only once the server answered "ok", so
+	// an error, a timeout or a closed socket all fail it. The lines before
+	// the status line go to `output`, if given.
+	inline bool AdminCommand(pid_t pid, const char* command, std::string* output = nullptr)
+	{
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		snprintf(addr.sun_path, sizeof(addr.sun_path), ServerSettings::kAdminSocketFormat, (int)pid);
+
+		Connection admin;
+		admin.fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		bool sent = connect(admin.fd, (struct sockaddr*)&addr, sizeof(addr)) == 0 &&
+			admin.Send(command);
+		bool ok = false;
+		std::string line;
+		while (sent && admin.ReadLine(line))
+		{
+			if (line == "ok") ok = true;
+			if (ok || line.compare(0, 6, "error:") == 0) break;
+			if (output) output->append(line).append("\n");
+		}
+		admin.Close();
+		return ok;
+	}
+
+	// Takes connected players through START: reads each one's player id,
+	// then has all of them ask to start; returns false if the room did not
+	// start. `Client` has player_id, ReadLine(std::string&) giving lines
+	// without their newline, and Send(const char*).
+	template <typename Client>
+	bool StartGame(std::vector<Client>& players)
+	{
+		std::string line;
+		for (Client& player : players)
+		{
+			if (!player.ReadLine(line) ||
+				sscanf(line.c_str(), "SRV_RES_YOUR_NEW_PLAYER %u", &player.player_id) != 1)
+			{
+				return false;
+			}
+		}
+		for (Client& player : players)
+		{
+			if (!player.Send(Protocol::CLIENT_REQUEST_START)) return false;
+		}
+		for (Client& player : players)
+		{
+			do
+			{
+				if (!player.ReadLine(line)) return false;
+			} while (line != "SRV_RES_START");
+		}
+		return true;
+	}
+
+	// Connects all players to the server on `port` and takes them through
+	// START; returns false if the room did not start.
+	inline bool JoinGame(std::vector<Connection>& players, int port)
+	{
+		for (Connection& player : players)
+		{
+			// the server may still be starting up
+			for (int attempt = 0; attempt < 200 && player.fd < 0; attempt++)
+			{
+				player.fd = ConnectLoopback(port);
+				if (player.fd < 0) usleep(10000);
+			}
+			if (player.fd < 0) return false;
+		}
+		return StartGame(players);
+	}
+
+	// One move by players[mover]; returns the ns until the first `count`
+	// players all read it, or -1.
+	inline int64_t Sample(std::vector<Connection>& players, size_t count, size_t mover, float step)
+	{
+		char request[Protocol::kMaxMessageLength];
+		Protocol::CreateMoveRequest(request, step, step);
+		char prefix[32];
+		int prefix_length = snprintf(prefix, sizeof(prefix), "SRV_RES_MOVE %u ",
+									 players[mover].player_id);
+
+		const int64_t start_ns = NowNs();
+		if (!players[mover].Send(request)) return -1;
+
+		// poll everyone at once, so a slow player does not delay reading others
+		std::vector<bool> done(count, false);
+		std::vector<struct pollfd> pfds(count);
+		size_t remaining = count;
+		int64_t last_ns = start_ns;
+		std::string line;
+		auto scan = [&](size_t i)
+		{
+			while (!done[i] && players[i].NextLine(line))
+			{
+				if (line.compare(0, prefix_length, prefix) != 0) continue;
+				done[i] = true;
+				remaining--;
+				last_ns = NowNs();
+			}
+		};
+
+		for (size_t i = 0; i < count; i++) scan(i);
+		while (remaining > 0)
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				pfds[i] = { players[i].fd, (short)(done[i] ? 0 : POLLIN), 0 };
+			}
+			if (poll(pfds.data(), count, kTimeoutMs) <= 0) return -1;
+
+			for (size_t i = 0; i < count; i++)
+			{
+				if (done[i] || !(pfds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+				if (!players[i].Fill()) return -1;
+				scan(i);
+			}
+		}
+		return last_ns - start_ns;
+	}
+}
@@ -14,18 +14,20 @@
 #include <GLFW/glfw3.h>
 
 #include <atomic>
-#include <unordered_map>
 #include <string>
 #include "window.hpp"
 #include "shaders.hpp"
 #include "player.hpp"
 #include "game_state.hpp"
 #include "game_settings.hpp"
+#include "log.hpp"
+#include "instrumented_mutex.hpp"
+#include "memory_accounting.hpp"
 
 //
 // GAME DATA
 GLuint VAO, VBO;
-GLuint next_VBO_index = 0;
+GLuint render_point_count = 0; // one past the highest VBO index in use
 struct ClientPlayerData
 {
 	Player player;
@@ -37,9 +39,10 @@ const int kFloatsPerPlayer = 5;
 GLfloat player_vertex_data[GameSettings::kMaxPlayers * kFloatsPerPlayer];
 volatile std::atomic_bool should_buffer_data;
 
-pthread_mutex_t game_mutex;
-std::unordered_map<unsigned int, ClientPlayerData*> players;
-PlayerId my_player_id = 0; // invalid player_id
+InstrumentedMutex game_mutex("client game_mutex");
+// indexed by the slot of the server-issued player id
+SlotMirror<ClientPlayerData, GameSettings::kMaxPlayers> players;
+PlayerId my_player_id = kInvalidPlayerId;
 GameStateType game_state;
 std::atomic_uint32_t render_count;
 
@@ -63,7 +66,7 @@ void* ServerResponseThread(void* /*args*/)
 {
 	char response[Protocol::kMaxMessageLength];
 	bool listen_to_server = true;
-	printf("Starting server response thread\n");
+	LOG_INFO("Starting server response thread\n");
 
 	// intermediate variables for storing server response data
 	PlayerId player_id = 0;
@@ -77,10 +80,10 @@ void* ServerResponseThread(void* /*args*/)
 											Protocol::kMaxMessageLength);
 		if (read_status < 1)
 		{
-			printf("Failed reading from server!\n");
+			LOG_WARN("Failed reading from server!\n");
 			continue;
 		}
-		printf("Server response: %s", response);
+		LOG_DEBUG("Server response: %s", response);
 
 		if (strcmp(response, Protocol::SERVER_RESPONSE_START) == 0)
 		{
@@ -107,15 +110,15 @@ void* ServerResponseThread(void* /*args*/)
 		else if (sscanf(response, "SRV_RES_MOVE %u %f %f\n",
 						&player_id, &moveX, &moveY) == 3)
 		{
-			printf("moving player...\n");
-			pthread_mutex_lock(&game_mutex);
+			LOG_DEBUG("moving player...\n");
+			game_mutex.Lock();
 
-			auto it = players.find(player_id);
-			if (it != players.end())
+			ClientPlayerData* player = players.Find(player_id);
+			if (player != nullptr)
 			{
-				it->second->player.posX = moveX;
-				it->second->player.posY = moveY;
-				const int index = it->second->VBO_index * kFloatsPerPlayer;
+				player->player.posX = moveX;
+				player->player.posY = moveY;
+				const int index = player->VBO_index * kFloatsPerPlayer;
 				player_vertex_data[index] = moveX;
 				player_vertex_data[index+1] = moveY;
 				should_buffer_data.store(true);
@@ -123,25 +126,22 @@ void* ServerResponseThread(void* /*args*/)
 			}
 			else
 			{
-				printf("ERROR: Cannot move - player_id %u is not in collection!\n",
+				LOG_WARN("ERROR: Cannot move - player_id %u is not in collection!\n",
 					   player_id);
 			}
 
-			pthread_mutex_unlock(&game_mutex);
+			game_mutex.Unlock();
 		}
 		else if (sscanf(response, "SRV_RES_NEW_PLAYER %u %f %f\n",
 						&player_id, &moveX, &moveY) == 3)
 		{
-			printf("Add another player with player_id=%u\n", player_id);
-			pthread_mutex_lock(&game_mutex);
+			LOG_INFO("Add another player with player_id=%u\n", player_id);
+			game_mutex.Lock();
 
-			auto it = players.find(player_id);
-			if (it == players.end())
+			ClientPlayerData* player = players.Insert(player_id);
+			if (player != nullptr)
 			{
-				players[player_id] = new ClientPlayerData();
-				ClientPlayerData* player = players[player_id];
-
-				player->VBO_index = next_VBO_index;
+				player->VBO_index = SlotHandleIndex(player_id);
 				player->player.is_alive = true;
 				player->player.posX = moveX;
 				player->player.posY = moveY;
@@ -155,32 +155,32 @@ void* ServerResponseThread(void* /*args*/)
 				player_vertex_data[index+4] = 0.3f;
 				should_buffer_data.store(true);
 
-				next_VBO_index++;
+				if (player->VBO_index >= render_point_count)
+				{
+					render_point_count = player->VBO_index + 1;
+				}
 				render_count++;
 			}
 			else
 			{
-				printf("ERROR: Cannot add another new player - player_id %u already exists!\n",
+				LOG_WARN("ERROR: Cannot add another new player - player_id %u already exists or is invalid!\n",
 					   player_id);
 			}
 
-			pthread_mutex_unlock(&game_mutex);
+			game_mutex.Unlock();
 		}
 		else if (sscanf(response, "SRV_RES_YOUR_NEW_PLAYER %u %f %f %f %f %f\n",
 						&player_id, &moveX, &moveY,
 						&colorR, &colorG, &colorB) == 6)
 		{
-			printf("Add my player with player_id=%u\n", player_id);
-			pthread_mutex_lock(&game_mutex);
+			LOG_INFO("Add my player with player_id=%u\n", player_id);
+			game_mutex.Lock();
 
-			auto it = players.find(player_id);
-			if (it == players.end())
+			ClientPlayerData* player = players.Insert(player_id);
+			if (player != nullptr)
 			{
 				my_player_id = player_id;
-				players[player_id] = new ClientPlayerData();
-				ClientPlayerData* player = players[player_id];
-
-				player->VBO_index = next_VBO_index;
+				player->VBO_index = SlotHandleIndex(player_id);
 				player->player.is_alive = true;
 				player->player.posX = moveX;
 				player->player.posY = moveY;
@@ -197,20 +197,23 @@ void* ServerResponseThread(void* /*args*/)
 				player_vertex_data[index+4] = colorB;
 				should_buffer_data.store(true);
 
-				next_VBO_index++;
+				if (player->VBO_index >= render_point_count)
+				{
+					render_point_count = player->VBO_index + 1;
+				}
 				render_count++;
 			}
 			else
 			{
-				printf("ERROR: Cannot add my new player - player_id %u already exists!\n",
+				LOG_WARN("ERROR: Cannot add my new player - player_id %u already exists or is invalid!\n",
 					   player_id);
 			}
 
-			pthread_mutex_unlock(&game_mutex);
+			game_mutex.Unlock();
 		}
 	}
 
-	printf("Terminating server response thread\n");
+	LOG_INFO("Terminating server response thread\n");
 	return nullptr;
 }
 
@@ -255,7 +258,7 @@ void key_callback(GLFWwindow* /*window*/, int key, int /*scancode*/, int action,
 		ssize_t write_status = rio_writen(clientfd, request, strlen(request));
 		if (write_status < 1)
 		{
-			printf("Failed writing to server!\n");
+			LOG_WARN("Failed writing to server!\n");
 		}
     }
 }
@@ -283,7 +286,7 @@ int main(int argc, char **argv)
     clientfd = Open_clientfd(host, port);
     Rio_readinitb(&rio, clientfd);
 	Rio_readinitb(&rio_read, clientfd);
-	printf("Connected to server...\n");
+	LOG_INFO("Connected to server...\n");
 
 
 	// Initialize window
@@ -333,8 +336,9 @@ int main(int argc, char **argv)
 
 	// Initialize game state and server receive thread
 	Rio_readinitb(&response_rio, clientfd);
-	int mutex_init_status = pthread_mutex_init(&game_mutex, nullptr);
-	assert(mutex_init_status == 0);
+	// the player map is a fixed-size table, not heap; charge it by hand so
+	// it shows up in the memory report
+	Memory::Charge(Memory::Tag::player_map, Memory::kProcessOwner, sizeof(players));
 	game_running.store(true);
 	game_state = GameStateType::not_started;
 	render_count.store(1);
@@ -359,11 +363,11 @@ int main(int argc, char **argv)
 			{
 				should_buffer_data.store(false); // TODO: race condition, use counter!
 
-				printf("Buffering data:\n");
+				LOG_DEBUG("Buffering data:\n");
 				const int max_i = GameSettings::kMaxPlayers * kFloatsPerPlayer;
 				for (int i = 0; i < max_i; i += 5)
 				{
-					printf("(%f, %f, %f, %f, %f)\n",
+					LOG_DEBUG("(%f, %f, %f, %f, %f)\n",
 						   player_vertex_data[i],
 						   player_vertex_data[i+1],
 						   player_vertex_data[i+2],
@@ -378,7 +382,7 @@ int main(int argc, char **argv)
 				// glBufferSubData(target buffer object type, offset in bytes,
 				//                 size in bytes, pointer to data);
 				glBufferSubData(GL_ARRAY_BUFFER, 0,
-								sizeof(GLfloat) * GameSettings::kMaxPlayers * GameSettings::kMaxPlayers,
+								sizeof(GLfloat) * GameSettings::kMaxPlayers * kFloatsPerPlayer,
 								player_vertex_data);
 
 				// position
@@ -398,8 +402,8 @@ int main(int argc, char **argv)
 			// render game
 			cubeShader->Activate();
 			glBindVertexArray(VAO);
-			printf("will render %u points\n", next_VBO_index);
-			glDrawArrays(GL_POINTS, 0, next_VBO_index);
+			LOG_DEBUG("will render %u points\n", render_point_count);
+			glDrawArrays(GL_POINTS, 0, render_point_count);
 			glBindVertexArray(0);
 			cubeShader->Deactivate();
 
@@ -412,6 +416,12 @@ int main(int argc, char **argv)
 	void* thread_return_status;
 	Pthread_join(server_response_tid, &thread_return_status);
 
+	std::string report;
+	AppendLockReport(report);
+	Memory::AppendReport(report);
+	Log::Flush();
+	fputs(report.c_str(), stdout);
+
 	glDeleteVertexArrays(1, &VAO);
     glDeleteBuffers(1, &VBO);
 	//delete player_vertex_data;
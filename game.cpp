@@ -1,131 +1,176 @@
 #include "game.hpp"
+#include "log.hpp"
 
 #include <cstdio>
+#include <cstring>
 #include <cassert>
 #include <random>
+#include <cmath>
 
 
-Game::Game()
+template <typename Settings>
+Game<Settings>::Game(uint32_t seed, Journal* journal)
+	: mRng(seed)
 {
-	int mutex_status = pthread_mutex_init(&mGameMutex, nullptr);
-	assert(mutex_status == 0);
 	mGameState = GameStateType::not_started;
-	mPausedByPlayerId = 0; // invalid player id
+	mPausedByPlayerId = kInvalidPlayerId;
+	mTick = 0;
+	mExpiredDropsReported = 0;
+	mJournal = journal;
+	PublishSnapshot();
 }
 
-Game::~Game()
-{
-	pthread_mutex_destroy(&mGameMutex);
-}
 
-
-bool Game::MovePlayer(Player* player, float dirX, float dirY)
+template <typename Settings>
+bool Game<Settings>::MovePlayer(Player* player, float dirX, float dirY)
 {
+	TRACE_SPAN("Game::MovePlayer");
 	ScopedLock lock(&mGameMutex);
 	if (mGameState != GameStateType::running) return false;
 
 	float newX = player->posX + dirX;
 	float newY = player->posY + dirY;
-	if (newX > 1.0f || newX < -1.0f || newY > 1.0f || newY < -1.0f) return false;
+	if (newX > Settings::kArenaMax || newX < Settings::kArenaMin ||
+		newY > Settings::kArenaMax || newY < Settings::kArenaMin) return false;
 
 	player->posX = newX;
 	player->posY = newY;
+	Record(JournalRecordType::move, player->player_id, dirX, dirY);
 	return true;
 }
 
-bool Game::PlayerSetReady(Player* player)
+template <typename Settings>
+bool Game<Settings>::PlayerSetReady(Player* player)
 {
 	ScopedLock lock(&mGameMutex);
 	if (mGameState != GameStateType::not_started) return false;
 	if (player->is_ready) return false;
 
 	player->is_ready = true;
+	Record(JournalRecordType::ready, player->player_id);
+	PublishSnapshot();
 	return true;
 }
 
-bool Game::AddPlayer(Player* player)
+template <typename Settings>
+bool Game<Settings>::AddPlayer(Player* player)
 {
 	ScopedLock lock(&mGameMutex);
 	if (mGameState != GameStateType::not_started) return false;
-	if (mPlayers.size() >= GameSettings::kMaxPlayers) return false;
-	mPlayers.push_back(player);
+
+	PlayerId player_id = mPlayers.Insert(player);
+	if (player_id == kInvalidPlayerId) return false;
+	player->player_id = player_id;
+	LOG_INFO("new player with id=%u\n", player_id);
 
 	player->is_alive = true;
 	player->is_ready = false;
 
 	// TODO: Create proper player positions
-	if (player->player_id == 1)
+	const uint32_t slot = SlotHandleIndex(player_id);
+	if (slot == 0)
 	{
 		player->posX = -0.5f;
 		player->posY = 0.5f;
 	}
-	else if (player->player_id == 2)
+	else if (slot == 1)
 	{
 		player->posX = 0.5f;
 		player->posY = 0.5f;
 	}
 	else
 	{
-		printf("Game::AddPlayer(): player_id not implemented - setting position to (0,0)\n");
+		LOG_WARN("Game::AddPlayer(): player slot not implemented - setting position to (0,0)\n");
 		player->posX = 0.0f;
 		player->posY = 0.0f;
 	}
 
 	// setting player color
-	srand(time(NULL));
-	player->colorR = ((float)(rand() % 256)) / 256.0f;
-	player->colorG = ((float)(rand() % 256)) / 256.0f;
-	player->colorB = ((float)(rand() % 256)) / 256.0f;
+	player->colorR = ((float)(mRng() % 256)) / 256.0f;
+	player->colorG = ((float)(mRng() % 256)) / 256.0f;
+	player->colorB = ((float)(mRng() % 256)) / 256.0f;
+
+	Record(JournalRecordType::join, player_id);
+	PublishSnapshot();
+	return true;
+}
 
+template <typename Settings>
+bool Game<Settings>::RemovePlayer(Player* player)
+{
+	ScopedLock lock(&mGameMutex);
+	if (!mPlayers.Remove(player->player_id)) return false;
+
+	if (mPausedByPlayerId == player->player_id) mPausedByPlayerId = kInvalidPlayerId;
+	Record(JournalRecordType::leave, player->player_id);
+	player->player_id = kInvalidPlayerId;
+	PublishSnapshot();
 	return true;
 }
 
-bool Game::TryStartGame()
+template <typename Settings>
+bool Game<Settings>::TryStartGame()
 {
 	ScopedLock lock(&mGameMutex);
 	if (mGameState == GameStateType::running) return false;
 
 	bool may_start = true;
-	for (auto& player : mPlayers)
+	mPlayers.ForEach([&may_start](const Player* player)
 	{
 		may_start &= player->is_ready;
+	});
+	if (may_start)
+	{
+		mGameState = GameStateType::running;
+		Record(JournalRecordType::start, kInvalidPlayerId);
+		PublishSnapshot();
 	}
-	if (may_start) mGameState = GameStateType::running;
 	return may_start;
 }
 
-bool Game::PlayerQuit(Player* player)
+template <typename Settings>
+bool Game<Settings>::PlayerQuit(Player* player)
 {
 	ScopedLock lock(&mGameMutex);
 	if (!player->is_alive) return false;
 
 	player->is_alive = false;
 	mGameState = GameStateType::ended;
+	Record(JournalRecordType::quit, player->player_id);
+	PublishSnapshot();
 	return true;
 }
 
-bool Game::PauseUnpauseGame(Player* player)
+template <typename Settings>
+bool Game<Settings>::PauseUnpauseGame(Player* player, GameStateType& new_state)
 {
 	ScopedLock lock(&mGameMutex);
+	new_state = mGameState;
 
 	if (mGameState == GameStateType::running)
 	{
-		printf("Game running --> setting to pause!\n");
+		LOG_INFO("Game running --> setting to pause!\n");
 		mGameState = GameStateType::paused;
 		mPausedByPlayerId = player->player_id;
+		new_state = mGameState;
+		Record(JournalRecordType::pause, player->player_id);
+		PublishSnapshot();
 		return true;
 	}
 	else if (mGameState == GameStateType::paused)
 	{
 		if (player->player_id != mPausedByPlayerId)
 		{
-			printf("Game paused --> cannot unpause by another player!\n");
+			LOG_INFO("Game paused --> cannot unpause by another player!\n");
 			return false;
 		}
-		printf("Game paused --> setting to running!\n");
+		LOG_INFO("Game paused --> setting to running!\n");
 
 		mGameState = GameStateType::running;
-		mPausedByPlayerId = 0;
+		mPausedByPlayerId = kInvalidPlayerId;
+		new_state = mGameState;
+		Record(JournalRecordType::unpause, player->player_id);
+		PublishSnapshot();
 		return true;
 	}
 	else
@@ -134,8 +179,147 @@ bool Game::PauseUnpauseGame(Player* player)
 	}
 }
 
-GameStateType Game::GetGameState()
+template <typename Settings>
+GameStateType Game<Settings>::GetGameState() const
+{
+	return mSnapshot.Load().game_state;
+}
+
+template <typename Settings>
+WorldSnapshot Game<Settings>::GetSnapshot() const
+{
+	RoomSnapshot room = mSnapshot.Load();
+
+	WorldSnapshot snapshot;
+	snapshot.tick = room.tick;
+	snapshot.game_state = room.game_state;
+	snapshot.paused_by_player_id = room.paused_by_player_id;
+	snapshot.projectile_count = room.projectile_count;
+	snapshot.player_count = room.player_count;
+	memcpy(snapshot.players, room.players, sizeof(PlayerSnapshot) * room.player_count);
+	return snapshot;
+}
+
+template <typename Settings>
+void Game<Settings>::PublishSnapshot()
+{
+	RoomSnapshot snapshot;
+	memset(&snapshot, 0, sizeof(snapshot));
+	snapshot.tick = mTick;
+	snapshot.game_state = mGameState;
+	snapshot.paused_by_player_id = mPausedByPlayerId;
+	snapshot.projectile_count = mProjectiles.LiveCount();
+	snapshot.player_count = 0;
+	mPlayers.ForEach([&snapshot](const Player* player)
+	{
+		PlayerSnapshot& out = snapshot.players[snapshot.player_count++];
+		out.player_id = player->player_id;
+		out.posX = player->posX;
+		out.posY = player->posY;
+		out.colorR = player->colorR;
+		out.colorG = player->colorG;
+		out.colorB = player->colorB;
+		out.is_alive = player->is_alive;
+		out.is_ready = player->is_ready;
+	});
+	mSnapshot.Store(snapshot);
+}
+
+template <typename Settings>
+ProjectileHandle Game<Settings>::FireProjectile(Player* player, float dirX, float dirY)
+{
+	ScopedLock lock(&mGameMutex);
+	if (mGameState != GameStateType::running) return kInvalidProjectile;
+	if (!player->is_alive) return kInvalidProjectile;
+
+	float length = std::sqrt(dirX * dirX + dirY * dirY);
+	if (length == 0.0f) return kInvalidProjectile;
+
+	float speed = GameSettings::kProjectileSpeed / length;
+	ProjectileHandle handle = mProjectiles.Spawn(player->player_id, player->posX, player->posY,
+												 dirX * speed, dirY * speed,
+												 GameSettings::kProjectileLifetime);
+	if (handle != kInvalidProjectile) Record(JournalRecordType::fire, player->player_id, dirX, dirY);
+	return handle;
+}
+
+template <typename Settings>
+void Game<Settings>::Tick(float dt, bool publish_snapshot)
+{
+	ScopedLock lock(&mGameMutex);
+	if (mGameState != GameStateType::running) return;
+
+	mProjectiles.Tick(dt, Settings::kArenaMin, Settings::kArenaMax);
+	mTick++;
+	if (mJournal)
+	{
+		Record(JournalRecordType::tick, kInvalidPlayerId, dt);
+		if (mTick % Settings::kTickRate == 0) mJournal->AppendChecksum((uint32_t)mTick, ComputeChecksum());
+	}
+	if (publish_snapshot) PublishSnapshot();
+}
+
+template <typename Settings>
+size_t Game<Settings>::EncodeProjectiles(char* dest, size_t capacity, bool compact)
 {
 	ScopedLock lock(&mGameMutex);
-	return mGameState;
+	const uint64_t dropped = mProjectiles.ExpiredDroppedCount();
+	if (dropped != mExpiredDropsReported)
+	{
+		LOG_WARN("%llu projectile expire notices dropped (frames fell behind)\n",
+				 (unsigned long long)(dropped - mExpiredDropsReported));
+		mExpiredDropsReported = dropped;
+	}
+	return mProjectiles.Encode(dest, capacity, compact);
+}
+
+template <typename Settings>
+uint32_t Game<Settings>::StateChecksum()
+{
+	ScopedLock lock(&mGameMutex);
+	return ComputeChecksum();
+}
+
+// FNV-1a
+static uint32_t HashBytes(uint32_t hash, const void* data, size_t length)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < length; i++) hash = (hash ^ bytes[i]) * 16777619u;
+	return hash;
+}
+
+template <typename Settings>
+uint32_t Game<Settings>::ComputeChecksum() const
+{
+	uint32_t hash = 2166136261u;
+	hash = HashBytes(hash, &mTick, sizeof(mTick));
+	hash = HashBytes(hash, &mGameState, sizeof(mGameState));
+	hash = HashBytes(hash, &mPausedByPlayerId, sizeof(mPausedByPlayerId));
+	mPlayers.ForEach([&hash](const Player* player)
+	{
+		// field by field: Player has padding
+		hash = HashBytes(hash, &player->player_id, sizeof(player->player_id));
+		hash = HashBytes(hash, &player->posX, sizeof(player->posX));
+		hash = HashBytes(hash, &player->posY, sizeof(player->posY));
+		hash = HashBytes(hash, &player->colorR, sizeof(player->colorR));
+		hash = HashBytes(hash, &player->colorG, sizeof(player->colorG));
+		hash = HashBytes(hash, &player->colorB, sizeof(player->colorB));
+		hash = HashBytes(hash, &player->is_alive, sizeof(player->is_alive));
+		hash = HashBytes(hash, &player->is_ready, sizeof(player->is_ready));
+	});
+	uint32_t projectiles = mProjectiles.Checksum();
+	return HashBytes(hash, &projectiles, sizeof(projectiles));
+}
+
+
+template class Game<DuelRoomSettings>;
+template class Game<SmallRoomSettings>;
+template class Game<LargeRoomSettings>;
+
+GameRoom* CreateGameRoom(unsigned int max_players, uint32_t seed, Journal* journal)
+{
+	if (max_players <= DuelRoomSettings::kMaxPlayers) return new Game<DuelRoomSettings>(seed, journal);
+	if (max_players <= SmallRoomSettings::kMaxPlayers) return new Game<SmallRoomSettings>(seed, journal);
+	if (max_players <= LargeRoomSettings::kMaxPlayers) return new Game<LargeRoomSettings>(seed, journal);
+	return nullptr;
 }
@@ -1,51 +1,163 @@
 #pragma once
 
 #include <pthread.h>
-#include <vector>
+#include <random>
+#include <type_traits>
 #include "player.hpp"
+#include "player_table.hpp"
+#include "projectile.hpp"
 #include "game_state.hpp"
 #include "game_settings.hpp"
+#include "world_snapshot.hpp"
+#include "seqlock.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+#include "instrumented_mutex.hpp"
+#include "journal.hpp"
 
 
-class Game
+// What the server sees of a room. Each room is a Game specialized for its
+// settings policy; see CreateGameRoom().
+class GameRoom
 {
 public:
-	Game();
-	~Game();
-	bool MovePlayer(Player* player, float dirX, float dirY);
+	virtual ~GameRoom() {}
+
+	virtual bool MovePlayer(Player* player, float dirX, float dirY) = 0;
 
 	// returns false if player is already ready
-	bool PlayerSetReady(Player* player);
+	virtual bool PlayerSetReady(Player* player) = 0;
 
 	// will set the game state to "running" and return `true`,
 	// if all players are ready.
 	// Returns false if the game is already running
-	bool TryStartGame();
+	virtual bool TryStartGame() = 0;
+
+	// assigns the player a fresh id; returns false if the game is full or
+	// has already started
+	virtual bool AddPlayer(Player* player) = 0;
 
-	bool AddPlayer(Player* player);
+	// frees the player's id for reuse; returns false if it is already stale
+	virtual bool RemovePlayer(Player* player) = 0;
 
 	// will return false if player has already left the game
-	bool PlayerQuit(Player* player);
+	virtual bool PlayerQuit(Player* player) = 0;
 
 	// returns true if game state is changed (ie. same player who
 	// paused the game now unpauses it, or the other way around).
-	bool PauseUnpauseGame(Player* player);
+	// `new_state` receives the state the game was left in by this call.
+	virtual bool PauseUnpauseGame(Player* player, GameStateType& new_state) = 0;
+
+	// Lock-free: both read the most recently published snapshot and never
+	// block the simulation.
+	virtual GameStateType GetGameState() const = 0;
+	virtual WorldSnapshot GetSnapshot() const = 0;
+
+	// spawns a projectile at the player's position travelling in direction
+	// (dirX, dirY). Returns kInvalidProjectile if the game is not running or
+	// the projectile pool is full.
+	virtual ProjectileHandle FireProjectile(Player* player, float dirX, float dirY) = 0;
+
+	// advances the simulation by `dt` seconds, if the game is running.
+	// With `publish_snapshot` false the tick is not published to snapshot
+	// readers (state transitions always are).
+	virtual void Tick(float dt, bool publish_snapshot = true) = 0;
+
+	// encodes projectile state for broadcast, see ProjectilePool::Encode()
+	virtual size_t EncodeProjectiles(char* dest, size_t capacity, bool compact = false) = 0;
 
-	GameStateType GetGameState();
+	// hash of the simulation state (players, projectiles, game state); two
+	// rooms that applied the same inputs from the same seed agree on it
+	virtual uint32_t StateChecksum() = 0;
+
+	virtual unsigned int MaxPlayers() const = 0;
+	virtual int TickRate() const = 0;
+};
+
+// Returns a room of the smallest policy that fits `max_players` (duel, small
+// or large), or nullptr if no policy is big enough. `seed` seeds the room's
+// RNG (player colors). With a `journal`, the room appends every input it
+// applies and every state transition to it, plus a StateChecksum() once a
+// second of game time; the journal must outlive the room.
+GameRoom* CreateGameRoom(unsigned int max_players, uint32_t seed = 0, Journal* journal = nullptr);
+
+
+// `Settings` is a RoomSettings policy. Rooms of at most
+// GameSettings::kInlineRoomLimit players keep their players inline with
+// unrolled loops; larger rooms use heap storage and runtime-bounded loops.
+// Instantiated for the policies in game_settings.hpp, in game.cpp.
+template <typename Settings>
+class Game final : public GameRoom
+{
+public:
+	explicit Game(uint32_t seed = 0, Journal* journal = nullptr);
+
+	bool MovePlayer(Player* player, float dirX, float dirY) override;
+	bool PlayerSetReady(Player* player) override;
+	bool TryStartGame() override;
+	bool AddPlayer(Player* player) override;
+	bool RemovePlayer(Player* player) override;
+	bool PlayerQuit(Player* player) override;
+	bool PauseUnpauseGame(Player* player, GameStateType& new_state) override;
+	GameStateType GetGameState() const override;
+	WorldSnapshot GetSnapshot() const override;
+	ProjectileHandle FireProjectile(Player* player, float dirX, float dirY) override;
+	void Tick(float dt, bool publish_snapshot) override;
+	size_t EncodeProjectiles(char* dest, size_t capacity, bool compact) override;
+	uint32_t StateChecksum() override;
+
+	unsigned int MaxPlayers() const override { return Settings::kMaxPlayers; }
+	int TickRate() const override { return Settings::kTickRate; }
 
 private:
+	typedef typename std::conditional<Settings::kInlineStorage,
+									  InlinePlayerTable<Settings::kMaxPlayers>,
+									  DynamicPlayerTable<Settings::kMaxPlayers>>::type PlayerTable;
+	typedef BasicWorldSnapshot<Settings::kMaxPlayers> RoomSnapshot;
+
+	// copies current state into mSnapshot; mGameMutex must be held
+	void PublishSnapshot();
+
+	// mGameMutex must be held for both
+	void Record(JournalRecordType type, PlayerId player_id, float x = 0.0f, float y = 0.0f)
+	{
+		if (mJournal) mJournal->Append(type, (uint32_t)mTick, player_id, x, y);
+	}
+	uint32_t ComputeChecksum() const;
+
+	// also feeds every wait (0 if uncontended) into the game_lock_wait
+	// histogram
 	struct ScopedLock
 	{
-		ScopedLock(pthread_mutex_t* m){ _m = m; pthread_mutex_lock(m); }
-		~ScopedLock(){ pthread_mutex_unlock(_m); }
+		ScopedLock(InstrumentedMutex* m)
+		{
+			_m = m;
+			Metrics::Record(Metrics::Histogram::game_lock_wait, m->Lock());
+		}
+		~ScopedLock(){ _m->Unlock(); }
 	private:
-		pthread_mutex_t* _m;
+		InstrumentedMutex* _m;
 	};
-	pthread_mutex_t mGameMutex;
+	InstrumentedMutex mGameMutex{"Game::mGameMutex"};
 
-	std::vector<Player*> mPlayers;
+	PlayerTable mPlayers;
 
 	GameStateType mGameState;
 
 	PlayerId mPausedByPlayerId;
+
+	ProjectilePool mProjectiles;
+	// ExpiredDroppedCount() already logged
+	uint64_t mExpiredDropsReported;
+
+	uint64_t mTick;
+	Seqlock<RoomSnapshot> mSnapshot;
+
+	// a fixed algorithm, so a seed replays the same on every platform
+	std::minstd_rand mRng;
+	Journal* mJournal;
 };
+
+extern template class Game<DuelRoomSettings>;
+extern template class Game<SmallRoomSettings>;
+extern template class Game<LargeRoomSettings>;
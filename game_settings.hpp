@@ -3,5 +3,37 @@
 class GameSettings
 {
 public:
-	static constexpr int kMaxPlayers = 4;
+	// largest room the server can host, and so the most players a client
+	// ever has to track
+	static constexpr int kMaxPlayers = 64;
+
+	// default simulation ticks per second; the server can change it at
+	// runtime (admin "tick-rate" command)
+	static constexpr int kTickRate = 30;
+
+	// rooms up to this size keep players inline and unroll player loops
+	static constexpr unsigned int kInlineRoomLimit = 8;
+
+	static constexpr unsigned int kMaxProjectiles = 1024;
+	static constexpr float kProjectileSpeed = 1.5f;    // arena units per second
+	static constexpr float kProjectileLifetime = 2.0f; // seconds
+};
+
+// Room policy that Game is instantiated with. Everything here is a
+// compile-time constant, so each room size gets its own specialized code.
+template <unsigned int MaxPlayers, int TickRate = GameSettings::kTickRate>
+struct RoomSettings
+{
+	static_assert(MaxPlayers > 0 && MaxPlayers <= (unsigned int)GameSettings::kMaxPlayers,
+				  "room size out of range");
+
+	static constexpr unsigned int kMaxPlayers = MaxPlayers;
+	static constexpr int kTickRate = TickRate;
+	static constexpr float kArenaMin = -1.0f;
+	static constexpr float kArenaMax = 1.0f;
+	static constexpr bool kInlineStorage = MaxPlayers <= GameSettings::kInlineRoomLimit;
 };
+
+typedef RoomSettings<2> DuelRoomSettings;
+typedef RoomSettings<GameSettings::kInlineRoomLimit> SmallRoomSettings;
+typedef RoomSettings<GameSettings::kMaxPlayers> LargeRoomSettings;
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// High dynamic range histogram of non-negative integer values (eg. ns).
+//
+// Buckets are log-linear: every power of two is split into
+// 2^kSubBucketBits linear sub-buckets, so any recorded value is reported
+// within about 3% of its true value, from 1 up to 2^kMaxExponent. Larger
+// values are clamped into the last bucket.
+//
+// Record() is meant for a single writing thread and uses relaxed atomics
+// without read-modify-write instructions, so it costs about as much as a
+// plain increment. Other threads may read or merge it concurrently.
+class HdrHistogram
+{
+public:
+	static constexpr unsigned int kSubBucketBits = 5;
+	static constexpr unsigned int kSubBuckets = 1u << kSubBucketBits;
+	static constexpr unsigned int kMaxExponent = 36;
+	static constexpr unsigned int kBucketCount =
+		kSubBuckets + (kMaxExponent - kSubBucketBits) * kSubBuckets;
+
+	HdrHistogram() { Reset(); }
+
+	void Record(uint64_t value)
+	{
+		Bump(mBuckets[BucketIndex(value)], 1);
+		Bump(mCount, 1);
+		Bump(mSum, value);
+		if (value > mMax.load(std::memory_order_relaxed))
+		{
+			mMax.store(value, std::memory_order_relaxed);
+		}
+	}
+
+	// adds `other` into this histogram; safe while `other` is being written
+	void Merge(const HdrHistogram& other)
+	{
+		for (unsigned int i = 0; i < kBucketCount; i++)
+		{
+			uint64_t count = other.mBuckets[i].load(std::memory_order_relaxed);
+			if (count) mBuckets[i].fetch_add(count, std::memory_order_relaxed);
+		}
+		mCount.fetch_add(other.Count(), std::memory_order_relaxed);
+		mSum.fetch_add(other.Sum(), std::memory_order_relaxed);
+		if (other.Max() > Max()) mMax.store(other.Max(), std::memory_order_relaxed);
+	}
+
+	void Reset()
+	{
+		for (auto& bucket : mBuckets) bucket.store(0, std::memory_order_relaxed);
+		mCount.store(0, std::memory_order_relaxed);
+		mSum.store(0, std::memory_order_relaxed);
+		mMax.store(0, std::memory_order_relaxed);
+	}
+
+	// returns the value below which `percentile` (0..100) of samples fall
+	uint64_t ValueAtPercentile(double percentile) const
+	{
+		uint64_t total = Count();
+		if (total == 0) return 0;
+
+		uint64_t rank = (uint64_t)(percentile / 100.0 * total + 0.5);
+		if (rank < 1) rank = 1;
+		uint64_t seen = 0;
+		for (unsigned int i = 0; i < kBucketCount; i++)
+		{
+			seen += mBuckets[i].load(std::memory_order_relaxed);
+			if (seen >= rank)
+			{
+				uint64_t value = BucketMidpoint(i);
+				return value < Max() ? value : Max();
+			}
+		}
+		return Max();
+	}
+
+	uint64_t Count() const { return mCount.load(std::memory_order_relaxed); }
+	uint64_t Sum() const { return mSum.load(std::memory_order_relaxed); }
+	uint64_t Max() const { return mMax.load(std::memory_order_relaxed); }
+
+	static unsigned int BucketIndex(uint64_t value)
+	{
+		if (value < kSubBuckets) return (unsigned int)value;
+
+		unsigned int exponent = 63 - __builtin_clzll(value);
+		if (exponent >= kMaxExponent) return kBucketCount - 1;
+
+		unsigned int mantissa = (value >> (exponent - kSubBucketBits)) & (kSubBuckets - 1);
+		return kSubBuckets + (exponent - kSubBucketBits) * kSubBuckets + mantissa;
+	}
+
+	static uint64_t BucketMidpoint(unsigned int index)
+	{
+		if (index < kSubBuckets) return index;
+
+		unsigned int shift = (index - kSubBuckets) / kSubBuckets;
+		uint64_t mantissa = (index - kSubBuckets) % kSubBuckets;
+		uint64_t lower = (kSubBuckets + mantissa) << shift;
+		return lower + ((1ull << shift) >> 1);
+	}
+
+private:
+	static void Bump(std::atomic<uint64_t>& counter, uint64_t delta)
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + delta,
+					  std::memory_order_relaxed);
+	}
+
+	std::atomic<uint64_t> mBuckets[kBucketCount];
+	std::atomic<uint64_t> mCount;
+	std::atomic<uint64_t> mSum;
+	std::atomic<uint64_t> mMax;
+};
@@ -0,0 +1,110 @@
+#include "instrumented_mutex.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// Mutexes may be constructed during static initialization (eg. globals), so
+// the registry is created on first use rather than as a global.
+static pthread_mutex_t sites_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<LockSite*>& Sites()
+{
+	static std::vector<LockSite*>* sites = new std::vector<LockSite*>();
+	return *sites;
+}
+
+LockSite* GetLockSite(const char* name)
+{
+	pthread_mutex_lock(&sites_mutex);
+	LockSite* found = nullptr;
+	for (LockSite* site : Sites())
+	{
+		if (strcmp(site->name, name) == 0)
+		{
+			found = site;
+			break;
+		}
+	}
+	if (found == nullptr)
+	{
+		found = new LockSite();
+		found->name = name;
+		Sites().push_back(found);
+	}
+	pthread_mutex_unlock(&sites_mutex);
+	return found;
+}
+
+InstrumentedMutex::InstrumentedMutex(const char* site_name)
+{
+	int status = pthread_mutex_init(&mMutex, nullptr);
+	assert(status == 0);
+	(void)status;
+	mSite = GetLockSite(site_name);
+	mAcquiredNs = 0;
+}
+
+InstrumentedMutex::~InstrumentedMutex()
+{
+	pthread_mutex_destroy(&mMutex);
+}
+
+
+static std::vector<LockSite*> SortedSites()
+{
+	pthread_mutex_lock(&sites_mutex);
+	std::vector<LockSite*> sites = Sites();
+	pthread_mutex_unlock(&sites_mutex);
+
+	std::sort(sites.begin(), sites.end(), [](const LockSite* a, const LockSite* b)
+			  { return a->wait_ns.load() > b->wait_ns.load(); });
+	return sites;
+}
+
+void AppendLockReport(std::string& out)
+{
+	char line[256];
+	snprintf(line, sizeof(line), "%-28s %12s %10s %8s %12s %10s %12s %10s\n",
+			 "lock site", "acquired", "contended", "rate", "wait ms", "max us",
+			 "hold ms", "max us");
+	out += line;
+
+	for (LockSite* site : SortedSites())
+	{
+		uint64_t acquisitions = site->acquisitions.load();
+		uint64_t contended = site->contended.load();
+		snprintf(line, sizeof(line), "%-28s %12lu %10lu %7.2f%% %12.3f %10.1f %12.3f %10.1f\n",
+				 site->name, (unsigned long)acquisitions, (unsigned long)contended,
+				 acquisitions ? 100.0 * contended / acquisitions : 0.0,
+				 site->wait_ns.load() / 1e6, site->max_wait_ns.load() / 1e3,
+				 site->hold_ns.load() / 1e6, site->max_hold_ns.load() / 1e3);
+		out += line;
+	}
+}
+
+void AppendLockPrometheus(std::string& out)
+{
+	static const char* kSeries[] = {
+		"sng_lock_acquisitions_total", "sng_lock_contended_total",
+		"sng_lock_wait_ns_total", "sng_lock_hold_ns_total",
+	};
+
+	std::vector<LockSite*> sites = SortedSites();
+	char line[256];
+	for (unsigned int series = 0; series < 4; series++)
+	{
+		snprintf(line, sizeof(line), "# TYPE %s counter\n", kSeries[series]);
+		out += line;
+		for (LockSite* site : sites)
+		{
+			const std::atomic<uint64_t>* values[] = {
+				&site->acquisitions, &site->contended, &site->wait_ns, &site->hold_ns,
+			};
+			snprintf(line, sizeof(line), "%s{site=\"%s\"} %lu\n", kSeries[series],
+					 site->name, (unsigned long)values[series]->load());
+			out += line;
+		}
+	}
+}
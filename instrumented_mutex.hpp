@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <pthread.h>
+#include "trace.hpp"
+
+// Contention statistics of one named lock site. Every mutex constructed
+// with the same name shares a site, eg. all per-client mutexes.
+struct LockSite
+{
+	const char* name;
+	std::atomic<uint64_t> acquisitions{0};
+	std::atomic<uint64_t> contended{0};
+	std::atomic<uint64_t> wait_ns{0};
+	std::atomic<uint64_t> max_wait_ns{0};
+	std::atomic<uint64_t> hold_ns{0};
+	std::atomic<uint64_t> max_hold_ns{0};
+};
+
+// Returns the site called `name` (a string literal), creating it on first
+// use. Sites live until the process exits.
+LockSite* GetLockSite(const char* name);
+
+// Human-readable table of all sites, worst total wait first.
+void AppendLockReport(std::string& out);
+// The same numbers as Prometheus counters.
+void AppendLockPrometheus(std::string& out);
+
+
+// pthread mutex that records acquisitions, contended acquisitions, wait time
+// and hold time into its LockSite.
+//
+// Uncontended acquisitions only pay for the hold time clock reads: the wait
+// is timed only when trylock fails. Contended waits also show up as trace
+// spans named after the site.
+class InstrumentedMutex
+{
+public:
+	explicit InstrumentedMutex(const char* site_name);
+	~InstrumentedMutex();
+
+	InstrumentedMutex(const InstrumentedMutex&) = delete;
+	InstrumentedMutex& operator=(const InstrumentedMutex&) = delete;
+
+	// returns how long the caller waited (0 if uncontended)
+	uint64_t Lock()
+	{
+		uint64_t wait_ns = 0;
+		if (pthread_mutex_trylock(&mMutex) != 0)
+		{
+			TRACE_SPAN(mSite->name);
+			uint64_t start_ns = NowNs();
+			pthread_mutex_lock(&mMutex);
+			wait_ns = NowNs() - start_ns;
+			mSite->contended.fetch_add(1, std::memory_order_relaxed);
+			mSite->wait_ns.fetch_add(wait_ns, std::memory_order_relaxed);
+			UpdateMax(mSite->max_wait_ns, wait_ns);
+		}
+		mSite->acquisitions.fetch_add(1, std::memory_order_relaxed);
+		mAcquiredNs = NowNs();
+		return wait_ns;
+	}
+
+	void Unlock()
+	{
+		RecordHold();
+		pthread_mutex_unlock(&mMutex);
+	}
+
+	// pthread_cond_wait on this mutex, which the caller holds. Time spent
+	// asleep counts as neither wait nor hold time.
+	void Wait(pthread_cond_t* cond)
+	{
+		RecordHold();
+		pthread_cond_wait(cond, &mMutex);
+		mAcquiredNs = NowNs();
+	}
+
+private:
+	void RecordHold()
+	{
+		uint64_t hold_ns = NowNs() - mAcquiredNs;
+		mSite->hold_ns.fetch_add(hold_ns, std::memory_order_relaxed);
+		UpdateMax(mSite->max_hold_ns, hold_ns);
+	}
+
+	static uint64_t NowNs()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	}
+
+	static void UpdateMax(std::atomic<uint64_t>& max, uint64_t value)
+	{
+		uint64_t current = max.load(std::memory_order_relaxed);
+		while (value > current &&
+			   !max.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+	}
+
+	pthread_mutex_t mMutex;
+	LockSite* mSite;
+	uint64_t mAcquiredNs; // only touched by the owner
+};
@@ -0,0 +1,258 @@
+#include "journal.hpp"
+#include "log.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+static const char kMagic[8] = { 'S', 'N', 'G', 'J', 'R', 'N', 'L', '\0' };
+static_assert(sizeof(JournalHeader) <= Journal::kHeaderBytes, "header must fit before the records");
+
+Journal::Journal()
+{
+	mOpen = false;
+	memset(&mPendingHeader, 0, sizeof(mPendingHeader));
+	mFd = -1;
+	mMap = nullptr;
+	mMapBytes = 0;
+	mHeader = nullptr;
+}
+
+Journal::~Journal()
+{
+	Close();
+}
+
+bool Journal::Open(const char* path, unsigned int max_players, int tick_rate, uint32_t seed)
+{
+	Close();
+	mPath = path;
+	memset(&mPendingHeader, 0, sizeof(mPendingHeader));
+	memcpy(mPendingHeader.magic, kMagic, sizeof(kMagic));
+	mPendingHeader.version = kVersion;
+	mPendingHeader.record_size = sizeof(JournalRecord);
+	mPendingHeader.max_players = max_players;
+	mPendingHeader.tick_rate = tick_rate;
+	mPendingHeader.seed = seed;
+	mOpen = true;
+	return true;
+}
+
+void Journal::Close()
+{
+	mOpen = false;
+	mPending.clear();
+	if (mMap == nullptr) return;
+
+	const size_t used = kHeaderBytes + mHeader->record_count * sizeof(JournalRecord);
+	munmap(mMap, mMapBytes);
+	if (ftruncate(mFd, used) != 0)
+	{
+		LOG_WARN("Journal: cannot truncate: %s\n", strerror(errno));
+	}
+	close(mFd);
+	mFd = -1;
+	mMap = nullptr;
+	mHeader = nullptr;
+}
+
+bool Journal::CreateFile()
+{
+	mFd = open(mPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (mFd < 0)
+	{
+		LOG_ERROR("Journal: cannot create %s: %s\n", mPath.c_str(), strerror(errno));
+		return false;
+	}
+	mMapBytes = kInitialBytes;
+	void* map = MAP_FAILED;
+	if (ftruncate(mFd, mMapBytes) == 0)
+	{
+		map = mmap(nullptr, mMapBytes, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0);
+	}
+	if (map == MAP_FAILED)
+	{
+		LOG_ERROR("Journal: cannot map %s: %s\n", mPath.c_str(), strerror(errno));
+		close(mFd);
+		mFd = -1;
+		return false;
+	}
+	mMap = (char*)map;
+	mHeader = (JournalHeader*)mMap;
+
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	*mHeader = mPendingHeader;
+	mHeader->start_time_ns = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	mHeader->record_count = 0;
+	LOG_INFO("Journal: match started, writing %s\n", mPath.c_str());
+	return true;
+}
+
+JournalRecord* Journal::Next()
+{
+	size_t offset = kHeaderBytes + mHeader->record_count * sizeof(JournalRecord);
+	if (offset + sizeof(JournalRecord) > mMapBytes)
+	{
+		// doubling keeps the number of stalls logarithmic in the match
+		// length; the mapping grows in place where the address space allows
+		size_t grown = mMapBytes * 2;
+		void* map = MAP_FAILED;
+		if (grown <= kMaxBytes && ftruncate(mFd, grown) == 0)
+		{
+			map = mremap(mMap, mMapBytes, grown, MREMAP_MAYMOVE);
+		}
+		if (map == MAP_FAILED)
+		{
+			if (grown > kMaxBytes)
+			{
+				LOG_ERROR("Journal: reached its limit of %zu bytes, journaling stops\n", kMaxBytes);
+			}
+			else
+			{
+				LOG_ERROR("Journal: cannot grow to %zu bytes (%s), journaling stops\n",
+						  grown, strerror(errno));
+			}
+			Close();
+			return nullptr;
+		}
+		mMap = (char*)map;
+		mMapBytes = grown;
+		mHeader = (JournalHeader*)mMap;
+	}
+	return (JournalRecord*)(mMap + offset);
+}
+
+void Journal::Push(const JournalRecord& record)
+{
+	if (!mOpen) return;
+
+	if (mMap == nullptr)
+	{
+		// the rest of the match goes straight to the file
+		if (record.type != JournalRecordType::start)
+		{
+			mPending.push_back(record);
+			return;
+		}
+		if (!CreateFile())
+		{
+			Close();
+			return;
+		}
+		// Next() may close the journal, which clears mPending
+		std::vector<JournalRecord> pending;
+		pending.swap(mPending);
+		for (const JournalRecord& held : pending)
+		{
+			JournalRecord* next = Next();
+			if (next == nullptr) return;
+			*next = held;
+			mHeader->record_count++;
+		}
+	}
+
+	JournalRecord* next = Next();
+	if (next == nullptr) return;
+	*next = record;
+	mHeader->record_count++;
+}
+
+void Journal::Append(JournalRecordType type, uint32_t tick, PlayerId player_id, float x, float y)
+{
+	JournalRecord record;
+	record.tick = tick;
+	record.player_id = player_id;
+	record.type = type;
+	memset(record.reserved, 0, sizeof(record.reserved));
+	record.x = x;
+	record.y = y;
+	Push(record);
+}
+
+void Journal::AppendChecksum(uint32_t tick, uint32_t checksum)
+{
+	JournalRecord record;
+	record.tick = tick;
+	record.player_id = kInvalidPlayerId;
+	record.type = JournalRecordType::checksum;
+	memset(record.reserved, 0, sizeof(record.reserved));
+	record.checksum = checksum;
+	record.y = 0.0f;
+	Push(record);
+}
+
+uint64_t Journal::RecordCount() const
+{
+	return (mHeader ? mHeader->record_count : 0) + mPending.size();
+}
+
+
+JournalReader::JournalReader()
+{
+	mMap = nullptr;
+	mMapBytes = 0;
+	mHeader = nullptr;
+}
+
+JournalReader::~JournalReader()
+{
+	if (mMap) munmap((void*)mMap, mMapBytes);
+}
+
+bool JournalReader::Open(const char* path, char* error, size_t error_length)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		snprintf(error, error_length, "cannot open: %s", strerror(errno));
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < Journal::kHeaderBytes)
+	{
+		snprintf(error, error_length, "too short for a journal header");
+		close(fd);
+		return false;
+	}
+	void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+	{
+		snprintf(error, error_length, "cannot map: %s", strerror(errno));
+		return false;
+	}
+	mMap = (const char*)map;
+	mMapBytes = st.st_size;
+	mHeader = (const JournalHeader*)mMap;
+
+	if (memcmp(mHeader->magic, kMagic, sizeof(kMagic)) != 0)
+	{
+		snprintf(error, error_length, "not a journal");
+		return false;
+	}
+	if (mHeader->version != Journal::kVersion || mHeader->record_size != sizeof(JournalRecord))
+	{
+		snprintf(error, error_length, "journal version %u is not supported", mHeader->version);
+		return false;
+	}
+	// a journal of a crashed server still has the unused tail of its mapping
+	if (Journal::kHeaderBytes + mHeader->record_count * sizeof(JournalRecord) > mMapBytes)
+	{
+		snprintf(error, error_length, "truncated (%llu records in the header)",
+				 (unsigned long long)mHeader->record_count);
+		return false;
+	}
+	return true;
+}
+
+const JournalRecord* JournalReader::Records() const
+{
+	return (const JournalRecord*)(mMap + Journal::kHeaderBytes);
+}
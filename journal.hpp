@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "player.hpp"
+
+// Match journal: every input a room applied and every state transition, in
+// the order the room applied them, so a match can be re-simulated exactly
+// (see tools/replay.cpp). The room's RNG seed is in the header.
+//
+// The file is a JournalHeader followed by fixed-size JournalRecords, written
+// through a shared memory mapping: appending is a store, and what was
+// appended survives a crash of the server. The header's record count is
+// bumped after each record, so a reader never sees a torn record.
+
+enum class JournalRecordType : uint8_t
+{
+	join,     // AddPlayer() gave the player its id
+	leave,    // RemovePlayer()
+	ready,
+	start,    // TryStartGame() started the game
+	quit,
+	pause,    // by the player
+	unpause,  // by the player
+	move,     // x, y: the direction
+	fire,     // x, y: the direction; only projectiles that spawned
+	tick,     // x: dt in seconds
+	checksum, // the room's StateChecksum() after the preceding tick
+};
+
+struct JournalRecord
+{
+	// the room's tick count after the record was applied
+	uint32_t tick;
+	// kInvalidPlayerId for room records (start, tick, checksum)
+	PlayerId player_id;
+	JournalRecordType type;
+	uint8_t reserved[3];
+	union
+	{
+		float x;
+		uint32_t checksum;
+	};
+	float y;
+};
+static_assert(sizeof(JournalRecord) == 20, "journal records are part of the file format");
+
+struct JournalHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t max_players;
+	uint32_t tick_rate;
+	uint32_t seed;
+	uint32_t reserved;
+	int64_t start_time_ns; // CLOCK_REALTIME
+	uint64_t record_count;
+};
+
+// Written by one room, under its game mutex. The file is only created when
+// the match starts: until then the room's records (joins, leaves, readies)
+// are held in memory, so a room that never starts leaves no file. The file
+// starts at kInitialBytes and doubles as it fills, up to kMaxBytes, where
+// journaling stops; Close() truncates it to its records.
+class Journal
+{
+public:
+	static constexpr uint32_t kVersion = 1;
+	static constexpr size_t kHeaderBytes = 64;
+	static constexpr size_t kInitialBytes = 64 * 1024;
+	static constexpr size_t kMaxBytes = 256 * 1024 * 1024;
+
+	Journal();
+	~Journal();
+
+	// Starts a journal to be written to `path`, which is created (or
+	// truncated) by the start record; returns false if `path` is too long.
+	bool Open(const char* path, unsigned int max_players, int tick_rate, uint32_t seed);
+	void Close();
+	bool IsOpen() const { return mOpen; }
+
+	// Drops the record, and stops journaling, if the file cannot grow.
+	void Append(JournalRecordType type, uint32_t tick, PlayerId player_id,
+				float x = 0.0f, float y = 0.0f);
+	void AppendChecksum(uint32_t tick, uint32_t checksum);
+
+	// including the ones still held for the start of the match
+	uint64_t RecordCount() const;
+
+private:
+	void Push(const JournalRecord& record);
+	bool CreateFile();
+	JournalRecord* Next();
+
+	bool mOpen;
+	std::string mPath;
+	JournalHeader mPendingHeader;
+	std::vector<JournalRecord> mPending;
+
+	int mFd;
+	char* mMap;
+	size_t mMapBytes;
+	JournalHeader* mHeader;
+};
+
+// Read-only view of a journal file.
+class JournalReader
+{
+public:
+	JournalReader();
+	~JournalReader();
+
+	// Returns false, with the reason in `error`, if `path` is not a journal.
+	bool Open(const char* path, char* error, size_t error_length);
+
+	const JournalHeader& Header() const { return *mHeader; }
+	const JournalRecord* Records() const;
+	uint64_t RecordCount() const { return mHeader->record_count; }
+
+private:
+	const char* mMap;
+	size_t mMapBytes;
+	const JournalHeader* mHeader;
+};
@@ -0,0 +1,95 @@
+#include "listener.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#define SO_ATTACH_REUSEPORT_CBPF 51
+#endif
+
+constexpr int kListenBacklog = 1024;
+
+
+int OpenReuseportListener(const char* port)
+{
+	struct addrinfo hints, *listp, *p;
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE | AI_ADDRCONFIG | AI_NUMERICSERV;
+
+	int rc = getaddrinfo(NULL, port, &hints, &listp);
+	if (rc != 0)
+	{
+		fprintf(stderr, "getaddrinfo failed (port %s): %s\n", port, gai_strerror(rc));
+		return -1;
+	}
+
+	int listenfd = -1;
+	for (p = listp; p; p = p->ai_next)
+	{
+		listenfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+		if (listenfd < 0) continue;
+
+		int optval = 1;
+		if (setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval)) == 0 &&
+			setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) == 0 &&
+			bind(listenfd, p->ai_addr, p->ai_addrlen) == 0)
+		{
+			break;
+		}
+		close(listenfd);
+		listenfd = -1;
+	}
+	freeaddrinfo(listp);
+
+	if (listenfd < 0)
+	{
+		fprintf(stderr, "OpenReuseportListener: could not bind port %s: %s\n",
+				port, strerror(errno));
+		return -1;
+	}
+	if (listen(listenfd, kListenBacklog) < 0)
+	{
+		fprintf(stderr, "OpenReuseportListener: listen failed: %s\n", strerror(errno));
+		close(listenfd);
+		return -1;
+	}
+	return listenfd;
+}
+
+bool AttachShardSteering(int listenfd, unsigned int shard_count)
+{
+	if (shard_count == 0) return false;
+
+	// A = last 32 bits of the source address (IPv4 source, or the low word
+	// of an IPv6 source), then A % shard_count selects the socket.
+	struct sock_filter code[] = {
+		// A = IP version nibble
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, (uint32_t)(SKF_NET_OFF + 0)),
+		BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 4),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 6, 2, 0),
+		// IPv4: source address at offset 12
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t)(SKF_NET_OFF + 12)),
+		BPF_JUMP(BPF_JMP | BPF_JA, 1, 0, 0),
+		// IPv6: low word of the source address at offset 8 + 12
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t)(SKF_NET_OFF + 20)),
+		BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, shard_count),
+		BPF_STMT(BPF_RET | BPF_A, 0),
+	};
+	struct sock_fprog program;
+	program.len = sizeof(code) / sizeof(code[0]);
+	program.filter = code;
+
+	if (setsockopt(listenfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+				   &program, sizeof(program)) != 0)
+	{
+		fprintf(stderr, "AttachShardSteering: %s\n", strerror(errno));
+		return false;
+	}
+	return true;
+}
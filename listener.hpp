@@ -0,0 +1,22 @@
+#pragma once
+
+// SO_REUSEPORT listener sharding.
+//
+// Every shard owns its own listening socket bound to the same port, so the
+// kernel spreads incoming connections across shards instead of funnelling
+// them through a single accept queue. If a shard's process dies, only its
+// socket leaves the group; the other shards keep accepting.
+
+// Opens a listening socket on `port` with SO_REUSEPORT set.
+// Returns the descriptor, or -1 on error (with a message on stderr).
+int OpenReuseportListener(const char* port);
+
+// Attaches a classic BPF steering program to a reuseport group (through any
+// of its sockets). Connections are routed to the shard at index
+// hash(source address) % shard_count, where the index is the order in which
+// the shards' sockets were bound. All connections from one host therefore
+// land on the same shard, which keeps a room's players together when they
+// share an address (eg. a LAN or a load generator). Without the program the
+// kernel balances on the full 4-tuple hash instead.
+// Returns false if the kernel refused the program.
+bool AttachShardSteering(int listenfd, unsigned int shard_count);
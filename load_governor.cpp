@@ -0,0 +1,86 @@
+#include "load_governor.hpp"
+#include "server_settings.hpp"
+#include "log.hpp"
+
+#include <cstdio>
+#include <ctime>
+
+
+static int64_t ClockNs(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+LoadGovernor::LoadGovernor(int tick_rate)
+	: mTickPeriodNs(1000000000L / tick_rate)
+{
+	mTick = 0;
+	mShedLevel = 0;
+	mCalmWindows = 0;
+	mWindowTicks = 0;
+	mWindowWorkNs = 0;
+	mWindowPeakQueuedBytes = 0;
+	mWindowStartNs = ClockNs(CLOCK_MONOTONIC);
+	mWindowStartCpuNs = ClockNs(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+void LoadGovernor::EndTick(int64_t work_ns, size_t queued_bytes)
+{
+	mTick++;
+	mWindowTicks++;
+	mWindowWorkNs += work_ns;
+	if (queued_bytes > mWindowPeakQueuedBytes) mWindowPeakQueuedBytes = queued_bytes;
+
+	if (mWindowTicks >= ServerSettings::kGovernorWindowTicks) EvaluateWindow();
+}
+
+void LoadGovernor::EvaluateWindow()
+{
+	int64_t now_ns = ClockNs(CLOCK_MONOTONIC);
+	int64_t cpu_ns = ClockNs(CLOCK_PROCESS_CPUTIME_ID);
+	int64_t wall_ns = now_ns - mWindowStartNs;
+
+	float tick_load = (float)mWindowWorkNs / (mWindowTicks * mTickPeriodNs);
+	float queue_load = (float)mWindowPeakQueuedBytes / ServerSettings::kGlobalQueueBytes;
+	float cpu_cores = wall_ns > 0 ? (float)(cpu_ns - mWindowStartCpuNs) / wall_ns : 0.0f;
+
+	bool overloaded = tick_load > ServerSettings::kTickBudgetHigh ||
+		queue_load > ServerSettings::kQueueBudgetHigh ||
+		cpu_cores > ServerSettings::kCpuBudgetCores;
+	bool calm = tick_load < ServerSettings::kTickBudgetLow &&
+		queue_load < ServerSettings::kQueueBudgetLow &&
+		cpu_cores < ServerSettings::kCpuBudgetCores * ServerSettings::kCpuBudgetLow;
+
+	int old_level = mShedLevel;
+	if (overloaded)
+	{
+		mCalmWindows = 0;
+		if (mShedLevel < kMaxShedLevel) mShedLevel++;
+	}
+	else if (calm && mShedLevel > 0)
+	{
+		if (++mCalmWindows >= ServerSettings::kGovernorRecoverWindows)
+		{
+			mShedLevel--;
+			mCalmWindows = 0;
+		}
+	}
+	else
+	{
+		mCalmWindows = 0;
+	}
+
+	if (mShedLevel != old_level)
+	{
+		LOG_INFO("LoadGovernor: shed level %i -> %i (tick load %.2f, queue load %.2f, "
+			   "cpu %.2f cores)\n", old_level, mShedLevel, tick_load, queue_load, cpu_cores);
+	}
+
+	mWindowTicks = 0;
+	mWindowWorkNs = 0;
+	mWindowPeakQueuedBytes = 0;
+	mWindowStartNs = now_ns;
+	mWindowStartCpuNs = cpu_ns;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Watches how long each tick's work takes, how many bytes sit in outbound
+// queues and how much CPU the process burns, and picks a shed level:
+//
+//   0  everything runs every tick
+//   1  state frames are broadcast every 2nd tick
+//   2  every 4th tick, with compact (reduced precision) encoding; snapshot
+//      publishing for spectators/metrics and periodic statistics are skipped
+//   3  every 8th tick, as level 2
+//
+// Simulation always runs at the full tick rate; only what is sent and
+// published is thinned out. The level rises one step per overloaded window
+// and falls one step after several calm windows, so it recovers on its own.
+class LoadGovernor
+{
+public:
+	static constexpr int kMaxShedLevel = 3;
+
+	LoadGovernor(int tick_rate);
+
+	// for a tick rate changed at runtime
+	void SetTickRate(int tick_rate) { mTickPeriodNs = 1000000000L / tick_rate; }
+
+	// call once per tick with the time spent on this tick's work and the
+	// bytes currently queued for clients
+	void EndTick(int64_t work_ns, size_t queued_bytes);
+
+	// true if this tick should broadcast a state frame and publish a snapshot
+	bool ShouldSendFrame() const { return (mTick % FrameInterval()) == 0; }
+
+	unsigned int FrameInterval() const { return 1u << mShedLevel; }
+	bool CompactEncoding() const { return mShedLevel >= 2; }
+	bool ShedLowPriorityWork() const { return mShedLevel >= 2; }
+	int ShedLevel() const { return mShedLevel; }
+
+private:
+	void EvaluateWindow();
+
+	int64_t mTickPeriodNs;
+	uint64_t mTick;
+	int mShedLevel;
+	int mCalmWindows;
+
+	// accumulated over the current window
+	int mWindowTicks;
+	int64_t mWindowWorkNs;
+	size_t mWindowPeakQueuedBytes;
+	int64_t mWindowStartNs;
+	int64_t mWindowStartCpuNs;
+};
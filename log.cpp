@@ -0,0 +1,283 @@
+#include "log.hpp"
+#include "memory_accounting.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+namespace Log
+{
+	// Per thread, at 184 bytes a record. Every connection has two logging
+	// threads, so rings stay small; bursts beyond one flush interval's worth
+	// are dropped and reported.
+	constexpr unsigned int kRingRecords = 1 << 9;
+	constexpr long kFlushIntervalMs = 20;
+
+	std::atomic<uint8_t> runtime_level((uint8_t)SNG_LOG_LEVEL);
+
+	// Single-producer (the owning thread), single-consumer (the writer).
+	// Allocated default-initialized: records are written before they are
+	// read, so pages of a ring are only made resident once it wraps onto them.
+	struct ThreadRing
+	{
+		Record records[kRingRecords];
+		std::atomic<uint64_t> head{0};
+		std::atomic<uint64_t> tail{0};
+		std::atomic<uint64_t> dropped{0};
+		uint64_t reported_dropped = 0; // writer only
+		std::atomic<bool> retired{false};
+	};
+
+	static pthread_once_t start_once = PTHREAD_ONCE_INIT;
+	// guards the ring list and the formatting, so Flush() and the writer
+	// thread never drain the same ring at once
+	static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+	static std::vector<ThreadRing*> registry;
+
+	// registers on first use; the writer frees the ring after the thread
+	// exits and its last records are written
+	struct ThreadSlot
+	{
+		ThreadRing* ring = nullptr;
+
+		~ThreadSlot()
+		{
+			if (ring) ring->retired.store(true, std::memory_order_release);
+		}
+	};
+	static thread_local ThreadSlot thread_slot;
+
+	static const char* kLevelNames[] = { "debug", "info", "warn", "error" };
+
+	const char* LevelName(Level level)
+	{
+		return kLevelNames[(unsigned int)level];
+	}
+
+	bool ParseLevel(const char* name, Level& level)
+	{
+		for (unsigned int i = 0; i < sizeof(kLevelNames) / sizeof(kLevelNames[0]); i++)
+		{
+			if (strcmp(name, kLevelNames[i]) == 0)
+			{
+				level = (Level)i;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void SetLevel(Level level)
+	{
+		// levels compiled out stay out
+		const uint8_t compiled_level = SNG_LOG_LEVEL;
+		runtime_level.store(std::max((uint8_t)level, compiled_level), std::memory_order_relaxed);
+	}
+
+	Level GetLevel()
+	{
+		return (Level)runtime_level.load(std::memory_order_relaxed);
+	}
+
+
+	// Formats one record. Every conversion of the format is re-run through
+	// snprintf on its own, with the length modifier normalized to the width
+	// the argument was stored with.
+	static void Format(const Record& record, std::string& out)
+	{
+		char spec[32];
+		char text[512];
+		unsigned int arg = 0;
+
+		for (const char* c = record.format; *c; c++)
+		{
+			if (*c != '%')
+			{
+				out += *c;
+				continue;
+			}
+			if (c[1] == '%')
+			{
+				out += '%';
+				c++;
+				continue;
+			}
+
+			// copy flags, width and precision; drop length modifiers
+			size_t length = 0;
+			spec[length++] = *c++;
+			while (*c && strchr("-+ #0123456789.", *c) && length < sizeof(spec) - 4)
+			{
+				spec[length++] = *c++;
+			}
+			while (*c && strchr("hlLqjzt", *c)) c++;
+			if (*c == '\0') break;
+
+			const char conversion = *c;
+			if (arg >= record.arg_count)
+			{
+				out += "<missing>";
+				continue;
+			}
+			const Arg& value = record.args[arg++];
+
+			if (strchr("diouxXc", conversion))
+			{
+				if (conversion != 'c')
+				{
+					spec[length++] = 'l';
+					spec[length++] = 'l';
+				}
+				spec[length++] = conversion;
+				spec[length] = '\0';
+				if (conversion == 'c') snprintf(text, sizeof(text), spec, (int)value.i);
+				else snprintf(text, sizeof(text), spec, (long long)value.i);
+			}
+			else if (strchr("fFeEgGaA", conversion))
+			{
+				spec[length++] = conversion;
+				spec[length] = '\0';
+				snprintf(text, sizeof(text), spec, value.d);
+			}
+			else if (conversion == 's')
+			{
+				spec[length++] = 's';
+				spec[length] = '\0';
+				const char* string = value.u < record.string_bytes ?
+					record.strings + value.u : "";
+				snprintf(text, sizeof(text), spec, string);
+			}
+			else if (conversion == 'p')
+			{
+				snprintf(text, sizeof(text), "%p", value.p);
+			}
+			else
+			{
+				snprintf(text, sizeof(text), "<%%%c?>", conversion);
+			}
+			out += text;
+		}
+	}
+
+	// Copies every ring's pending records into `pending`; the caller holds
+	// registry_mutex.
+	static void DrainLocked(std::vector<Record>& pending, std::string& out)
+	{
+		for (size_t i = 0; i < registry.size();)
+		{
+			ThreadRing* ring = registry[i];
+			// check before draining, so no record can slip in after
+			bool retired = ring->retired.load(std::memory_order_acquire);
+
+			uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+			uint64_t head = ring->head.load(std::memory_order_acquire);
+			for (; tail != head; tail++)
+			{
+				pending.push_back(ring->records[tail % kRingRecords]);
+			}
+			ring->tail.store(tail, std::memory_order_release);
+
+			uint64_t dropped = ring->dropped.load(std::memory_order_relaxed);
+			if (dropped != ring->reported_dropped)
+			{
+				char text[96];
+				snprintf(text, sizeof(text), "[log] %lu messages dropped, ring full\n",
+						 (unsigned long)(dropped - ring->reported_dropped));
+				out += text;
+				ring->reported_dropped = dropped;
+			}
+
+			if (retired)
+			{
+				registry[i] = registry.back();
+				registry.pop_back();
+				delete ring;
+			}
+			else
+			{
+				i++;
+			}
+		}
+	}
+
+	// Records of one flush are merged across threads by timestamp.
+	void Flush()
+	{
+		// never destroyed: Flush() also runs from atexit
+		static std::vector<Record>& pending = *new std::vector<Record>();
+		std::string out;
+		pthread_mutex_lock(&registry_mutex);
+		pending.clear();
+		DrainLocked(pending, out);
+		std::stable_sort(pending.begin(), pending.end(),
+						 [](const Record& a, const Record& b)
+						 { return a.timestamp_ns < b.timestamp_ns; });
+		for (const Record& record : pending) Format(record, out);
+		fwrite(out.data(), 1, out.size(), stdout);
+		fflush(stdout);
+		pthread_mutex_unlock(&registry_mutex);
+	}
+
+	static void* WriterThread(void*)
+	{
+		struct timespec interval = { 0, kFlushIntervalMs * 1000000 };
+		while (true)
+		{
+			nanosleep(&interval, nullptr);
+			Flush();
+		}
+		return nullptr;
+	}
+
+	static void StartWriter()
+	{
+		pthread_t tid;
+		if (pthread_create(&tid, nullptr, WriterThread, nullptr) == 0)
+		{
+			pthread_detach(tid);
+		}
+		atexit(Flush);
+	}
+
+	Record* Begin()
+	{
+		ThreadRing* ring = thread_slot.ring;
+		if (ring == nullptr)
+		{
+			pthread_once(&start_once, StartWriter);
+			{
+				Memory::Scope scope(Memory::Tag::diagnostics);
+				ring = new ThreadRing;
+			}
+			pthread_mutex_lock(&registry_mutex);
+			registry.push_back(ring);
+			pthread_mutex_unlock(&registry_mutex);
+			thread_slot.ring = ring;
+		}
+
+		uint64_t head = ring->head.load(std::memory_order_relaxed);
+		if (head - ring->tail.load(std::memory_order_acquire) >= kRingRecords)
+		{
+			ring->dropped.store(ring->dropped.load(std::memory_order_relaxed) + 1,
+								std::memory_order_relaxed);
+			return nullptr;
+		}
+
+		Record* record = &ring->records[head % kRingRecords];
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		record->timestamp_ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+		return record;
+	}
+
+	void Commit()
+	{
+		ThreadRing* ring = thread_slot.ring;
+		ring->head.store(ring->head.load(std::memory_order_relaxed) + 1,
+						 std::memory_order_release);
+	}
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// Asynchronous binary logger.
+//
+// A call site does not format anything: it stores its format string's
+// address (the format id) and its raw arguments in a fixed-size record on
+// the calling thread's lock-free ring. A background thread, started on first
+// use, formats the records and writes them to stdout. A full ring drops the
+// record (the drops are reported) rather than block the caller.
+//
+// Formats must be string literals. Arguments may be integers, floating
+// point, pointers or C strings; strings are copied (up to
+// kRecordStringBytes in total per record).
+//
+// Levels below SNG_LOG_LEVEL are compiled out completely; the remaining
+// ones can also be filtered at runtime with SetLevel().
+#define SNG_LOG_LEVEL_DEBUG 0
+#define SNG_LOG_LEVEL_INFO 1
+#define SNG_LOG_LEVEL_WARN 2
+#define SNG_LOG_LEVEL_ERROR 3
+
+#ifndef SNG_LOG_LEVEL
+#define SNG_LOG_LEVEL SNG_LOG_LEVEL_INFO
+#endif
+
+namespace Log
+{
+	enum class Level : uint8_t
+	{
+		debug = SNG_LOG_LEVEL_DEBUG,
+		info = SNG_LOG_LEVEL_INFO,
+		warn = SNG_LOG_LEVEL_WARN,
+		error = SNG_LOG_LEVEL_ERROR,
+	};
+
+	const char* LevelName(Level level);
+	// returns false for unknown names
+	bool ParseLevel(const char* name, Level& level);
+
+	void SetLevel(Level level);
+	Level GetLevel();
+
+	// writes out everything logged so far; also runs at exit
+	void Flush();
+
+	constexpr unsigned int kRecordArgs = 8;
+	constexpr unsigned int kRecordStringBytes = 96;
+
+	union Arg
+	{
+		int64_t i;
+		uint64_t u;
+		double d;
+		const void* p;
+	};
+
+	struct Record
+	{
+		const char* format;
+		uint64_t timestamp_ns;
+		Level level;
+		uint8_t arg_count;
+		uint8_t string_bytes;
+		Arg args[kRecordArgs];
+		char strings[kRecordStringBytes];
+	};
+
+	// claims the next record of the calling thread's ring (nullptr if full)
+	// and publishes it
+	Record* Begin();
+	void Commit();
+
+	extern std::atomic<uint8_t> runtime_level;
+	inline bool Enabled(Level level)
+	{
+		return (uint8_t)level >= runtime_level.load(std::memory_order_relaxed);
+	}
+
+	inline void Encode(Record& record, const char* value)
+	{
+		// strings live in the record, the arg holds their offset
+		size_t space = kRecordStringBytes - record.string_bytes;
+		size_t length = value ? strnlen(value, space ? space - 1 : 0) : 0;
+		record.args[record.arg_count++].u = record.string_bytes;
+		if (space == 0) return;
+		memcpy(record.strings + record.string_bytes, value ? value : "", length);
+		record.strings[record.string_bytes + length] = '\0';
+		record.string_bytes += length + 1;
+	}
+	inline void Encode(Record& record, char* value) { Encode(record, (const char*)value); }
+
+	template <typename T>
+	inline void Encode(Record& record, T value)
+	{
+		static_assert(std::is_arithmetic<T>::value || std::is_pointer<T>::value ||
+					  std::is_enum<T>::value, "unsupported log argument");
+		Arg& arg = record.args[record.arg_count++];
+		if constexpr (std::is_floating_point<T>::value) arg.d = value;
+		else if constexpr (std::is_pointer<T>::value) arg.p = value;
+		else if constexpr (std::is_signed<T>::value) arg.i = (int64_t)value;
+		else arg.u = (uint64_t)value;
+	}
+
+	// never called; lets the compiler check formats against arguments
+	__attribute__((format(printf, 1, 2))) inline void CheckFormat(const char*, ...) {}
+
+	template <typename... Args>
+	inline void Write(Level level, const char* format, Args... args)
+	{
+		static_assert(sizeof...(Args) <= kRecordArgs, "too many log arguments");
+		if (!Enabled(level)) return;
+
+		Record* record = Begin();
+		if (record == nullptr) return;
+		record->format = format;
+		record->level = level;
+		record->arg_count = 0;
+		record->string_bytes = 0;
+		(Encode(*record, args), ...);
+		Commit();
+	}
+}
+
+#define LOG_AT(level, ...) \
+	do { \
+		if (false) Log::CheckFormat(__VA_ARGS__); \
+		Log::Write(level, __VA_ARGS__); \
+	} while (0)
+#define LOG_COMPILED_OUT(...) \
+	do { if (false) Log::CheckFormat(__VA_ARGS__); } while (0)
+
+#if SNG_LOG_LEVEL <= SNG_LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) LOG_AT(Log::Level::debug, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) LOG_COMPILED_OUT(__VA_ARGS__)
+#endif
+
+#if SNG_LOG_LEVEL <= SNG_LOG_LEVEL_INFO
+#define LOG_INFO(...) LOG_AT(Log::Level::info, __VA_ARGS__)
+#else
+#define LOG_INFO(...) LOG_COMPILED_OUT(__VA_ARGS__)
+#endif
+
+#if SNG_LOG_LEVEL <= SNG_LOG_LEVEL_WARN
+#define LOG_WARN(...) LOG_AT(Log::Level::warn, __VA_ARGS__)
+#else
+#define LOG_WARN(...) LOG_COMPILED_OUT(__VA_ARGS__)
+#endif
+
+#define LOG_ERROR(...) LOG_AT(Log::Level::error, __VA_ARGS__)
@@ -0,0 +1,452 @@
+#include "memory_accounting.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <new>
+#include <execinfo.h>
+#include <pthread.h>
+#include <unistd.h>
+
+namespace Memory
+{
+	struct Stats
+	{
+		std::atomic<uint64_t> live;
+		std::atomic<uint64_t> peak;
+		std::atomic<uint64_t> allocated; // bytes, ever
+		std::atomic<uint64_t> allocations;
+	};
+
+	enum OwnerState : uint8_t { owner_free, owner_open, owner_closed };
+
+	struct OwnerSlot
+	{
+		std::atomic<uint8_t> state;
+		char name[32];
+		Stats stats;
+	};
+
+	// Everything here is zero-initialized before any constructor runs, so
+	// allocations made during static initialization are accounted too.
+	constexpr unsigned int kTagCount = (unsigned int)Tag::count;
+	constexpr unsigned int kMaxOwners = 1024;
+	static Stats tag_stats[kTagCount];
+	static OwnerSlot owners[kMaxOwners];
+	static pthread_mutex_t owners_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+	static thread_local Tag current_tag = Tag::untagged;
+	static thread_local Owner current_owner = kProcessOwner;
+
+	constexpr uint64_t kMaxGuardReports = 16;
+	static std::atomic<int> guard_mode((int)GuardMode::off);
+	static std::atomic<uint64_t> hot_path_allocations(0);
+	static thread_local int hot_path_depth = 0;
+	static thread_local bool in_guard_report = false;
+
+	// precedes every block handed out by operator new
+	struct alignas(16) Header
+	{
+		uint64_t size;
+		Owner owner;
+		Tag tag;
+	};
+	static_assert(sizeof(Header) == 16, "header must keep blocks 16-byte aligned");
+
+	static const char* kTagNames[kTagCount] = {
+		"untagged", "respond_message", "client_queue", "client", "game_room", "player_map",
+		"diagnostics",
+	};
+
+	const char* TagName(Tag tag)
+	{
+		return kTagNames[(unsigned int)tag];
+	}
+
+	static void Add(Stats& stats, uint64_t bytes)
+	{
+		uint64_t live = stats.live.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+		stats.allocated.fetch_add(bytes, std::memory_order_relaxed);
+		stats.allocations.fetch_add(1, std::memory_order_relaxed);
+
+		uint64_t peak = stats.peak.load(std::memory_order_relaxed);
+		while (live > peak &&
+			   !stats.peak.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {}
+	}
+
+	void Charge(Tag tag, Owner owner, size_t bytes)
+	{
+		Add(tag_stats[(unsigned int)tag], bytes);
+		Add(owners[owner].stats, bytes);
+	}
+
+	void Release(Tag tag, Owner owner, size_t bytes)
+	{
+		tag_stats[(unsigned int)tag].live.fetch_sub(bytes, std::memory_order_relaxed);
+
+		OwnerSlot& slot = owners[owner];
+		uint64_t live = slot.stats.live.fetch_sub(bytes, std::memory_order_relaxed) - bytes;
+		if (live == 0 && owner != kProcessOwner)
+		{
+			uint8_t closed = owner_closed;
+			slot.state.compare_exchange_strong(closed, owner_free);
+		}
+	}
+
+	size_t LiveBytes(Tag tag)
+	{
+		return tag_stats[(unsigned int)tag].live.load(std::memory_order_relaxed);
+	}
+
+
+	Owner OpenOwner(const char* name)
+	{
+		pthread_mutex_lock(&owners_mutex);
+		for (Owner owner = 1; owner < kMaxOwners; owner++)
+		{
+			OwnerSlot& slot = owners[owner];
+			if (slot.state.load() != owner_free) continue;
+
+			snprintf(slot.name, sizeof(slot.name), "%s", name);
+			slot.stats.peak.store(0);
+			slot.stats.allocated.store(0);
+			slot.stats.allocations.store(0);
+			slot.state.store(owner_open);
+			pthread_mutex_unlock(&owners_mutex);
+			return owner;
+		}
+		pthread_mutex_unlock(&owners_mutex);
+		return kProcessOwner;
+	}
+
+	void CloseOwner(Owner owner)
+	{
+		if (owner == kProcessOwner) return;
+
+		OwnerSlot& slot = owners[owner];
+		slot.state.store(owner_closed);
+		// nothing left to free, so nothing will reopen the slot later
+		if (slot.stats.live.load() == 0)
+		{
+			uint8_t closed = owner_closed;
+			slot.state.compare_exchange_strong(closed, owner_free);
+		}
+	}
+
+
+	Scope::Scope(Tag tag, Owner owner)
+	{
+		mPreviousTag = current_tag;
+		mPreviousOwner = current_owner;
+		current_tag = tag;
+		current_owner = owner;
+	}
+
+	Scope::Scope(Tag tag)
+		: Scope(tag, current_owner)
+	{
+	}
+
+	Scope::~Scope()
+	{
+		current_tag = mPreviousTag;
+		current_owner = mPreviousOwner;
+	}
+
+
+	void SetAllocationGuard(GuardMode mode)
+	{
+		// the first backtrace() loads the unwinder, which allocates
+		void* frames[1];
+		backtrace(frames, 1);
+		guard_mode.store((int)mode);
+	}
+
+	bool ParseGuardMode(const char* name, GuardMode& mode)
+	{
+		static const char* kNames[] = { "off", "report", "abort" };
+		for (int i = 0; i < 3; i++)
+		{
+			if (strcmp(name, kNames[i]) == 0)
+			{
+				mode = (GuardMode)i;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	uint64_t HotPathAllocations()
+	{
+		return hot_path_allocations.load(std::memory_order_relaxed);
+	}
+
+	HotPath::HotPath()
+	{
+		mActive = true;
+		hot_path_depth++;
+	}
+
+	void HotPath::Leave()
+	{
+		if (!mActive) return;
+		mActive = false;
+		hot_path_depth--;
+	}
+
+	static void CheckHotPath(size_t size)
+	{
+		if (hot_path_depth == 0 || in_guard_report) return;
+		int mode = guard_mode.load(std::memory_order_relaxed);
+		if (mode == (int)GuardMode::off) return;
+
+		uint64_t count = hot_path_allocations.fetch_add(1, std::memory_order_relaxed) + 1;
+		if (count > kMaxGuardReports && mode != (int)GuardMode::abort) return;
+
+		// stderr, unbuffered and without allocating
+		in_guard_report = true;
+		char line[128];
+		int length = snprintf(line, sizeof(line),
+							  "hot path allocation #%lu: %zu bytes (%s)\n",
+							  (unsigned long)count, size, kTagNames[(unsigned int)current_tag]);
+		ssize_t written = write(STDERR_FILENO, line, length);
+		(void)written;
+		void* frames[32];
+		int depth = backtrace(frames, 32);
+		backtrace_symbols_fd(frames, depth, STDERR_FILENO);
+		in_guard_report = false;
+
+		if (mode == (int)GuardMode::abort) abort();
+	}
+
+	static void* Allocate(size_t size)
+	{
+		CheckHotPath(size);
+		Header* header = (Header*)malloc(sizeof(Header) + size);
+		if (header == nullptr) return nullptr;
+
+		header->size = size;
+		header->owner = current_owner;
+		header->tag = current_tag;
+		Charge(header->tag, header->owner, size);
+		return header + 1;
+	}
+
+	static void Free(void* block)
+	{
+		if (block == nullptr) return;
+
+		Header* header = (Header*)block - 1;
+		Release(header->tag, header->owner, header->size);
+		free(header);
+	}
+
+	// Over-aligned types (eg. cache-line aligned members) get a padding of
+	// one alignment unit in front, with the header at its end.
+	static void* AllocateAligned(size_t size, size_t alignment)
+	{
+		CheckHotPath(size);
+		if (alignment < sizeof(Header)) alignment = sizeof(Header);
+		size_t total = (alignment + size + alignment - 1) / alignment * alignment;
+		char* base = (char*)aligned_alloc(alignment, total);
+		if (base == nullptr) return nullptr;
+
+		Header* header = (Header*)(base + alignment) - 1;
+		header->size = size;
+		header->owner = current_owner;
+		header->tag = current_tag;
+		Charge(header->tag, header->owner, size);
+		return base + alignment;
+	}
+
+	static void FreeAligned(void* block, size_t alignment)
+	{
+		if (block == nullptr) return;
+		if (alignment < sizeof(Header)) alignment = sizeof(Header);
+
+		Header* header = (Header*)block - 1;
+		Release(header->tag, header->owner, header->size);
+		free((char*)block - alignment);
+	}
+
+
+	void AppendReport(std::string& out)
+	{
+		// allocation rates are measured between reports
+		static pthread_mutex_t report_mutex = PTHREAD_MUTEX_INITIALIZER;
+		static uint64_t last_allocated[kTagCount];
+		static double last_seconds = 0;
+
+		pthread_mutex_lock(&report_mutex);
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		double now_seconds = ts.tv_sec + ts.tv_nsec * 1e-9;
+		double interval = last_seconds > 0 ? now_seconds - last_seconds : 0;
+		last_seconds = now_seconds;
+
+		char line[256];
+		snprintf(line, sizeof(line), "%-20s %14s %14s %14s %12s\n",
+				 "subsystem", "live bytes", "peak bytes", "allocations", "bytes/s");
+		out += line;
+		for (unsigned int i = 0; i < kTagCount; i++)
+		{
+			const Stats& stats = tag_stats[i];
+			uint64_t allocated = stats.allocated.load();
+			double rate = interval > 0 ? (allocated - last_allocated[i]) / interval : 0;
+			last_allocated[i] = allocated;
+			snprintf(line, sizeof(line), "%-20s %14lu %14lu %14lu %12.0f\n", kTagNames[i],
+					 (unsigned long)stats.live.load(), (unsigned long)stats.peak.load(),
+					 (unsigned long)stats.allocations.load(), rate);
+			out += line;
+		}
+
+		snprintf(line, sizeof(line), "%-20s %14s %14s %14s %12s\n",
+				 "owner", "live bytes", "peak bytes", "allocations", "state");
+		out += line;
+		for (Owner owner = 0; owner < kMaxOwners; owner++)
+		{
+			const OwnerSlot& slot = owners[owner];
+			uint8_t state = slot.state.load();
+			if (owner != kProcessOwner && state == owner_free) continue;
+
+			snprintf(line, sizeof(line), "%-20s %14lu %14lu %14lu %12s\n",
+					 owner == kProcessOwner ? "process" : slot.name,
+					 (unsigned long)slot.stats.live.load(), (unsigned long)slot.stats.peak.load(),
+					 (unsigned long)slot.stats.allocations.load(),
+					 state == owner_closed ? "leaking" : "open");
+			out += line;
+		}
+		pthread_mutex_unlock(&report_mutex);
+	}
+
+	void AppendPrometheus(std::string& out)
+	{
+		static const char* kSeries[4][2] = {
+			{ "live_bytes", "gauge" },
+			{ "peak_bytes", "gauge" },
+			{ "allocated_bytes_total", "counter" },
+			{ "allocations_total", "counter" },
+		};
+		char line[256];
+
+		for (unsigned int series = 0; series < 4; series++)
+		{
+			snprintf(line, sizeof(line), "# TYPE sng_memory_%s %s\n",
+					 kSeries[series][0], kSeries[series][1]);
+			out += line;
+			for (unsigned int i = 0; i < kTagCount; i++)
+			{
+				const std::atomic<uint64_t>* values[] = {
+					&tag_stats[i].live, &tag_stats[i].peak,
+					&tag_stats[i].allocated, &tag_stats[i].allocations,
+				};
+				snprintf(line, sizeof(line), "sng_memory_%s{subsystem=\"%s\"} %lu\n",
+						 kSeries[series][0], kTagNames[i], (unsigned long)values[series]->load());
+				out += line;
+			}
+		}
+
+		snprintf(line, sizeof(line), "# TYPE sng_hot_path_allocations_total counter\n"
+				 "sng_hot_path_allocations_total %lu\n", (unsigned long)HotPathAllocations());
+		out += line;
+
+		for (unsigned int series = 0; series < 4; series++)
+		{
+			snprintf(line, sizeof(line), "# TYPE sng_memory_owner_%s %s\n",
+					 kSeries[series][0], kSeries[series][1]);
+			out += line;
+			for (Owner owner = 0; owner < kMaxOwners; owner++)
+			{
+				const OwnerSlot& slot = owners[owner];
+				uint8_t state = slot.state.load();
+				if (owner != kProcessOwner && state == owner_free) continue;
+
+				const std::atomic<uint64_t>* values[] = {
+					&slot.stats.live, &slot.stats.peak,
+					&slot.stats.allocated, &slot.stats.allocations,
+				};
+				snprintf(line, sizeof(line),
+						 "sng_memory_owner_%s{owner=\"%s\",state=\"%s\"} %lu\n",
+						 kSeries[series][0], owner == kProcessOwner ? "process" : slot.name,
+						 state == owner_closed ? "leaking" : "open",
+						 (unsigned long)values[series]->load());
+				out += line;
+			}
+		}
+	}
+}
+
+
+void* operator new(size_t size)
+{
+	void* block = Memory::Allocate(size);
+	if (block == nullptr) throw std::bad_alloc();
+	return block;
+}
+
+void* operator new[](size_t size)
+{
+	void* block = Memory::Allocate(size);
+	if (block == nullptr) throw std::bad_alloc();
+	return block;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return Memory::Allocate(size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return Memory::Allocate(size); }
+
+void operator delete(void* block) noexcept { Memory::Free(block); }
+void operator delete[](void* block) noexcept { Memory::Free(block); }
+void operator delete(void* block, size_t) noexcept { Memory::Free(block); }
+void operator delete[](void* block, size_t) noexcept { Memory::Free(block); }
+void operator delete(void* block, const std::nothrow_t&) noexcept { Memory::Free(block); }
+void operator delete[](void* block, const std::nothrow_t&) noexcept { Memory::Free(block); }
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+	void* block = Memory::AllocateAligned(size, (size_t)alignment);
+	if (block == nullptr) throw std::bad_alloc();
+	return block;
+}
+
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+	void* block = Memory::AllocateAligned(size, (size_t)alignment);
+	if (block == nullptr) throw std::bad_alloc();
+	return block;
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	return Memory::AllocateAligned(size, (size_t)alignment);
+}
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	return Memory::AllocateAligned(size, (size_t)alignment);
+}
+
+void operator delete(void* block, std::align_val_t alignment) noexcept
+{
+	Memory::FreeAligned(block, (size_t)alignment);
+}
+void operator delete[](void* block, std::align_val_t alignment) noexcept
+{
+	Memory::FreeAligned(block, (size_t)alignment);
+}
+void operator delete(void* block, size_t, std::align_val_t alignment) noexcept
+{
+	Memory::FreeAligned(block, (size_t)alignment);
+}
+void operator delete[](void* block, size_t, std::align_val_t alignment) noexcept
+{
+	Memory::FreeAligned(block, (size_t)alignment);
+}
+void operator delete(void* block, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	Memory::FreeAligned(block, (size_t)alignment);
+}
+void operator delete[](void* block, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	Memory::FreeAligned(block, (size_t)alignment);
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Tagged heap accounting.
+//
+// Linking memory_accounting.o replaces the global operator new and delete.
+// Every allocation is charged to the subsystem tag and owner (a room or a
+// connection) of the innermost MemoryScope on the allocating thread, and
+// remembers them, so it is credited back correctly whichever thread frees
+// it. Memory that does not come from operator new (eg. static tables) can be
+// charged by hand.
+namespace Memory
+{
+	enum class Tag : uint8_t
+	{
+		untagged,
+		respond_message,
+		client_queue,
+		client,
+		game_room,
+		player_map,
+		diagnostics, // metrics, trace and log buffers
+		count
+	};
+
+	const char* TagName(Tag tag);
+
+	// Owners are small handles into a fixed table; 0 is the process itself.
+	typedef uint16_t Owner;
+	constexpr Owner kProcessOwner = 0;
+
+	// Returns kProcessOwner if the table is full. `name` is copied.
+	Owner OpenOwner(const char* name);
+	// The owner's slot is reused once it is closed and all its memory is
+	// freed; a closed owner that keeps live bytes shows up as a leak.
+	void CloseOwner(Owner owner);
+
+	// Charges all allocations of the current thread to `tag` and `owner`
+	// until destroyed. The second form keeps the current owner.
+	class Scope
+	{
+	public:
+		Scope(Tag tag, Owner owner);
+		explicit Scope(Tag tag);
+		~Scope();
+
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+
+	private:
+		Tag mPreviousTag;
+		Owner mPreviousOwner;
+	};
+
+	// for memory that does not come from operator new
+	void Charge(Tag tag, Owner owner, size_t bytes);
+	void Release(Tag tag, Owner owner, size_t bytes);
+
+	size_t LiveBytes(Tag tag);
+
+	// Steady-state allocation guard: once armed, any allocation inside a
+	// HotPath is counted and reported with a stack trace on stderr (the
+	// first few), or aborts the process.
+	enum class GuardMode { off, report, abort };
+	void SetAllocationGuard(GuardMode mode);
+	// returns false for unknown names ("off", "report", "abort")
+	bool ParseGuardMode(const char* name, GuardMode& mode);
+	uint64_t HotPathAllocations();
+
+	// Marks the current thread as being on the hot path until destroyed or
+	// Leave() is called. Nests.
+	class HotPath
+	{
+	public:
+		HotPath();
+		~HotPath() { Leave(); }
+		void Leave();
+
+		HotPath(const HotPath&) = delete;
+		HotPath& operator=(const HotPath&) = delete;
+
+	private:
+		bool mActive;
+	};
+
+	// live bytes, peak and allocation rate (since the previous report) per
+	// subsystem and per open or leaking owner
+	void AppendReport(std::string& out);
+	void AppendPrometheus(std::string& out);
+}
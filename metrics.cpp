@@ -0,0 +1,310 @@
+#include "metrics.hpp"
+#include "memory_accounting.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <vector>
+#include <algorithm>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+namespace Metrics
+{
+	constexpr unsigned int kHistogramCount = (unsigned int)Histogram::count;
+	constexpr unsigned int kCounterCount = (unsigned int)Counter::count;
+
+	static const char* kHistogramNames[kHistogramCount] = {
+		"sng_receive_to_parse_ns",
+		"sng_game_lock_wait_ns",
+		"sng_enqueue_to_write_ns",
+		"sng_tick_duration_ns",
+		"sng_outbound_queue_depth",
+		"sng_socket_rx_queue_ns",
+		"sng_wire_to_wire_ns",
+	};
+	static const char* kCounterNames[kCounterCount] = {
+		"sng_bytes_received_total",
+		"sng_bytes_sent_total",
+		"sng_messages_received_total",
+		"sng_messages_sent_total",
+		"sng_tick_frame_allocations_total",
+		"sng_move_response_allocations_total",
+	};
+
+	// A thread's histograms are allocated on its first Record() of each
+	// (they are about 8 KB apiece and most threads record only a few).
+	// Readers hold registry_mutex, which also keeps them from being freed.
+	struct ThreadMetrics
+	{
+		std::atomic<HdrHistogram*> histograms[kHistogramCount];
+		std::atomic<uint64_t> counters[kCounterCount];
+
+		ThreadMetrics()
+		{
+			for (auto& histogram : histograms) histogram.store(nullptr);
+			for (auto& counter : counters) counter.store(0);
+		}
+		~ThreadMetrics()
+		{
+			for (auto& histogram : histograms) delete histogram.load();
+		}
+	};
+
+	// all live threads' metrics, plus what exited threads left behind
+	static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+	static std::vector<ThreadMetrics*> registry;
+	static HdrHistogram retired_histograms[kHistogramCount];
+	static std::atomic<uint64_t> retired_counters[kCounterCount];
+
+	// registers on first use and retires on thread exit
+	struct ThreadSlot
+	{
+		ThreadMetrics* metrics = nullptr;
+
+		ThreadMetrics* Get()
+		{
+			if (metrics == nullptr)
+			{
+				Memory::Scope scope(Memory::Tag::diagnostics);
+				metrics = new ThreadMetrics();
+				pthread_mutex_lock(&registry_mutex);
+				registry.push_back(metrics);
+				pthread_mutex_unlock(&registry_mutex);
+			}
+			return metrics;
+		}
+
+		~ThreadSlot()
+		{
+			if (metrics == nullptr) return;
+
+			pthread_mutex_lock(&registry_mutex);
+			registry.erase(std::find(registry.begin(), registry.end(), metrics));
+			for (unsigned int i = 0; i < kHistogramCount; i++)
+			{
+				HdrHistogram* histogram = metrics->histograms[i].load();
+				if (histogram) retired_histograms[i].Merge(*histogram);
+			}
+			for (unsigned int i = 0; i < kCounterCount; i++)
+			{
+				retired_counters[i].fetch_add(metrics->counters[i].load());
+			}
+			pthread_mutex_unlock(&registry_mutex);
+			delete metrics;
+		}
+	};
+	static thread_local ThreadSlot thread_slot;
+
+
+	static HdrHistogram* OwnHistogram(Histogram histogram)
+	{
+		std::atomic<HdrHistogram*>& slot = thread_slot.Get()->histograms[(unsigned int)histogram];
+		HdrHistogram* own = slot.load(std::memory_order_relaxed);
+		if (own == nullptr)
+		{
+			Memory::Scope scope(Memory::Tag::diagnostics);
+			own = new HdrHistogram();
+			slot.store(own, std::memory_order_release);
+		}
+		return own;
+	}
+
+	void Record(Histogram histogram, uint64_t value)
+	{
+		OwnHistogram(histogram)->Record(value);
+	}
+
+	void Reserve(Histogram histogram)
+	{
+		OwnHistogram(histogram);
+	}
+
+	void Add(Counter counter, uint64_t delta)
+	{
+		std::atomic<uint64_t>& value = thread_slot.Get()->counters[(unsigned int)counter];
+		value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+	}
+
+	void MergeHistograms(HdrHistogram* out)
+	{
+		pthread_mutex_lock(&registry_mutex);
+		for (unsigned int i = 0; i < kHistogramCount; i++)
+		{
+			out[i].Merge(retired_histograms[i]);
+			for (ThreadMetrics* metrics : registry)
+			{
+				HdrHistogram* histogram = metrics->histograms[i].load(std::memory_order_acquire);
+				if (histogram) out[i].Merge(*histogram);
+			}
+		}
+		pthread_mutex_unlock(&registry_mutex);
+	}
+
+	uint64_t CounterValue(Counter counter)
+	{
+		const unsigned int index = (unsigned int)counter;
+		pthread_mutex_lock(&registry_mutex);
+		uint64_t total = retired_counters[index].load(std::memory_order_relaxed);
+		for (ThreadMetrics* metrics : registry)
+		{
+			total += metrics->counters[index].load(std::memory_order_relaxed);
+		}
+		pthread_mutex_unlock(&registry_mutex);
+		return total;
+	}
+
+	void AppendPrometheus(std::string& out)
+	{
+		static const double kQuantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+		char line[256];
+
+		// merged copies are large, so keep them off the stack
+		std::vector<HdrHistogram> merged(kHistogramCount);
+		MergeHistograms(merged.data());
+
+		for (unsigned int i = 0; i < kHistogramCount; i++)
+		{
+			const char* name = kHistogramNames[i];
+			snprintf(line, sizeof(line), "# TYPE %s summary\n", name);
+			out += line;
+			for (double quantile : kQuantiles)
+			{
+				snprintf(line, sizeof(line), "%s{quantile=\"%g\"} %lu\n", name, quantile,
+						 (unsigned long)merged[i].ValueAtPercentile(quantile * 100.0));
+				out += line;
+			}
+			snprintf(line, sizeof(line), "%s_sum %lu\n%s_count %lu\n",
+					 name, (unsigned long)merged[i].Sum(),
+					 name, (unsigned long)merged[i].Count());
+			out += line;
+			// a summary has no max series, so it is a family of its own
+			snprintf(line, sizeof(line), "# TYPE %s_max gauge\n%s_max %lu\n",
+					 name, name, (unsigned long)merged[i].Max());
+			out += line;
+		}
+
+		for (unsigned int i = 0; i < kCounterCount; i++)
+		{
+			snprintf(line, sizeof(line), "# TYPE %s counter\n%s %lu\n",
+					 kCounterNames[i], kCounterNames[i],
+					 (unsigned long)CounterValue((Counter)i));
+			out += line;
+		}
+	}
+
+
+	// back-off bounds while accept() keeps failing, eg. out of fds
+	static constexpr long kAcceptRetryMinMs = 10;
+	static constexpr long kAcceptRetryMaxMs = 1000;
+
+	struct ExporterArgs
+	{
+		int listenfd;
+		void (*append_extra)(std::string& out);
+		char path[108];
+	};
+
+	// the running exporter, for StopExporter(); it lives as long as the process
+	static ExporterArgs* exporter = nullptr;
+	static std::atomic_bool stopping(false);
+
+	static void* ExporterThread(void* argsPtr)
+	{
+		ExporterArgs* args = (ExporterArgs*)argsPtr;
+		std::string dump;
+
+		long retry_ms = kAcceptRetryMinMs;
+		while (!stopping.load())
+		{
+			int connfd = accept(args->listenfd, nullptr, nullptr);
+			if (connfd < 0)
+			{
+				if (errno == EINTR || errno == ECONNABORTED) continue;
+				if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+				{
+					// the condition usually passes; do not spin while it lasts
+					fprintf(stderr, "Metrics exporter: accept failed: %s, retrying in %ld ms\n",
+							strerror(errno), retry_ms);
+					struct timespec delay = { retry_ms / 1000, (retry_ms % 1000) * 1000000 };
+					nanosleep(&delay, nullptr);
+					retry_ms = std::min(retry_ms * 2, kAcceptRetryMaxMs);
+					continue;
+				}
+				// the socket was shut down (StopExporter) or is unusable
+				if (!stopping.load())
+				{
+					fprintf(stderr, "Metrics exporter: accept failed: %s, metrics stop\n",
+							strerror(errno));
+				}
+				break;
+			}
+			retry_ms = kAcceptRetryMinMs;
+
+			dump.clear();
+			AppendPrometheus(dump);
+			if (args->append_extra) args->append_extra(dump);
+
+			size_t written = 0;
+			while (written < dump.size())
+			{
+				ssize_t n = write(connfd, dump.data() + written, dump.size() - written);
+				if (n <= 0) break;
+				written += n;
+			}
+			close(connfd);
+		}
+		unlink(args->path);
+		return nullptr;
+	}
+
+	void StopExporter()
+	{
+		if (exporter == nullptr || stopping.exchange(true)) return;
+		// wakes the accept() in ExporterThread
+		shutdown(exporter->listenfd, SHUT_RDWR);
+		unlink(exporter->path);
+	}
+
+	bool StartExporter(const char* path, void (*append_extra)(std::string& out))
+	{
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if (strlen(path) >= sizeof(addr.sun_path)) return false;
+		strcpy(addr.sun_path, path);
+
+		int listenfd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (listenfd < 0) return false;
+		unlink(path);
+		if (bind(listenfd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+			listen(listenfd, 16) != 0)
+		{
+			fprintf(stderr, "Metrics exporter: cannot listen on %s: %s\n",
+					path, strerror(errno));
+			close(listenfd);
+			return false;
+		}
+
+		ExporterArgs* args = new ExporterArgs{ listenfd, append_extra, {} };
+		strcpy(args->path, path);
+		pthread_t tid;
+		if (pthread_create(&tid, nullptr, ExporterThread, args) != 0)
+		{
+			close(listenfd);
+			unlink(path);
+			delete args;
+			return false;
+		}
+		pthread_detach(tid);
+		exporter = args;
+		// the socket file goes with the process on a normal exit
+		atexit(StopExporter);
+		return true;
+	}
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include "hdr_histogram.hpp"
+
+// Low-overhead process metrics.
+//
+// Every thread records into its own histograms and counters (registered on
+// first use), so recording never contends. Readers merge all threads on
+// demand; threads that exit fold their data into a retired total first.
+namespace Metrics
+{
+	// latencies are recorded in nanoseconds
+	enum class Histogram
+	{
+		receive_to_parse,   // request line read -> request classified
+		game_lock_wait,     // waiting to acquire the game mutex
+		enqueue_to_write,   // response created -> written to the socket
+		tick_duration,      // work done per server tick
+		outbound_queue_depth, // entries left after each pop (not ns)
+		socket_rx_queue,    // kernel receive timestamp -> request line read
+		wire_to_wire,       // kernel receive of a request -> kernel send of its broadcast
+		count
+	};
+
+	enum class Counter
+	{
+		bytes_received,
+		bytes_sent,
+		messages_received,
+		messages_sent,
+		tick_frame_allocations, // the tick frame pool was exhausted
+		move_response_allocations, // a receive thread's move pool was exhausted
+		count
+	};
+
+	void Record(Histogram histogram, uint64_t value);
+	// allocates this thread's `histogram` ahead of its first Record(), for
+	// threads that record it on a hot path (see Memory::HotPath)
+	void Reserve(Histogram histogram);
+	void Add(Counter counter, uint64_t delta = 1);
+
+	// merges every thread's data; `out` must have Histogram::count entries
+	void MergeHistograms(HdrHistogram* out);
+	uint64_t CounterValue(Counter counter);
+
+	// Prometheus text exposition of everything above
+	void AppendPrometheus(std::string& out);
+
+	// Serves a Prometheus dump to every connection on a Unix-domain socket
+	// at `path`, from its own thread. `append_extra` (may be nullptr) adds
+	// caller-specific series, eg. per-connection counters.
+	// Returns false if the socket could not be created. One exporter per
+	// process.
+	bool StartExporter(const char* path, void (*append_extra)(std::string& out));
+
+	// Stops serving and removes the socket file; async-signal-safe. Also
+	// runs at exit.
+	void StopExporter();
+
+	inline uint64_t NowNs()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	}
+}
@@ -0,0 +1,226 @@
+#include "outbound_queue.hpp"
+#include "protocol.hpp"
+#include "server_settings.hpp"
+#include "metrics.hpp"
+
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+
+RespondMessage::RespondMessage(const char* message)
+{
+	mMessageLength = strlen(message);
+	assert(mMessageLength < Protocol::kMaxMessageLength);
+	mCapacity = Protocol::kMaxMessageLength - 1;
+	mpMessage = new char[Protocol::kMaxMessageLength];
+	strcpy(mpMessage, message);
+	mKind = Kind::generic;
+	mSubject = kInvalidPlayerId;
+	mCreatedNs = Metrics::NowNs();
+	mFlowId = 0;
+	mKernelRxNs = 0;
+}
+
+RespondMessage::RespondMessage(const char* message, size_t length)
+{
+	mMessageLength = length;
+	mCapacity = length;
+	mpMessage = new char[length + 1];
+	memcpy(mpMessage, message, length);
+	mpMessage[length] = '\0';
+	mKind = Kind::generic;
+	mSubject = kInvalidPlayerId;
+	mCreatedNs = Metrics::NowNs();
+	mFlowId = 0;
+	mKernelRxNs = 0;
+}
+
+RespondMessage::RespondMessage(const char* message, Kind kind, PlayerId subject)
+	: RespondMessage(message)
+{
+	mKind = kind;
+	mSubject = subject;
+}
+
+RespondMessage::RespondMessage(size_t capacity)
+{
+	mMessageLength = 0;
+	mCapacity = capacity;
+	mpMessage = new char[capacity + 1];
+	mpMessage[0] = '\0';
+	mKind = Kind::generic;
+	mSubject = kInvalidPlayerId;
+	mCreatedNs = Metrics::NowNs();
+	mFlowId = 0;
+	mKernelRxNs = 0;
+}
+
+RespondMessage::~RespondMessage()
+{
+	delete[] mpMessage;
+}
+
+void RespondMessage::Refill(size_t length, Kind kind, PlayerId subject)
+{
+	assert(length <= mCapacity);
+	mMessageLength = length;
+	mpMessage[length] = '\0';
+	mKind = kind;
+	mSubject = subject;
+	mCreatedNs = Metrics::NowNs();
+	mFlowId = 0;
+	mKernelRxNs = 0;
+}
+
+
+RespondMessagePool::RespondMessagePool(size_t message_capacity, size_t messages)
+{
+	mMessageCapacity = message_capacity;
+	mNext = 0;
+	mFallbacks = 0;
+	for (size_t i = 0; i < messages; i++)
+	{
+		mMessages.push_back(NewRespondMessage(message_capacity));
+	}
+}
+
+std::shared_ptr<RespondMessage> RespondMessagePool::Acquire()
+{
+	for (size_t i = 0; i < mMessages.size(); i++)
+	{
+		std::shared_ptr<RespondMessage>& message = mMessages[(mNext + i) % mMessages.size()];
+		if (message.use_count() != 1) continue;
+
+		// pairs with the release of the last queue dropping its reference,
+		// so its reads of the old contents are done before we overwrite them
+		std::atomic_thread_fence(std::memory_order_acquire);
+		mNext = (mNext + i + 1) % mMessages.size();
+		return message;
+	}
+	mFallbacks++;
+	return NewRespondMessage(mMessageCapacity);
+}
+
+
+int64_t MonotonicNowNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+OutboundQueue::OutboundQueue(std::atomic<size_t>* global_bytes)
+{
+	{
+		Memory::Scope scope(Memory::Tag::client_queue);
+		mRing.resize(ServerSettings::kClientQueueMaxEntries);
+	}
+	mHead = mTail = 0;
+	memset(mPendingMove, 0, sizeof(mPendingMove));
+	mBytes = 0;
+	mpGlobalBytes = global_bytes;
+	mOverBudgetSinceNs = 0;
+	mPeakBytes = 0;
+	mCoalesced = 0;
+	mDropped = 0;
+	mShed = 0;
+}
+
+OutboundQueue::~OutboundQueue()
+{
+	Clear();
+}
+
+OutboundQueue::PushResult OutboundQueue::Push(const std::shared_ptr<RespondMessage>& message)
+{
+	const size_t length = message->GetMessageLength();
+	const size_t capacity = mRing.size();
+
+	// replace a waiting move of the same player in place
+	uint32_t slot = SlotHandleIndex(message->GetSubject());
+	if (message->GetKind() == RespondMessage::Kind::move &&
+		slot < GameSettings::kMaxPlayers && mPendingMove[slot] > mHead)
+	{
+		std::shared_ptr<RespondMessage>& waiting = mRing[(mPendingMove[slot] - 1) % capacity];
+		if (waiting->GetKind() == RespondMessage::Kind::move &&
+			waiting->GetSubject() == message->GetSubject())
+		{
+			size_t old_length = waiting->GetMessageLength();
+			mBytes = mBytes - old_length + length;
+			mpGlobalBytes->fetch_add(length - old_length);
+			waiting = message;
+			mCoalesced++;
+			UpdateBudgetState();
+			return PushResult::coalesced;
+		}
+	}
+
+	if (Depth() >= capacity || mBytes + length > ServerSettings::kClientQueueHardBytes)
+	{
+		mDropped++;
+		return PushResult::dropped;
+	}
+	if (mpGlobalBytes->load(std::memory_order_relaxed) + length > ServerSettings::kGlobalQueueBytes)
+	{
+		mDropped++;
+		mShed++;
+		return PushResult::shed;
+	}
+
+	if (message->GetKind() == RespondMessage::Kind::move &&
+		slot < GameSettings::kMaxPlayers)
+	{
+		mPendingMove[slot] = mTail + 1;
+	}
+	mRing[mTail % capacity] = message;
+	mTail++;
+	mBytes += length;
+	mpGlobalBytes->fetch_add(length);
+	if (mBytes > mPeakBytes) mPeakBytes = mBytes;
+	UpdateBudgetState();
+	return PushResult::queued;
+}
+
+std::shared_ptr<RespondMessage> OutboundQueue::Pop()
+{
+	if (Empty()) return nullptr;
+
+	std::shared_ptr<RespondMessage> message;
+	message.swap(mRing[mHead % mRing.size()]);
+	mHead++;
+
+	mBytes -= message->GetMessageLength();
+	mpGlobalBytes->fetch_sub(message->GetMessageLength());
+	UpdateBudgetState();
+	return message;
+}
+
+void OutboundQueue::Clear()
+{
+	mDropped += Depth();
+	while (!Empty())
+	{
+		Pop();
+	}
+}
+
+void OutboundQueue::UpdateBudgetState()
+{
+	if (mBytes <= ServerSettings::kClientQueueSoftBytes)
+	{
+		mOverBudgetSinceNs = 0;
+	}
+	else if (mOverBudgetSinceNs == 0)
+	{
+		mOverBudgetSinceNs = MonotonicNowNs();
+	}
+}
+
+bool OutboundQueue::OverBudgetTooLong(int64_t now_ns) const
+{
+	return mOverBudgetSinceNs != 0 &&
+		now_ns - mOverBudgetSinceNs > ServerSettings::kSlowClientGraceMs * 1000000;
+}
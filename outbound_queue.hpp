@@ -0,0 +1,160 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "player.hpp"
+#include "game_settings.hpp"
+#include "memory_accounting.hpp"
+
+// A message queued for sending to clients. One instance is usually shared
+// by every client's queue it was broadcast to.
+class RespondMessage
+{
+public:
+	enum class Kind
+	{
+		generic,
+		move // SRV_RES_MOVE, superseded by any later move of the same player
+	};
+
+	RespondMessage(const char* message);
+	// multi-line broadcast frame, eg. per-tick projectile state
+	RespondMessage(const char* message, size_t length);
+	// SRV_RES_MOVE for `subject`
+	RespondMessage(const char* message, Kind kind, PlayerId subject);
+	// empty reusable message of up to `capacity` bytes, see RespondMessagePool
+	explicit RespondMessage(size_t capacity);
+	~RespondMessage();
+
+	// Reuses the message: the caller has written `length` bytes into
+	// GetMessage() (at most GetCapacity()).
+	void Refill(size_t length, Kind kind = Kind::generic, PlayerId subject = kInvalidPlayerId);
+
+	char* GetMessage() { return mpMessage; }
+	size_t GetMessageLength() { return mMessageLength; }
+	size_t GetCapacity() const { return mCapacity; }
+	Kind GetKind() const { return mKind; }
+	PlayerId GetSubject() const { return mSubject; }
+	uint64_t GetCreatedNs() const { return mCreatedNs; }
+
+	// ties the write back to the request that caused it, see trace.hpp
+	void SetFlowId(uint64_t flow_id) { mFlowId = flow_id; }
+	uint64_t GetFlowId() const { return mFlowId; }
+
+	// kernel receive time of that request (CLOCK_REALTIME), 0 if unknown
+	void SetKernelRxNs(int64_t rx_ns) { mKernelRxNs = rx_ns; }
+	int64_t GetKernelRxNs() const { return mKernelRxNs; }
+
+private:
+	char* mpMessage;
+	size_t mMessageLength;
+	size_t mCapacity;
+	Kind mKind;
+	PlayerId mSubject;
+	uint64_t mCreatedNs; // for enqueue-to-write latency
+	uint64_t mFlowId;
+	int64_t mKernelRxNs; // for wire-to-wire latency
+};
+
+// make_shared<RespondMessage>, charged to the respond_message subsystem
+template <typename... Args>
+std::shared_ptr<RespondMessage> NewRespondMessage(Args&&... args)
+{
+	Memory::Scope scope(Memory::Tag::respond_message);
+	return std::make_shared<RespondMessage>(std::forward<Args>(args)...);
+}
+
+// Messages allocated once and handed out again as soon as no client queue
+// holds them any more, so the steady state does not allocate: the tick
+// loop's broadcast frames, and each receive thread's move responses. Only
+// a backlog deeper than the pool falls back to a fresh message. Used by
+// one thread.
+class RespondMessagePool
+{
+public:
+	RespondMessagePool(size_t message_capacity, size_t messages);
+
+	// a message no client queue references; fill it and call Refill()
+	std::shared_ptr<RespondMessage> Acquire();
+
+	uint64_t FallbackCount() const { return mFallbacks; }
+
+private:
+	std::vector<std::shared_ptr<RespondMessage>> mMessages;
+	size_t mNext;
+	size_t mMessageCapacity;
+	uint64_t mFallbacks;
+};
+
+// Bounded per-client outbound queue.
+//
+// Entries live in a fixed ring allocated once, and the queue tracks the
+// bytes it holds against a per-client budget and a process-wide counter.
+// A move for a player who already has a move waiting is coalesced into the
+// waiting entry, so a slow reader only ever gets the latest position.
+// Note that the coalesced move keeps the queue position of the entry it
+// replaces.
+//
+// Not thread-safe: the owner serializes access (the server uses the
+// client's mutex).
+class OutboundQueue
+{
+public:
+	enum class PushResult
+	{
+		queued,
+		coalesced,
+		dropped, // over this client's hard or entry limit
+		shed // over the global limit; not queued, but not the client's fault
+	};
+
+	OutboundQueue(std::atomic<size_t>* global_bytes);
+	~OutboundQueue();
+
+	PushResult Push(const std::shared_ptr<RespondMessage>& message);
+
+	// returns nullptr if empty
+	std::shared_ptr<RespondMessage> Pop();
+
+	// drops everything still queued, eg. on disconnect
+	void Clear();
+
+	bool Empty() const { return mHead == mTail; }
+	size_t Depth() const { return mTail - mHead; }
+	size_t Bytes() const { return mBytes; }
+
+	// true once the queue has been above the soft budget for longer than
+	// the grace period, without draining below it in between
+	bool OverBudgetTooLong(int64_t now_ns) const;
+
+	// statistics
+	size_t PeakBytes() const { return mPeakBytes; }
+	uint64_t CoalescedCount() const { return mCoalesced; }
+	uint64_t DroppedCount() const { return mDropped; } // shed ones included
+	uint64_t ShedCount() const { return mShed; }
+
+private:
+	void UpdateBudgetState();
+
+	std::vector<std::shared_ptr<RespondMessage>> mRing;
+	uint64_t mHead; // sequence number of the oldest entry
+	uint64_t mTail; // sequence number of the next entry
+
+	// per player slot: sequence number + 1 of its queued move, or 0
+	uint64_t mPendingMove[GameSettings::kMaxPlayers];
+
+	size_t mBytes;
+	std::atomic<size_t>* mpGlobalBytes;
+	int64_t mOverBudgetSinceNs; // 0 if within budget
+
+	size_t mPeakBytes;
+	uint64_t mCoalesced;
+	uint64_t mDropped;
+	uint64_t mShed;
+};
+
+// monotonic clock in nanoseconds
+int64_t MonotonicNowNs();
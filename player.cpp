@@ -1,11 +1,11 @@
 #include "player.hpp"
-#include <cstdio>
-
-PlayerId Player::id_generator = 1;
 
 
 Player::Player()
 {
-	player_id = id_generator++;
-	printf("new player with id=%u\n", player_id);
+	posX = posY = 0.0f;
+	colorR = colorG = colorB = 0.0f;
+	is_alive = false;
+	is_ready = false;
+	player_id = kInvalidPlayerId;
 }
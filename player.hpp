@@ -1,6 +1,10 @@
 #pragma once
 
-typedef unsigned int PlayerId;
+#include "slot_map.hpp"
+
+// Player ids are generational slot handles issued by Game::AddPlayer().
+typedef SlotHandle PlayerId;
+constexpr PlayerId kInvalidPlayerId = kInvalidSlotHandle;
 
 class Player
 {
@@ -15,6 +19,5 @@ public:
 	bool is_ready;
 	PlayerId player_id;
 
-	static PlayerId id_generator;
 	Player();
 };
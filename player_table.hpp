@@ -0,0 +1,55 @@
+#pragma once
+
+#include <memory>
+#include "player.hpp"
+#include "slot_map.hpp"
+
+// Player storage for small rooms: the slot map lives inside the Game object
+// and ForEach() runs a loop with a compile-time trip count, which the
+// compiler fully unrolls.
+template <unsigned int Capacity>
+class InlinePlayerTable
+{
+public:
+	PlayerId Insert(Player* player) { return mPlayers.Insert(player); }
+	bool Remove(PlayerId player_id) { return mPlayers.Remove(player_id); }
+	unsigned int Size() const { return mPlayers.Size(); }
+
+	template <typename F>
+	void ForEach(F f) const
+	{
+		const unsigned int size = mPlayers.Size();
+		Player* const* players = mPlayers.begin();
+#pragma GCC unroll 16
+		for (unsigned int i = 0; i < Capacity; i++)
+		{
+			if (i < size) f(players[i]);
+		}
+	}
+
+private:
+	SlotMap<Player*, Capacity> mPlayers;
+};
+
+// Player storage for large rooms: the slot map is heap-allocated once, and
+// loops run over the live players only.
+template <unsigned int Capacity>
+class DynamicPlayerTable
+{
+public:
+	DynamicPlayerTable() : mPlayers(new SlotMap<Player*, Capacity>()) {}
+
+	PlayerId Insert(Player* player) { return mPlayers->Insert(player); }
+	bool Remove(PlayerId player_id) { return mPlayers->Remove(player_id); }
+	unsigned int Size() const { return mPlayers->Size(); }
+
+	template <typename F>
+	void ForEach(F f) const
+	{
+		const SlotMap<Player*, Capacity>& players = *mPlayers;
+		for (Player* player : players) f(player);
+	}
+
+private:
+	std::unique_ptr<SlotMap<Player*, Capacity>> mPlayers;
+};
@@ -0,0 +1,144 @@
+#include "projectile.hpp"
+#include "protocol.hpp"
+
+
+ProjectilePool::ProjectilePool()
+{
+	mExpiredCount = 0;
+	mExpiredDropped = 0;
+}
+
+ProjectileHandle ProjectilePool::Spawn(PlayerId owner, float posX, float posY,
+									   float velX, float velY, float lifetime)
+{
+	ProjectileHandle handle = mSlots.Insert();
+	if (handle == kInvalidProjectile) return kInvalidProjectile;
+
+	unsigned int dense = mSlots.Size() - 1;
+	mPosX[dense] = posX;
+	mPosY[dense] = posY;
+	mVelX[dense] = velX;
+	mVelY[dense] = velY;
+	mTimeLeft[dense] = lifetime;
+	mOwner[dense] = owner;
+	return handle;
+}
+
+uint32_t ProjectilePool::Checksum() const
+{
+	// FNV-1a over the dense arrays
+	uint32_t hash = 2166136261u;
+	auto mix = [&hash](const void* data, size_t length)
+	{
+		const unsigned char* bytes = (const unsigned char*)data;
+		for (size_t i = 0; i < length; i++) hash = (hash ^ bytes[i]) * 16777619u;
+	};
+	const unsigned int count = mSlots.Size();
+	mix(&count, sizeof(count));
+	mix(mPosX, count * sizeof(float));
+	mix(mPosY, count * sizeof(float));
+	mix(mVelX, count * sizeof(float));
+	mix(mVelY, count * sizeof(float));
+	mix(mTimeLeft, count * sizeof(float));
+	mix(mOwner, count * sizeof(PlayerId));
+	return hash;
+}
+
+bool ProjectilePool::IsAlive(ProjectileHandle handle) const
+{
+	return mSlots.Contains(handle);
+}
+
+bool ProjectilePool::Despawn(ProjectileHandle handle)
+{
+	int dense = mSlots.DenseIndex(handle);
+	if (dense < 0) return false;
+	RemoveDense(dense);
+	return true;
+}
+
+void ProjectilePool::RemoveDense(unsigned int dense)
+{
+	if (mExpiredCount < kCapacity)
+	{
+		mExpired[mExpiredCount++] = mSlots.HandleAt(dense);
+	}
+	else
+	{
+		// more expired than fit in frames since the last Encode()
+		mExpiredDropped++;
+	}
+
+	// the last live projectile is swapped into the hole to keep arrays dense
+	unsigned int last;
+	mSlots.RemoveDense(dense, last);
+	if (dense != last)
+	{
+		mPosX[dense] = mPosX[last];
+		mPosY[dense] = mPosY[last];
+		mVelX[dense] = mVelX[last];
+		mVelY[dense] = mVelY[last];
+		mTimeLeft[dense] = mTimeLeft[last];
+		mOwner[dense] = mOwner[last];
+	}
+}
+
+void ProjectilePool::Tick(float dt, float arenaMin, float arenaMax)
+{
+	const unsigned int count = mSlots.Size();
+	float* __restrict posX = mPosX;
+	float* __restrict posY = mPosY;
+	const float* __restrict velX = mVelX;
+	const float* __restrict velY = mVelY;
+	float* __restrict timeLeft = mTimeLeft;
+	unsigned char* __restrict expired = mExpiredMask;
+
+	// Branch-free integration and expiry test over the dense arrays, which
+	// -O3 turns into SIMD loops.
+	for (unsigned int i = 0; i < count; i++)
+	{
+		posX[i] += velX[i] * dt;
+		posY[i] += velY[i] * dt;
+		timeLeft[i] -= dt;
+		expired[i] = (posX[i] > arenaMax) | (posX[i] < arenaMin) |
+			(posY[i] > arenaMax) | (posY[i] < arenaMin) | (timeLeft[i] <= 0.0f);
+	}
+
+	// Walk backwards so swap-removal only ever moves already-visited entries.
+	for (unsigned int i = count; i-- > 0;)
+	{
+		if (expired[i]) RemoveDense(i);
+	}
+}
+
+size_t ProjectilePool::Encode(char* dest, size_t capacity, bool compact)
+{
+	size_t written = 0;
+	const int precision = compact ? 3 : 6;
+
+	unsigned int sent = 0;
+	for (; sent < mExpiredCount; sent++)
+	{
+		if (capacity - written < Protocol::kMaxMessageLength) break;
+		written += Protocol::CreateProjectileExpiredResponse(dest + written,
+															 mExpired[sent]);
+	}
+
+	// keep whatever did not fit for the next frame
+	for (unsigned int i = sent; i < mExpiredCount; i++)
+	{
+		mExpired[i - sent] = mExpired[i];
+	}
+	mExpiredCount -= sent;
+
+	for (unsigned int i = 0; i < mSlots.Size(); i++)
+	{
+		if (capacity - written < Protocol::kMaxMessageLength) break;
+		written += Protocol::CreateProjectileResponse(dest + written,
+													  mSlots.HandleAt(i),
+													  mOwner[i], mPosX[i], mPosY[i],
+													  precision);
+	}
+
+	return written;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "player.hpp"
+#include "slot_map.hpp"
+#include "game_settings.hpp"
+
+typedef SlotHandle ProjectileHandle;
+constexpr ProjectileHandle kInvalidProjectile = kInvalidSlotHandle;
+
+// Fixed-capacity pool of server-authoritative projectiles.
+//
+// Live projectiles are kept densely packed in structure-of-arrays form, so the
+// per-tick update is a straight loop over contiguous floats that the compiler
+// can vectorize. Handles come from a SlotIndex, which recycles slots through
+// a free list; all storage is inline, so spawning and expiring never touches
+// the allocator.
+class ProjectilePool
+{
+public:
+	static constexpr unsigned int kCapacity = GameSettings::kMaxProjectiles;
+
+	ProjectilePool();
+
+	// returns kInvalidProjectile if the pool is full
+	ProjectileHandle Spawn(PlayerId owner, float posX, float posY,
+						   float velX, float velY, float lifetime);
+
+	// returns false if the handle is stale (projectile already expired)
+	bool Despawn(ProjectileHandle handle);
+
+	bool IsAlive(ProjectileHandle handle) const;
+
+	// Advances every live projectile by `dt` seconds. Projectiles that leave
+	// the arena [arenaMin, arenaMax]^2 or run out of lifetime are expired and
+	// remembered until the next call to Encode(), so clients can be told to
+	// drop them.
+	void Tick(float dt, float arenaMin, float arenaMax);
+
+	// Writes one SRV_RES_PROJECTILE line per live projectile and one
+	// SRV_RES_PROJECTILE_EXPIRED line per projectile expired since the last
+	// call. Returns the number of bytes written (never more than `capacity`).
+	// `compact` sends positions with reduced precision.
+	size_t Encode(char* dest, size_t capacity, bool compact = false);
+
+	unsigned int LiveCount() const { return mSlots.Size(); }
+
+	// expire notices that did not fit in the pending list and were never
+	// sent; clients keep showing those projectiles
+	uint64_t ExpiredDroppedCount() const { return mExpiredDropped; }
+
+	// hash of every live projectile, in pool order
+	uint32_t Checksum() const;
+
+private:
+	void RemoveDense(unsigned int dense);
+
+	SlotIndex<kCapacity> mSlots;
+
+	// dense, structure-of-arrays projectile data
+	float mPosX[kCapacity];
+	float mPosY[kCapacity];
+	float mVelX[kCapacity];
+	float mVelY[kCapacity];
+	float mTimeLeft[kCapacity];
+	PlayerId mOwner[kCapacity];
+	unsigned char mExpiredMask[kCapacity];
+
+	// expired since the last Encode()
+	ProjectileHandle mExpired[kCapacity];
+	unsigned int mExpiredCount;
+	uint64_t mExpiredDropped;
+};
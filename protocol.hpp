@@ -4,14 +4,22 @@
  * "<message_type> <args...>"
  *
  * Message types:
- * MOVE, QUIT
+ * MOVE, FIRE, QUIT
  *
  * Examples:
  * "MOVE %f %f"	 ('%f' representing a float)
+ *
+ * A server broadcast may carry several newline-terminated messages back to
+ * back (eg. one per projectile each tick); every line is still shorter than
+ * kMaxMessageLength, so clients read them one at a time as usual.
  */
 
+#pragma once
+
 #include <cstdio>
+#include <cstring>
 #include "player.hpp"
+#include "projectile.hpp"
 
 namespace Protocol
 {
@@ -21,34 +29,86 @@ namespace Protocol
 	inline char CLIENT_REQUEST_TOGGLE_PAUSE[] = "CLT_REQ_TOGGLE_PAUSE\n";
 	inline char CLIENT_REQUEST_QUIT[] = "CLT_REQ_QUIT\n";
 
-	void CreateMoveRequest(char dest[kMaxMessageLength], float dirX, float dirY)
+	inline void CreateMoveRequest(char dest[kMaxMessageLength], float dirX, float dirY)
 	{
 		sprintf(dest, "CLT_REQ_MOVE %f %f\n", dirX, dirY);
 	}
 
+	inline void CreateFireRequest(char dest[kMaxMessageLength], float dirX, float dirY)
+	{
+		sprintf(dest, "CLT_REQ_FIRE %f %f\n", dirX, dirY);
+	}
+
+	enum class ClientRequest
+	{
+		start,
+		toggle_pause,
+		quit,
+		move,
+		fire,
+		unknown
+	};
+	constexpr unsigned int kClientRequestTypes = 6;
+
+	inline const char* ClientRequestName(ClientRequest request)
+	{
+		static const char* names[kClientRequestTypes] =
+			{ "start", "toggle_pause", "quit", "move", "fire", "unknown" };
+		return names[(unsigned int)request];
+	}
+
+	// Classifies a received request line. For move and fire, (dirX, dirY)
+	// receive the requested direction.
+	inline ClientRequest ParseClientRequest(const char* line, float* dirX, float* dirY)
+	{
+		if (strcmp(line, CLIENT_REQUEST_START) == 0) return ClientRequest::start;
+		if (strcmp(line, CLIENT_REQUEST_TOGGLE_PAUSE) == 0) return ClientRequest::toggle_pause;
+		if (strcmp(line, CLIENT_REQUEST_QUIT) == 0) return ClientRequest::quit;
+		if (sscanf(line, "CLT_REQ_MOVE %f %f", dirX, dirY) == 2) return ClientRequest::move;
+		if (sscanf(line, "CLT_REQ_FIRE %f %f", dirX, dirY) == 2) return ClientRequest::fire;
+		return ClientRequest::unknown;
+	}
+
 
 	inline char SERVER_RESPONSE_START[] = "SRV_RES_START\n";
 	inline char SERVER_RESPONSE_PAUSE[] = "SRV_RES_PAUSE\n";
 	inline char SERVER_RESPONSE_UNPAUSE[] = "SRV_RES_UNPAUSE\n";
 	inline char SERVER_RESPONSE_END_GAME[] = "SRV_RES_END_GAME\n";
 
-	void CreateMoveResponse(char dest[kMaxMessageLength], PlayerId player_id,
-							float newposX, float newposY)
+	inline void CreateMoveResponse(char dest[kMaxMessageLength], PlayerId player_id,
+							       float newposX, float newposY)
 	{
 		sprintf(dest, "SRV_RES_MOVE %u %f %f\n", player_id, newposX, newposY);
 	}
 
-	void CreateNewPlayerResponse(char dest[kMaxMessageLength],
-								 PlayerId player_id, float posX, float posY)
+	inline void CreateNewPlayerResponse(char dest[kMaxMessageLength],
+								        PlayerId player_id, float posX, float posY)
 	{
 		sprintf(dest, "SRV_RES_NEW_PLAYER %u %f %f\n", player_id, posX, posY);
 	}
 
-	void CreateYourNewPlayerResponse(char dest[kMaxMessageLength],
-									 PlayerId player_id, float posX, float posY,
-									 float colorR, float colorG, float colorB)
+	inline void CreateYourNewPlayerResponse(char dest[kMaxMessageLength],
+									        PlayerId player_id, float posX, float posY,
+									        float colorR, float colorG, float colorB)
 	{
 		sprintf(dest, "SRV_RES_YOUR_NEW_PLAYER %u %f %f %f %f %f\n",
 				player_id, posX, posY, colorR, colorG, colorB);
 	}
+
+	// returns the number of characters written. `precision` is the number
+	// of decimals sent for the position.
+	inline int CreateProjectileResponse(char dest[kMaxMessageLength],
+										ProjectileHandle handle, PlayerId owner,
+										float posX, float posY, int precision = 6)
+	{
+		return sprintf(dest, "SRV_RES_PROJECTILE %u %u %.*f %.*f\n",
+					   handle, owner, precision, posX, precision, posY);
+	}
+
+	// returns the number of characters written
+	inline int CreateProjectileExpiredResponse(char dest[kMaxMessageLength],
+											   ProjectileHandle handle)
+	{
+		return sprintf(dest, "SRV_RES_PROJECTILE_EXPIRED %u\n", handle);
+	}
 }
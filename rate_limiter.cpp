@@ -0,0 +1,104 @@
+#include "rate_limiter.hpp"
+#include "server_settings.hpp"
+
+RateLimits rate_limits;
+std::atomic<uint64_t> rate_limited_requests(0);
+
+
+RateLimits::RateLimits()
+{
+	SetClientLimit({ ServerSettings::kClientRequestRate, ServerSettings::kClientRequestBurst });
+
+	const TokenBucketLimit control =
+		{ ServerSettings::kControlRequestRate, ServerSettings::kControlRequestBurst };
+	SetRequestLimit(Protocol::ClientRequest::start, control);
+	SetRequestLimit(Protocol::ClientRequest::toggle_pause, control);
+	SetRequestLimit(Protocol::ClientRequest::quit, control);
+	SetRequestLimit(Protocol::ClientRequest::move,
+					{ ServerSettings::kMoveRequestRate, ServerSettings::kMoveRequestBurst });
+	SetRequestLimit(Protocol::ClientRequest::fire,
+					{ ServerSettings::kFireRequestRate, ServerSettings::kFireRequestBurst });
+	SetRequestLimit(Protocol::ClientRequest::unknown,
+					{ ServerSettings::kUnknownRequestRate, ServerSettings::kUnknownRequestBurst });
+}
+
+void RateLimits::SetClientLimit(TokenBucketLimit limit)
+{
+	mClientRate.store(limit.rate, std::memory_order_relaxed);
+	mClientBurst.store(limit.burst, std::memory_order_relaxed);
+}
+
+void RateLimits::SetRequestLimit(Protocol::ClientRequest request, TokenBucketLimit limit)
+{
+	mRequestRate[(unsigned int)request].store(limit.rate, std::memory_order_relaxed);
+	mRequestBurst[(unsigned int)request].store(limit.burst, std::memory_order_relaxed);
+}
+
+TokenBucketLimit RateLimits::GetClientLimit() const
+{
+	return { mClientRate.load(std::memory_order_relaxed),
+			 mClientBurst.load(std::memory_order_relaxed) };
+}
+
+TokenBucketLimit RateLimits::GetRequestLimit(Protocol::ClientRequest request) const
+{
+	return { mRequestRate[(unsigned int)request].load(std::memory_order_relaxed),
+			 mRequestBurst[(unsigned int)request].load(std::memory_order_relaxed) };
+}
+
+
+ClientRateLimiter::ClientRateLimiter()
+{
+	// buckets start full (last_refill_ns = 0 refills them on first use)
+	mClientBucket = { 0.0f, 0 };
+	for (unsigned int i = 0; i < Protocol::kClientRequestTypes; i++)
+	{
+		mRequestBuckets[i] = { 0.0f, 0 };
+		mDropped[i] = 0;
+	}
+}
+
+void ClientRateLimiter::Refill(TokenBucket& bucket, TokenBucketLimit limit, int64_t now_ns)
+{
+	if (bucket.last_refill_ns == 0)
+	{
+		bucket.tokens = limit.burst;
+	}
+	else
+	{
+		bucket.tokens += limit.rate * (now_ns - bucket.last_refill_ns) * 1e-9f;
+		if (bucket.tokens > limit.burst) bucket.tokens = limit.burst;
+	}
+	bucket.last_refill_ns = now_ns;
+}
+
+bool ClientRateLimiter::Allow(Protocol::ClientRequest request, int64_t now_ns)
+{
+	const unsigned int type = (unsigned int)request;
+	TokenBucketLimit request_limit = rate_limits.GetRequestLimit(request);
+	TokenBucketLimit client_limit = rate_limits.GetClientLimit();
+
+	TokenBucket& bucket = mRequestBuckets[type];
+	Refill(bucket, request_limit, now_ns);
+	Refill(mClientBucket, client_limit, now_ns);
+
+	bool request_ok = request_limit.rate <= 0.0f || bucket.tokens >= 1.0f;
+	bool client_ok = client_limit.rate <= 0.0f || mClientBucket.tokens >= 1.0f;
+	if (!request_ok || !client_ok)
+	{
+		mDropped[type]++;
+		rate_limited_requests.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	if (request_limit.rate > 0.0f) bucket.tokens -= 1.0f;
+	if (client_limit.rate > 0.0f) mClientBucket.tokens -= 1.0f;
+	return true;
+}
+
+uint64_t ClientRateLimiter::DroppedCount() const
+{
+	uint64_t total = 0;
+	for (uint64_t dropped : mDropped) total += dropped;
+	return total;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include "protocol.hpp"
+
+struct TokenBucketLimit
+{
+	float rate;  // tokens per second; <= 0 disables the limit
+	float burst; // bucket capacity
+};
+
+// Process-wide input rate limits. Every client limiter reads these on each
+// request, so changes take effect immediately without a restart.
+class RateLimits
+{
+public:
+	RateLimits();
+
+	void SetClientLimit(TokenBucketLimit limit);
+	void SetRequestLimit(Protocol::ClientRequest request, TokenBucketLimit limit);
+
+	TokenBucketLimit GetClientLimit() const;
+	TokenBucketLimit GetRequestLimit(Protocol::ClientRequest request) const;
+
+private:
+	std::atomic<float> mClientRate, mClientBurst;
+	std::atomic<float> mRequestRate[Protocol::kClientRequestTypes];
+	std::atomic<float> mRequestBurst[Protocol::kClientRequestTypes];
+};
+
+extern RateLimits rate_limits;
+
+// Per-client token buckets: one overall, plus one per request type.
+// Used only by the client's receive thread, so it needs no locking.
+class ClientRateLimiter
+{
+public:
+	ClientRateLimiter();
+
+	// takes a token from the request type's bucket and the overall bucket;
+	// returns false (and counts the drop) if either is empty
+	bool Allow(Protocol::ClientRequest request, int64_t now_ns);
+
+	uint64_t DroppedCount(Protocol::ClientRequest request) const
+	{
+		return mDropped[(unsigned int)request];
+	}
+	uint64_t DroppedCount() const;
+
+private:
+	struct TokenBucket
+	{
+		float tokens;
+		int64_t last_refill_ns;
+	};
+
+	static void Refill(TokenBucket& bucket, TokenBucketLimit limit, int64_t now_ns);
+
+	TokenBucket mClientBucket;
+	TokenBucket mRequestBuckets[Protocol::kClientRequestTypes];
+	uint64_t mDropped[Protocol::kClientRequestTypes];
+};
+
+// requests dropped by all client limiters
+extern std::atomic<uint64_t> rate_limited_requests;
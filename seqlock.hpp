@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// Single-writer sequence lock.
+//
+// The writer never waits: it bumps the sequence to an odd value, copies the
+// new value in and bumps the sequence back to even. Readers copy the value
+// out and retry if the sequence was odd or changed underneath them, so they
+// always observe one consistent version without ever taking a lock.
+//
+// The value is stored as relaxed atomic words rather than a plain T, which
+// keeps concurrent reads well-defined under the C++ memory model.
+template <typename T>
+class Seqlock
+{
+	static_assert(std::is_trivially_copyable<T>::value,
+				  "Seqlock values must be trivially copyable");
+
+public:
+	Seqlock()
+	{
+		mSequence.store(0, std::memory_order_relaxed);
+		for (auto& word : mWords) word.store(0, std::memory_order_relaxed);
+	}
+
+	// Writers must be serialized externally (eg. by the owner's mutex).
+	void Store(const T& value)
+	{
+		uint64_t words[kWords] = {};
+		memcpy(words, &value, sizeof(T));
+
+		uint64_t sequence = mSequence.load(std::memory_order_relaxed);
+		mSequence.store(sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		for (size_t i = 0; i < kWords; i++)
+		{
+			mWords[i].store(words[i], std::memory_order_relaxed);
+		}
+		mSequence.store(sequence + 2, std::memory_order_release);
+	}
+
+	T Load() const
+	{
+		uint64_t words[kWords];
+		uint64_t before, after;
+		do
+		{
+			before = mSequence.load(std::memory_order_acquire);
+			for (size_t i = 0; i < kWords; i++)
+			{
+				words[i] = mWords[i].load(std::memory_order_relaxed);
+			}
+			std::atomic_thread_fence(std::memory_order_acquire);
+			after = mSequence.load(std::memory_order_relaxed);
+		} while ((before & 1) || before != after);
+
+		T value;
+		memcpy(&value, words, sizeof(T));
+		return value;
+	}
+
+	// number of completed writes
+	uint64_t Version() const
+	{
+		return mSequence.load(std::memory_order_acquire) / 2;
+	}
+
+private:
+	static constexpr size_t kWords = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+	// keep the hot sequence counter off the data's cache lines
+	alignas(64) std::atomic<uint64_t> mSequence;
+	alignas(64) std::atomic<uint64_t> mWords[kWords];
+};
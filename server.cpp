@@ -1,42 +1,45 @@
 /*
- * Server
+ * Server rooms: client connections, the game loop, admin commands and
+ * sharding. The entry point is in server_main.cpp.
  */
 
 #include "csapp.h"
 #include "protocol.hpp"
 #include "game.hpp"
+#include "listener.hpp"
+#include "outbound_queue.hpp"
+#include "server_settings.hpp"
+#include "rate_limiter.hpp"
+#include "load_governor.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+#include "log.hpp"
+#include "instrumented_mutex.hpp"
+#include "memory_accounting.hpp"
+#include "socket_timestamps.hpp"
+#include "transport.hpp"
+#include "journal.hpp"
+#include "wire_capture.hpp"
+#include "admin.hpp"
+#include "server.hpp"
 
 #include <cassert>
 #include <vector>
-#include <queue>
 #include <memory>
 #include <string>
 #include <cstring>
 #include <atomic>
+#include <algorithm>
+#include <random>
 
 
 //
 // CLIENT INFO
-class RespondMessage
-{
-public:
-	RespondMessage(const char* message)
-	{
-		mMessageLength = strlen(message);
-		assert(mMessageLength < Protocol::kMaxMessageLength);
-		mpMessage = (char*)malloc(sizeof(char) * Protocol::kMaxMessageLength);
-		strcpy(mpMessage, message);
-	}
-	~RespondMessage()
-	{
-		delete mpMessage;
-	}
-	char* GetMessage() { return mpMessage; }
-	size_t GetMessageLength() { return mMessageLength; }
-private:
-	char* mpMessage;
-	size_t mMessageLength;
-};
+
+// bytes queued for sending across all clients, see OutboundQueue
+std::atomic<size_t> global_queued_bytes(0);
+std::atomic<uint64_t> slow_client_disconnects(0);
+std::atomic<uint64_t> shed_messages(0); // over the global queue budget
 
 struct Client
 {
@@ -45,112 +48,378 @@ struct Client
 	Player client_player;
 	bool player_created;
 
-	int connfd;
+	// owned by the client; connection_id is its Id(), kept for logging
+	Transport* transport;
+	int connection_id;
 	volatile std::atomic_bool client_connected;
 	pthread_t receive_tid;
 	pthread_t respond_tid;
-	pthread_mutex_t client_mutex;
+	InstrumentedMutex client_mutex{"Client::client_mutex"};
+	// set by the admin "drain" command: no new messages are queued, and the
+	// respond thread disconnects once the queue is flushed
+	std::atomic_bool draining{false};
+
+	OutboundQueue message_queue{&global_queued_bytes};
+
+	// only touched by the receive thread
+	ClientRateLimiter rate_limiter;
+
+	// per-connection traffic, exported with the process metrics
+	std::atomic<uint64_t> bytes_received{0};
+	std::atomic<uint64_t> bytes_sent{0};
+	std::atomic<uint64_t> messages_received{0};
+	std::atomic<uint64_t> messages_sent{0};
 
-	std::queue<std::shared_ptr<RespondMessage>> message_queue;
+	// everything allocated on behalf of this connection
+	Memory::Owner memory_owner;
+
+	// the receive and respond threads still running; the last one to
+	// finish hands the client to ReapClients()
+	std::atomic<int> threads_running{2};
 };
 
 //
 // CLIENT SETUP AND SYNCHRONIZATION
 std::vector<Client*> connected_clients;
-pthread_mutex_t connected_clients_mutex;
+InstrumentedMutex connected_clients_mutex("connected_clients_mutex");
 pthread_cond_t client_cond_respond;
+// clients whose threads have both finished, waiting to be freed
+std::atomic<unsigned int> finished_clients(0);
+
+// Called by each client thread as its last touch of `client`.
+static void ClientThreadFinished(Client* client)
+{
+	if (client->threads_running.fetch_sub(1) == 1) finished_clients++;
+}
 
 //
 // GAME DATA
-Game* game;
+GameRoom* game;
+Memory::Owner room_memory_owner;
+// open while a room runs, if SNG_JOURNAL=1
+Journal room_journal;
+unsigned int rooms_started = 0;
+// the game loop picks up changes on its next tick, see the tick-rate command
+std::atomic<int> tick_rate(0);
 
 
 //
 // SERVER SETUP
 void InitServer()
 {
-	int status = pthread_mutex_init(&connected_clients_mutex, nullptr);
-	assert(status == 0);
+	// a write to a disconnected client must fail with EPIPE, not kill the
+	// whole server
+	Signal(SIGPIPE, SIG_IGN);
 }
-void InitGame()
+void InitGame(unsigned int max_players)
 {
-	game = new Game();
+	room_memory_owner = Memory::OpenOwner("room");
+	rooms_started++;
+
+	// SNG_JOURNAL=1 records the match for tools/replay; the file is only
+	// created when the match starts
+	const uint32_t seed = std::random_device()();
+	const char* journal_env = getenv("SNG_JOURNAL");
+	const bool journal = journal_env && strcmp(journal_env, "1") == 0;
+	GameRoom* room;
+	{
+		Memory::Scope scope(Memory::Tag::game_room, room_memory_owner);
+		room = CreateGameRoom(max_players, seed, journal ? &room_journal : nullptr);
+	}
+	if (journal && room)
+	{
+		char journal_path[108];
+		snprintf(journal_path, sizeof(journal_path), ServerSettings::kJournalFileFormat,
+				 (int)getpid(), rooms_started);
+		if (room_journal.Open(journal_path, room->MaxPlayers(), room->TickRate(), seed))
+		{
+			LOG_INFO("Match journal goes to %s once the match starts (seed %u)\n",
+					 journal_path, seed);
+		}
+	}
+
+	// admin commands read the room under this lock
+	connected_clients_mutex.Lock();
+	game = room;
+	connected_clients_mutex.Unlock();
+	if (game == nullptr)
+	{
+		fprintf(stderr, "No room policy fits %u players (max %d)\n",
+				max_players, GameSettings::kMaxPlayers);
+		exit(1);
+	}
+}
+
+
+void PrintConnectionStats()
+{
+	connected_clients_mutex.Lock();
+	LOG_INFO("Outbound queues: %zu bytes queued, %lu slow clients disconnected, "
+		   "%lu messages shed, %lu requests rate limited\n",
+		   global_queued_bytes.load(), (unsigned long)slow_client_disconnects.load(),
+		   (unsigned long)shed_messages.load(), (unsigned long)rate_limited_requests.load());
+	for (auto& client_ptr : connected_clients)
+	{
+		client_ptr->client_mutex.Lock();
+		const OutboundQueue& queue = client_ptr->message_queue;
+		LOG_INFO("  client[%i]: depth %zu, %zu bytes (peak %zu), %lu coalesced, %lu dropped\n",
+			   client_ptr->connection_id, queue.Depth(), queue.Bytes(), queue.PeakBytes(),
+			   (unsigned long)queue.CoalescedCount(), (unsigned long)queue.DroppedCount());
+		client_ptr->client_mutex.Unlock();
+	}
+	connected_clients_mutex.Unlock();
+}
+
+
+// Per-connection and lock series for the metrics exporter.
+void AppendServerMetrics(std::string& out)
+{
+	struct ConnectionSample
+	{
+		int connection_id;
+		uint64_t values[6];
+	};
+	static const char* kSeries[6][2] = {
+		{ "sng_connection_bytes_received", "counter" },
+		{ "sng_connection_bytes_sent", "counter" },
+		{ "sng_connection_messages_received", "counter" },
+		{ "sng_connection_messages_sent", "counter" },
+		{ "sng_connection_queue_depth", "gauge" },
+		{ "sng_connection_queued_bytes", "gauge" },
+	};
+
+	std::vector<ConnectionSample> samples;
+	connected_clients_mutex.Lock();
+	for (auto& client_ptr : connected_clients)
+	{
+		client_ptr->client_mutex.Lock();
+		ConnectionSample sample = { client_ptr->connection_id, {
+			client_ptr->bytes_received.load(), client_ptr->bytes_sent.load(),
+			client_ptr->messages_received.load(), client_ptr->messages_sent.load(),
+			client_ptr->message_queue.Depth(), client_ptr->message_queue.Bytes() } };
+		client_ptr->client_mutex.Unlock();
+		samples.push_back(sample);
+	}
+	connected_clients_mutex.Unlock();
+
+	// Prometheus wants every sample of a metric in one group
+	char line[512];
+	for (int series = 0; series < 6; series++)
+	{
+		snprintf(line, sizeof(line), "# TYPE %s %s\n", kSeries[series][0], kSeries[series][1]);
+		out += line;
+		for (auto& sample : samples)
+		{
+			snprintf(line, sizeof(line), "%s{connection=\"%i\"} %lu\n", kSeries[series][0],
+					 sample.connection_id, (unsigned long)sample.values[series]);
+			out += line;
+		}
+	}
+
+	snprintf(line, sizeof(line),
+			 "# TYPE sng_queued_bytes gauge\nsng_queued_bytes %zu\n"
+			 "# TYPE sng_slow_client_disconnects_total counter\nsng_slow_client_disconnects_total %lu\n"
+			 "# TYPE sng_shed_messages_total counter\nsng_shed_messages_total %lu\n"
+			 "# TYPE sng_rate_limited_requests_total counter\nsng_rate_limited_requests_total %lu\n",
+			 global_queued_bytes.load(), (unsigned long)slow_client_disconnects.load(),
+			 (unsigned long)shed_messages.load(), (unsigned long)rate_limited_requests.load());
+	out += line;
+
+	AppendLockPrometheus(out);
+	Memory::AppendPrometheus(out);
 }
 
 
 //
 // HANDLE CLIENTS
+
+// Disconnects a client that cannot keep up with its outbound queue.
+// Caller must hold client->client_mutex.
+void DisconnectSlowClient(Client* client)
+{
+	LOG_WARN("client[%i]: slow consumer (%zu messages, %zu bytes queued), disconnecting\n",
+		   client->connection_id, client->message_queue.Depth(), client->message_queue.Bytes());
+	slow_client_disconnects++;
+	client->client_connected.store(false);
+	client->message_queue.Clear();
+
+	// wakes the receive thread out of its blocking read
+	client->transport->Shutdown();
+}
+
+// Queues a server response for one client, within the client's outbound
+// budget. Only the client's own limits disconnect it; a message over the
+// global budget is shed for this client. Caller must hold
+// client->client_mutex.
+void EnqueueResponse(Client* client, const std::shared_ptr<RespondMessage>& response)
+{
+	if (!client->client_connected || client->draining) return;
+
+	OutboundQueue::PushResult result = client->message_queue.Push(response);
+	if (result == OutboundQueue::PushResult::shed) shed_messages++;
+	if (result == OutboundQueue::PushResult::dropped ||
+		client->message_queue.OverBudgetTooLong(MonotonicNowNs()))
+	{
+		DisconnectSlowClient(client);
+	}
+}
+
+// Pushes a server response to each client connection's message queue, then
+// signals each client's respond thread to send the message to its client.
+void BroadcastResponse(const std::shared_ptr<RespondMessage>& response)
+{
+	TRACE_SPAN_FLOW("BroadcastResponse", response->GetFlowId());
+	connected_clients_mutex.Lock();
+	for (auto& client_ptr : connected_clients)
+	{
+		client_ptr->client_mutex.Lock();
+		EnqueueResponse(client_ptr, response);
+		client_ptr->client_mutex.Unlock();
+	}
+	pthread_cond_broadcast(&client_cond_respond);
+	connected_clients_mutex.Unlock();
+}
+
+static void RecordWireToWire(int64_t wire_ns)
+{
+	if (wire_ns > 0) Metrics::Record(Metrics::Histogram::wire_to_wire, wire_ns);
+}
+
 void* ClientRespondThread(void* clientPtr)
 {
 	Client* client = (Client*)clientPtr;
 	int error_tolerance = 5; // max # connection errors that may occur
-	printf("Starting respond thread for client[%i]\n", client->connfd);
+	LOG_INFO("Starting respond thread for client[%i]\n", client->connection_id);
+	TRACE_THREAD_NAME("respond[%i]", client->connection_id);
+	Memory::Scope memory_scope(Memory::Tag::untagged, client->memory_owner);
+	// recorded on the hot path below, so they must not allocate there
+	Metrics::Reserve(Metrics::Histogram::outbound_queue_depth);
+	Metrics::Reserve(Metrics::Histogram::enqueue_to_write);
+	Metrics::Reserve(Metrics::Histogram::wire_to_wire);
 
-	while (client->client_connected && error_tolerance > 0)
+	while ((client->client_connected || client->draining) && error_tolerance > 0)
 	{
-		pthread_mutex_lock(&client->client_mutex);
-		while (client->client_connected && client->message_queue.empty()) {
-			pthread_cond_wait(&client_cond_respond, &client->client_mutex);
+		client->client_mutex.Lock();
+		{
+			TRACE_SPAN("cond_wait");
+			while (client->client_connected && client->message_queue.Empty()) {
+				client->client_mutex.Wait(&client_cond_respond);
+			}
 		}
-		//printf("respond thread awoken by broadcast, send to client[%i]\n", client->connfd);
-		if (!client->client_connected) {
-			pthread_mutex_unlock(&client->client_mutex);
+		//printf("respond thread awoken by broadcast, send to client[%i]\n", client->connection_id);
+		Memory::HotPath hot_path;
+		// a draining client still gets what was queued before the drain
+		if (client->message_queue.Empty() ||
+			(!client->client_connected && !client->draining)) {
+			client->client_mutex.Unlock();
 			break;
 		}
-		auto msg = client->message_queue.front();
-		client->message_queue.pop();
+		auto msg = client->message_queue.Pop();
+		Metrics::Record(Metrics::Histogram::outbound_queue_depth,
+						client->message_queue.Depth());
 		// printf("respond thread for client[%i] will send message \"%s\" with length %lu\n",
-		// 	   client->connfd, msg->GetMessage(), msg->GetMessageLength());
+		// 	   client->connection_id, msg->GetMessage(), msg->GetMessageLength());
+
+		// the write happens outside the lock, so a slow socket never stalls
+		// the threads queueing messages for this client
+		client->client_mutex.Unlock();
 
 		// send message to client
-		ssize_t write_status = rio_writen(client->connfd, msg->GetMessage(),
-		                                  msg->GetMessageLength());
+		ssize_t write_status;
+		{
+			TRACE_SPAN_FLOW("write", msg->GetFlowId());
+			if (msg->GetFlowId()) TRACE_FLOW_STEP("request", msg->GetFlowId());
+			write_status = client->transport->Write(msg->GetMessage(), msg->GetMessageLength(),
+													msg->GetKernelRxNs());
+		}
 		if(write_status < 1)
 		{
-			printf("Some error occurred: Could not write to client!");
+			LOG_WARN("Some error occurred: Could not write to client[%i]!\n", client->connection_id);
 			error_tolerance--;
 		}
+		else
+		{
+			Metrics::Record(Metrics::Histogram::enqueue_to_write,
+							Metrics::NowNs() - msg->GetCreatedNs());
+			Metrics::Add(Metrics::Counter::bytes_sent, msg->GetMessageLength());
+			Metrics::Add(Metrics::Counter::messages_sent);
+			client->bytes_sent.fetch_add(msg->GetMessageLength(), std::memory_order_relaxed);
+			client->messages_sent.fetch_add(1, std::memory_order_relaxed);
+		}
 		// printf("respond thread for client[%i] has sent message \"%s\" with length %lu\n",
-		// 	   client->connfd, msg->GetMessage(), msg->GetMessageLength());
-
-		pthread_mutex_unlock(&client->client_mutex);
+		// 	   client->connection_id, msg->GetMessage(), msg->GetMessageLength());
 	}
 
-	printf("Terminating respond thread for client[%i]\n", client->connfd);
+	// a connection that keeps failing writes is dead; this also wakes the
+	// receive thread
+	if (client->draining || error_tolerance == 0) client->transport->Shutdown();
+
+	client->client_mutex.Lock();
+	LOG_INFO("Terminating respond thread for client[%i] (queue peak %zu bytes, "
+		   "%lu coalesced, %lu dropped)\n", client->connection_id,
+		   client->message_queue.PeakBytes(),
+		   (unsigned long)client->message_queue.CoalescedCount(),
+		   (unsigned long)client->message_queue.DroppedCount());
+	client->client_mutex.Unlock();
+	ClientThreadFinished(client);
 	return nullptr;
 }
 
 void* ClientReceiveThread(void* clientPtr)
 {
 	Client* client = (Client*)clientPtr;
-	printf("Starting respond thread for client[%i]\n", client->connfd);
+	LOG_INFO("Starting receive thread for client[%i]\n", client->connection_id);
+	TRACE_THREAD_NAME("receive[%i]", client->connection_id);
+	Memory::Scope memory_scope(Memory::Tag::untagged, client->memory_owner);
 
 	int error_tolerance = 5; // max # connection errors that may occur
 
 	// storage buffer for received client requests
 	char buf[Protocol::kMaxMessageLength];
 	memset(buf, 0, Protocol::kMaxMessageLength);
-	rio_t rio;
-	rio_readinitb(&rio, client->connfd);
+
+	// this player's move responses, reused so a move does not allocate
+	RespondMessagePool move_pool(Protocol::kMaxMessageLength - 1,
+								 ServerSettings::kMoveResponsesPerPlayer * game->MaxPlayers() + 1);
+	uint64_t move_fallbacks = 0;
+	Metrics::Reserve(Metrics::Histogram::receive_to_parse);
 
 	// send initial player data
-	pthread_mutex_lock(&client->client_mutex);
+	client->client_mutex.Lock();
 	Protocol::CreateYourNewPlayerResponse(buf, client->client_player.player_id,
 										  client->client_player.posX,
 										  client->client_player.posY,
 										  client->client_player.colorR,
 										  client->client_player.colorG,
 										  client->client_player.colorB);
-	auto new_data = std::make_shared<RespondMessage>(buf);
-	client->message_queue.push(new_data);
+	auto new_data = NewRespondMessage(buf);
+	EnqueueResponse(client, new_data);
+	// the respond thread may already be waiting
+	pthread_cond_broadcast(&client_cond_respond);
 	memset(buf, 0, Protocol::kMaxMessageLength);
-	pthread_mutex_unlock(&client->client_mutex);
+	client->client_mutex.Unlock();
 
 
-	while(error_tolerance > 0)
+	while(error_tolerance > 0 && client->client_connected)
 	{
-		ssize_t read_status = rio_readlineb(&rio, buf, Protocol::kMaxMessageLength);
-		if(read_status <= 0)
+		ssize_t read_status;
+		int64_t kernel_rx_ns = 0;
+		{
+			TRACE_SPAN("read_line");
+			read_status = client->transport->ReadLine(buf, Protocol::kMaxMessageLength, &kernel_rx_ns);
+		}
+		uint64_t received_ns = Metrics::NowNs();
+		if (kernel_rx_ns > 0)
+		{
+			int64_t queued_ns = RealtimeNowNs() - kernel_rx_ns;
+			if (queued_ns > 0) Metrics::Record(Metrics::Histogram::socket_rx_queue, queued_ns);
+		}
+		if(read_status == 0)
+		{
+			// the client closed the connection
+			break;
+		}
+		if(read_status < 0)
 		{
 			// TODO: Will this work?
 			error_tolerance--;
@@ -170,30 +439,53 @@ void* ClientReceiveThread(void* clientPtr)
 		if(only_whitespace)
 		{
 			error_tolerance--;
-			printf("Client[%i]: empty message received\n", client->connfd);
+			LOG_WARN("Client[%i]: empty message received\n", client->connection_id);
 			memset(buf, 0, read_status);
 			continue;
 		}
 
+		// one flow per request links its spans on every thread it touches
+		uint64_t flow_id = TRACE_NEW_FLOW_ID();
+		TRACE_SPAN_FLOW("handle_request", flow_id);
+		TRACE_FLOW_BEGIN("request", flow_id);
+
+		// parse -> Game -> broadcast must not allocate in steady state;
+		// control requests are exempt
+		Memory::HotPath hot_path;
+
 		// parsing client request
 		float moveX, moveY;
+		Protocol::ClientRequest request = Protocol::ParseClientRequest(buf, &moveX, &moveY);
+		Metrics::Record(Metrics::Histogram::receive_to_parse, Metrics::NowNs() - received_ns);
+		Metrics::Add(Metrics::Counter::bytes_received, read_status);
+		Metrics::Add(Metrics::Counter::messages_received);
+		client->bytes_received.fetch_add(read_status, std::memory_order_relaxed);
+		client->messages_received.fetch_add(1, std::memory_order_relaxed);
+
+		// over-limit requests are dropped before they touch the game or
+		// fan out to other clients
+		if (!client->rate_limiter.Allow(request, MonotonicNowNs()))
+		{
+			memset(buf, 0, read_status);
+			continue;
+		}
+
 		std::shared_ptr<RespondMessage> response = nullptr;
 		bool broadcast_response = false;
 
-		if (strcmp(buf, Protocol::CLIENT_REQUEST_START) == 0)
+		if (request == Protocol::ClientRequest::start)
 		{
-			printf("client[%i] requested start\n", client->connfd);
+			hot_path.Leave();
+			LOG_INFO("client[%i] requested start\n", client->connection_id);
 			game->PlayerSetReady(&client->client_player);
 
 			if (game->TryStartGame())
 			{
 				// send each player information about all other players,
 				// so each player knows about the other players in the game
-				pthread_mutex_lock(&connected_clients_mutex);
+				connected_clients_mutex.Lock();
 				for (auto& client_ptr : connected_clients)
 				{
-					pthread_mutex_lock(&client_ptr->client_mutex);
-
 					char outbuf[Protocol::kMaxMessageLength];
 					Protocol::CreateNewPlayerResponse
 						(outbuf,
@@ -201,7 +493,7 @@ void* ClientReceiveThread(void* clientPtr)
 						 client_ptr->client_player.posX,
 						 client_ptr->client_player.posY
 						 );
-					auto inner_response = std::make_shared<RespondMessage>(outbuf);
+					auto inner_response = NewRespondMessage(outbuf);
 
 					for (auto& client_inner_ptr : connected_clients)
 					{
@@ -209,156 +501,542 @@ void* ClientReceiveThread(void* clientPtr)
 						if (client_inner_ptr->client_player.player_id ==
 						    client_ptr->client_player.player_id) continue;
 
-						client_inner_ptr->message_queue.push(inner_response);
+						client_inner_ptr->client_mutex.Lock();
+						EnqueueResponse(client_inner_ptr, inner_response);
+						client_inner_ptr->client_mutex.Unlock();
 					}
-
-					pthread_mutex_unlock(&client_ptr->client_mutex);
 				}
 				// pthread_cond_broadcast(&client_cond_respond);
-				pthread_mutex_unlock(&connected_clients_mutex);
+				connected_clients_mutex.Unlock();
 
 
 				// send start message to all players
-				printf("ACTION: Game can be started!\n");
-				response = std::make_shared<RespondMessage>
+				LOG_INFO("ACTION: Game can be started!\n");
+				response = NewRespondMessage
 					(Protocol::SERVER_RESPONSE_START);
 				broadcast_response = true;
 			}
 			else
 			{
-				printf("ACTION: Game can not be started!\n");
+				LOG_INFO("ACTION: Game can not be started!\n");
 			}
 		}
-		else if (strcmp(buf, Protocol::CLIENT_REQUEST_TOGGLE_PAUSE) == 0)
+		else if (request == Protocol::ClientRequest::toggle_pause)
 		{
-			printf("client[%i] requested pause/unpause\n", client->connfd);
-			bool take_action = game->PauseUnpauseGame(&client->client_player);
+			hot_path.Leave();
+			LOG_INFO("client[%i] requested pause/unpause\n", client->connection_id);
+			GameStateType new_state;
+			bool take_action = game->PauseUnpauseGame(&client->client_player,
+													  new_state);
 
-			// NOTE: PauseUnpauseGame changes game state, so we match against
-			// the inverted state, ie. respond unpause command to clients if
-			// state is now paused
-			if (take_action && game->GetGameState() == GameStateType::running)
+			// NOTE: match against the state PauseUnpauseGame left the game in,
+			// not a second read which another client may already have changed
+			if (take_action && new_state == GameStateType::running)
 			{
-				printf("ACTION: Game will be unpaused!\n");
-				response = std::make_shared<RespondMessage>
+				LOG_INFO("ACTION: Game will be unpaused!\n");
+				response = NewRespondMessage
 					(Protocol::SERVER_RESPONSE_UNPAUSE);
 			}
-			else if (take_action && game->GetGameState() == GameStateType::paused)
+			else if (take_action && new_state == GameStateType::paused)
 			{
-				printf("ACTION: Game will be paused!\n");
-				response = std::make_shared<RespondMessage>
+				LOG_INFO("ACTION: Game will be paused!\n");
+				response = NewRespondMessage
 					(Protocol::SERVER_RESPONSE_PAUSE);
 			}
 			else
 			{
-				printf("ACTION: No pause/unpause action will be taken!\n");
+				LOG_INFO("ACTION: No pause/unpause action will be taken!\n");
 			}
 			broadcast_response = take_action;
 		}
-		else if (strcmp(buf, Protocol::CLIENT_REQUEST_QUIT) == 0)
+		else if (request == Protocol::ClientRequest::quit)
 		{
-			printf("client[%i] requested quit\n", client->connfd);
+			hot_path.Leave();
+			LOG_INFO("client[%i] requested quit\n", client->connection_id);
 			bool take_action = game->PlayerQuit(&client->client_player);
 
 			if (take_action)
 			{
-				printf("ACTION: Client will quit!\n");
-				response = std::make_shared<RespondMessage>
+				LOG_INFO("ACTION: Client will quit!\n");
+				response = NewRespondMessage
 					(Protocol::SERVER_RESPONSE_END_GAME);
 				broadcast_response = take_action;
 			}
 			else
 			{
-				printf("ACTION: Client will not quit!\n");
+				LOG_INFO("ACTION: Client will not quit!\n");
 			}
 		}
-		else if (sscanf(buf, "CLT_REQ_MOVE %f %f", &moveX, &moveY) == 2)
+		else if (request == Protocol::ClientRequest::move)
 		{
-			printf("client[%i] requested move (%f, %f)\n",
-				   client->connfd, moveX, moveY);
+			LOG_DEBUG("client[%i] requested move (%f, %f)\n",
+				   client->connection_id, moveX, moveY);
 			bool should_move = game->MovePlayer(&client->client_player, moveX, moveY);
 
 			if (should_move)
 			{
-				char outbuf[Protocol::kMaxMessageLength];
-				Protocol::CreateMoveResponse(outbuf,
+				response = move_pool.Acquire();
+				Protocol::CreateMoveResponse(response->GetMessage(),
 											 client->client_player.player_id,
 											 client->client_player.posX,
 											 client->client_player.posY);
-
-				response = std::make_shared<RespondMessage>(outbuf);
+				response->Refill(strlen(response->GetMessage()), RespondMessage::Kind::move,
+								 client->client_player.player_id);
+				if (move_pool.FallbackCount() != move_fallbacks)
+				{
+					Metrics::Add(Metrics::Counter::move_response_allocations,
+								 move_pool.FallbackCount() - move_fallbacks);
+					move_fallbacks = move_pool.FallbackCount();
+				}
 				broadcast_response = should_move;
-				printf("ACTION: Client will move!\n");
+				LOG_DEBUG("ACTION: Client will move!\n");
 			}
 			else
 			{
-				printf("ACTION: Client will not move!\n");
+				LOG_DEBUG("ACTION: Client will not move!\n");
+			}
+		}
+		else if (request == Protocol::ClientRequest::fire)
+		{
+			// Projectiles are simulated and broadcast by the tick loop, so
+			// there is no immediate response to a fire request.
+			ProjectileHandle handle =
+				game->FireProjectile(&client->client_player, moveX, moveY);
+			if (handle == kInvalidProjectile)
+			{
+				LOG_DEBUG("client[%i]: fire request rejected\n", client->connection_id);
 			}
 		}
 		else
 		{
-			printf("client[%i]: unrecongnized command: \"%s\"\n", client->connfd, buf);
-			printf("ACTION: No action will be taken!\n");
+			LOG_WARN("client[%i]: unrecongnized command: \"%s\"\n", client->connection_id, buf);
+			LOG_DEBUG("ACTION: No action will be taken!\n");
 		}
 
 		if (broadcast_response)
 		{
-			// Pushing server response to each client connection's message queue,
-			// then signals each client's respond thread to send the message to
-			// its client.
-			pthread_mutex_lock(&connected_clients_mutex);
-			for (auto& client_ptr : connected_clients)
-			{
-				pthread_mutex_lock(&client_ptr->client_mutex);
-				client_ptr->message_queue.push(response);
-				pthread_mutex_unlock(&client_ptr->client_mutex);
-			}
-			pthread_cond_broadcast(&client_cond_respond);
-			pthread_mutex_unlock(&connected_clients_mutex);
+			response->SetFlowId(flow_id);
+			response->SetKernelRxNs(kernel_rx_ns);
+			BroadcastResponse(response);
 		}
 
 		memset(buf, 0, read_status); // TODO: Probably not required.
 	}
 
-	printf("Terminating receive thread for client[%i]\n", client->connfd);
+	LOG_INFO("Terminating receive thread for client[%i] (%lu requests rate limited)\n",
+		   client->connection_id, (unsigned long)client->rate_limiter.DroppedCount());
 	client->client_connected.store(false);
+	game->RemovePlayer(&client->client_player);
 
-	pthread_mutex_lock(&connected_clients_mutex);
+	connected_clients_mutex.Lock();
 	pthread_cond_broadcast(&client_cond_respond);
-	pthread_mutex_unlock(&connected_clients_mutex);
+	connected_clients_mutex.Unlock();
 
+	ClientThreadFinished(client);
 	return NULL;
 }
 
+// Joins a client's threads and frees it with its transport. The client must
+// no longer be in connected_clients.
+static void FreeClient(Client* client)
+{
+	void* thread_return_status;
+	Pthread_join(client->receive_tid, &thread_return_status);
+	Pthread_join(client->respond_tid, &thread_return_status);
+	delete client->transport;
 
-int main(int argc, char **argv)
+	Memory::Owner memory_owner = client->memory_owner;
+	delete client;
+	Memory::CloseOwner(memory_owner);
+}
+
+// Frees every client whose threads have finished, so a long-running room
+// does not keep their threads, connections and memory until it closes.
+// Returns the number of clients left. Only the game loop thread may call it.
+static size_t ReapClients()
 {
-	struct sockaddr_storage clientaddr;
-	char client_hostname[MAXLINE], client_port[MAXLINE];
+	std::vector<Client*> finished;
+	connected_clients_mutex.Lock();
+	auto first_finished = std::stable_partition(
+		connected_clients.begin(), connected_clients.end(),
+		[](Client* client) { return client->threads_running.load() > 0; });
+	finished.assign(first_finished, connected_clients.end());
+	connected_clients.erase(first_finished, connected_clients.end());
+	const size_t remaining = connected_clients.size();
+	connected_clients_mutex.Unlock();
 
-	if (argc != 2) {
-		fprintf(stderr, "usage: %s <port>\n", argv[0]);
-		exit(0);
+	finished_clients.fetch_sub(finished.size());
+	for (Client* client : finished)
+	{
+		LOG_INFO("client[%i]: freed\n", client->connection_id);
+		FreeClient(client);
 	}
+	return remaining;
+}
+
+
+//
+// ADMIN COMMANDS
+// Served by the admin socket thread, see admin.hpp. They only take the same
+// locks as the client threads, so the simulation keeps running.
+
+static const char* GameStateName(GameStateType state)
+{
+	switch (state)
+	{
+	case GameStateType::not_started: return "not_started";
+	case GameStateType::running: return "running";
+	case GameStateType::paused: return "paused";
+	case GameStateType::ended: return "ended";
+	}
+	return "?";
+}
+
+static bool AdminRooms(int, char**, std::string& reply)
+{
+	// the lock keeps the room from being replaced while it is read
+	connected_clients_mutex.Lock();
+	if (game == nullptr)
+	{
+		connected_clients_mutex.Unlock();
+		reply += "no room is running";
+		return false;
+	}
+	WorldSnapshot snapshot = game->GetSnapshot();
+	const unsigned int max_players = game->MaxPlayers();
+	unsigned int connections = 0;
+	for (auto& client_ptr : connected_clients)
+	{
+		if (client_ptr->client_connected) connections++;
+	}
+	connected_clients_mutex.Unlock();
+
+	// every shard process hosts one room at a time, with its own admin socket
+	char line[256];
+	snprintf(line, sizeof(line),
+			 "room %d: %s, tick %lu at %d Hz, %u/%u players, %u connections, "
+			 "%u projectiles, %zu bytes queued\n",
+			 (int)getpid(), GameStateName(snapshot.game_state),
+			 (unsigned long)snapshot.tick, tick_rate.load(), snapshot.player_count,
+			 max_players, connections, snapshot.projectile_count,
+			 global_queued_bytes.load());
+	reply += line;
+	return true;
+}
+
+static bool AdminConnections(int, char**, std::string& reply)
+{
+	char line[256];
+	connected_clients_mutex.Lock();
+	for (auto& client_ptr : connected_clients)
+	{
+		client_ptr->client_mutex.Lock();
+		const OutboundQueue& queue = client_ptr->message_queue;
+		const char* state = !client_ptr->client_connected ? "closed" :
+			client_ptr->draining ? "draining" : "connected";
+		snprintf(line, sizeof(line),
+				 "connection %i: %s, player %u, queue depth %zu, %zu bytes (peak %zu), "
+				 "%lu coalesced, %lu dropped, %lu/%lu messages in/out\n",
+				 client_ptr->connection_id, state, (unsigned int)client_ptr->client_player.player_id,
+				 queue.Depth(), queue.Bytes(), queue.PeakBytes(),
+				 (unsigned long)queue.CoalescedCount(), (unsigned long)queue.DroppedCount(),
+				 (unsigned long)client_ptr->messages_received.load(),
+				 (unsigned long)client_ptr->messages_sent.load());
+		client_ptr->client_mutex.Unlock();
+		reply += line;
+	}
+	connected_clients_mutex.Unlock();
+	return true;
+}
+
+static bool AdminMetrics(int, char**, std::string& reply)
+{
+	Metrics::AppendPrometheus(reply);
+	AppendServerMetrics(reply);
+	return true;
+}
+
+static bool AdminLocks(int, char**, std::string& reply)
+{
+	AppendLockReport(reply);
+	return true;
+}
+
+static bool AdminMemory(int, char**, std::string& reply)
+{
+	Memory::AppendReport(reply);
+	return true;
+}
+
+static bool AdminTickRate(int argc, char** argv, std::string& reply)
+{
+	char line[64];
+	if (argc >= 2)
+	{
+		int rate = atoi(argv[1]);
+		if (rate < ServerSettings::kMinTickRate || rate > ServerSettings::kMaxTickRate)
+		{
+			snprintf(line, sizeof(line), "tick rate must be %d to %d Hz",
+					 ServerSettings::kMinTickRate, ServerSettings::kMaxTickRate);
+			reply += line;
+			return false;
+		}
+		tick_rate.store(rate);
+	}
+	snprintf(line, sizeof(line), "tick rate %d Hz\n", tick_rate.load());
+	reply += line;
+	return true;
+}
+
+static void AppendRateLimit(std::string& reply, const char* name, TokenBucketLimit limit)
+{
+	char line[128];
+	snprintf(line, sizeof(line), "%s: %.1f/s, burst %.1f\n", name, limit.rate, limit.burst);
+	reply += line;
+}
 
-	int listenfd = Open_listenfd(argv[1]); // TODO: error checking
+static bool AdminRateLimit(int argc, char** argv, std::string& reply)
+{
+	if (argc == 1)
+	{
+		AppendRateLimit(reply, "client", rate_limits.GetClientLimit());
+		for (unsigned int i = 0; i < Protocol::kClientRequestTypes; i++)
+		{
+			Protocol::ClientRequest request = (Protocol::ClientRequest)i;
+			AppendRateLimit(reply, Protocol::ClientRequestName(request),
+							rate_limits.GetRequestLimit(request));
+		}
+		return true;
+	}
+	if (argc != 4)
+	{
+		reply += "usage: rate-limit [<client|request> <rate> <burst>]";
+		return false;
+	}
+
+	TokenBucketLimit limit = { (float)atof(argv[2]), (float)atof(argv[3]) };
+	if (strcmp(argv[1], "client") == 0)
+	{
+		rate_limits.SetClientLimit(limit);
+		AppendRateLimit(reply, argv[1], limit);
+		return true;
+	}
+	for (unsigned int i = 0; i < Protocol::kClientRequestTypes; i++)
+	{
+		Protocol::ClientRequest request = (Protocol::ClientRequest)i;
+		if (strcmp(argv[1], Protocol::ClientRequestName(request)) != 0) continue;
+		rate_limits.SetRequestLimit(request, limit);
+		AppendRateLimit(reply, argv[1], limit);
+		return true;
+	}
+	reply += "unknown limit \"";
+	reply += argv[1];
+	reply += "\"";
+	return false;
+}
+
+static bool AdminLogLevel(int argc, char** argv, std::string& reply)
+{
+	if (argc >= 2)
+	{
+		Log::Level level;
+		if (!Log::ParseLevel(argv[1], level))
+		{
+			reply += "levels are debug, info, warn and error";
+			return false;
+		}
+		Log::SetLevel(level);
+	}
+	// SetLevel cannot go below the compiled-in level, so report what stuck
+	reply += "log level ";
+	reply += Log::LevelName(Log::GetLevel());
+	reply += "\n";
+	return true;
+}
+
+// Runs `action` on the connected client `argv[1]` ("all" for every one).
+// Caller of `action` holds client->client_mutex.
+static bool ForConnections(int argc, char** argv, std::string& reply,
+						   void (*action)(Client* client))
+{
+	if (argc != 2)
+	{
+		reply += "usage: ";
+		reply += argv[0];
+		reply += " <connection|all>";
+		return false;
+	}
+	const bool all = strcmp(argv[1], "all") == 0;
+	const int connection_id = atoi(argv[1]);
+
+	unsigned int matched = 0;
+	connected_clients_mutex.Lock();
+	for (auto& client_ptr : connected_clients)
+	{
+		if (!all && client_ptr->connection_id != connection_id) continue;
+		client_ptr->client_mutex.Lock();
+		if (client_ptr->client_connected && !client_ptr->draining)
+		{
+			action(client_ptr);
+			matched++;
+		}
+		client_ptr->client_mutex.Unlock();
+	}
+	connected_clients_mutex.Unlock();
+
+	if (matched == 0 && !all)
+	{
+		reply += "no open connection ";
+		reply += argv[1];
+		return false;
+	}
+	char line[64];
+	snprintf(line, sizeof(line), "%u connections\n", matched);
+	reply += line;
+	return true;
+}
+
+static void KickClient(Client* client)
+{
+	LOG_INFO("client[%i]: kicked by admin\n", client->connection_id);
+	client->client_connected.store(false);
+	client->message_queue.Clear();
+	client->transport->Shutdown();
+}
+
+// Stops reading from the client at once; the respond thread sends what is
+// already queued and then closes the connection.
+static void DrainClient(Client* client)
+{
+	LOG_INFO("client[%i]: draining %zu queued messages\n", client->connection_id,
+			 client->message_queue.Depth());
+	client->draining.store(true);
+	client->transport->ShutdownRead();
+}
+
+static bool AdminKick(int argc, char** argv, std::string& reply)
+{
+	return ForConnections(argc, argv, reply, KickClient);
+}
+
+static bool AdminDrain(int argc, char** argv, std::string& reply)
+{
+	return ForConnections(argc, argv, reply, DrainClient);
+}
+
+static const Admin::Command kAdminCommands[] = {
+	{ "rooms", "- room state, players and connections", AdminRooms },
+	{ "connections", "- every connection with its queue depth and traffic", AdminConnections },
+	{ "metrics", "- the Prometheus metrics dump", AdminMetrics },
+	{ "locks", "- lock contention report", AdminLocks },
+	{ "memory", "- heap usage per subsystem and owner", AdminMemory },
+	{ "tick-rate", "[hz] - show or change the tick rate", AdminTickRate },
+	{ "rate-limit", "[<client|request> <rate> <burst>] - show or change input rate limits",
+	  AdminRateLimit },
+	{ "log-level", "[debug|info|warn|error] - show or change the log level", AdminLogLevel },
+	{ "kick", "<connection|all> - disconnect at once, dropping queued messages", AdminKick },
+	{ "drain", "<connection|all> - stop reading, flush queued messages, then disconnect",
+	  AdminDrain },
+};
+
+
+// SIGINT/SIGTERM: removes the admin and metrics socket files, then dies of
+// the signal as before. Only async-signal-safe calls.
+static void RemoveSocketsAndDie(int signal_number)
+{
+	Admin::StopServer();
+	Metrics::StopExporter();
+	signal(signal_number, SIG_DFL);
+	raise(signal_number);
+}
+
+// Metrics exporter, admin socket and trace file, named after the process.
+// Once per process, before its room starts.
+void StartDiagnostics()
+{
+	char metrics_path[108];
+	snprintf(metrics_path, sizeof(metrics_path), ServerSettings::kMetricsSocketFormat,
+			 (int)getpid());
+	if (Metrics::StartExporter(metrics_path, AppendServerMetrics))
+	{
+		LOG_INFO("Serving metrics on %s\n", metrics_path);
+	}
+	char admin_path[108];
+	snprintf(admin_path, sizeof(admin_path), ServerSettings::kAdminSocketFormat, (int)getpid());
+	if (Admin::StartServer(admin_path, kAdminCommands,
+						   sizeof(kAdminCommands) / sizeof(kAdminCommands[0])))
+	{
+		LOG_INFO("Admin commands on %s\n", admin_path);
+	}
+	Signal(SIGINT, RemoveSocketsAndDie);
+	Signal(SIGTERM, RemoveSocketsAndDie);
+#ifdef SNG_TRACE
+	char trace_path[108];
+	snprintf(trace_path, sizeof(trace_path), ServerSettings::kTraceFileFormat, (int)getpid());
+	if (Trace::Start(trace_path))
+	{
+		LOG_INFO("Writing trace to %s\n", trace_path);
+		TRACE_THREAD_NAME("main");
+	}
+#endif
+}
+
+// cleared by StopRoom(), checked by the game loop once per tick
+std::atomic_bool room_running(false);
+
+void StopRoom()
+{
+	room_running.store(false);
+}
+
+// back-off bounds while the room's Accept() keeps failing, eg. out of fds
+static constexpr long kAcceptRetryMinMs = 10;
+static constexpr long kAcceptRetryMaxMs = 1000;
+
+void ServeRoom(TransportListener& listener, const char* name, int allowed_connections)
+{
 	InitServer();
-	InitGame();
-	printf("Server listening on port %s...\n", argv[1]);
+	InitGame(allowed_connections);
+	tick_rate.store(game->TickRate());
+	room_running.store(true);
+
+	LOG_INFO("Server[%d] listening on %s for %i players (room capacity %u)...\n",
+		   (int)getpid(), name, allowed_connections, game->MaxPlayers());
 
 	// Initial loop - wait for all players to join
-	const int temp_allowed_connections = 2; // just to get things working initially
 	int connections = 0;
-	while (connections < temp_allowed_connections)
+	long retry_ms = kAcceptRetryMinMs;
+	while (connections < allowed_connections)
 	{
-		socklen_t clientlen = sizeof(struct sockaddr_storage);
-		int new_connfd = Accept(listenfd, (SA *) &clientaddr, &clientlen);
+		char peer[2 * MAXLINE];
+		Transport* transport = listener.Accept(peer, sizeof(peer));
+		if (transport == nullptr)
+		{
+			// Accept() logged why; out of fds usually passes, so do not spin
+			// while it lasts
+			struct timespec delay = { retry_ms / 1000, (retry_ms % 1000) * 1000000 };
+			nanosleep(&delay, nullptr);
+			retry_ms = std::min(retry_ms * 2, kAcceptRetryMaxMs);
+			continue;
+		}
+		retry_ms = kAcceptRetryMinMs;
 
 		// Create client object to handle connection
-		Client* new_client = new Client();
-		new_client->connfd = new_connfd;
+		char owner_name[32];
+		snprintf(owner_name, sizeof(owner_name), "connection %i", transport->Id());
+		Memory::Owner memory_owner = Memory::OpenOwner(owner_name);
+		Client* new_client;
+		{
+			Memory::Scope scope(Memory::Tag::client, memory_owner);
+			new_client = new Client();
+		}
+		new_client->memory_owner = memory_owner;
+		new_client->transport = transport;
+		new_client->connection_id = transport->Id();
 		new_client->client_connected.store(true);
+		connected_clients_mutex.Lock();
 		connected_clients.push_back(new_client);
+		connected_clients_mutex.Unlock();
 		game->AddPlayer(&new_client->client_player);
 
 		// Spawn two threads for each connected client, one for receiving requests
@@ -367,35 +1045,267 @@ int main(int argc, char **argv)
 		Pthread_create(&new_client->respond_tid, nullptr, ClientRespondThread, new_client);
 
 		// Print debug information about connected client
-		Getnameinfo((SA *) &clientaddr, clientlen, client_hostname, MAXLINE,
-		            client_port, MAXLINE, 0);
-		printf("Connected to client (%s, %s) via threads (recv: %lu, resp: %lu)\n",
-		       client_hostname, client_port, new_client->receive_tid,
-		       new_client->respond_tid);
+		LOG_INFO("Connected to client (%s) via threads (recv: %lu, resp: %lu)\n",
+		       peer, new_client->receive_tid, new_client->respond_tid);
 
 		connections++;
 	}
 
-	// Game loop - play game
-	bool game_running = true;
-	printf("Game running...\n");
-	while (game_running)
+	// Game loop - advance the simulation at a fixed tick rate, and broadcast
+	// projectile state as one multi-line frame after each tick. Under
+	// overload the governor thins out frames and low-priority work.
+	int loop_tick_rate = tick_rate.load();
+	float tick_seconds = 1.0f / loop_tick_rate;
+	long tick_nanoseconds = 1000000000L / loop_tick_rate;
+	struct timespec next_tick;
+	clock_gettime(CLOCK_MONOTONIC, &next_tick);
+
+	int stats_interval_ticks = ServerSettings::kQueueStatsIntervalSeconds * loop_tick_rate;
+	int ticks_until_stats = stats_interval_ticks;
+	LoadGovernor governor(loop_tick_rate);
+
+	// tick frames are the room's memory
+	Memory::Scope memory_scope(Memory::Tag::untagged, room_memory_owner);
+	RespondMessagePool frame_pool(ServerSettings::kMaxTickFrameBytes,
+								  ServerSettings::kTickFramePoolSize);
+	uint64_t frame_fallbacks = 0;
+
+	// SNG_ALLOC_GUARD=report|abort arms the hot path allocation guard once
+	// the game has warmed up
+	Memory::GuardMode guard_mode = Memory::GuardMode::off;
+	const char* guard_env = getenv("SNG_ALLOC_GUARD");
+	if (guard_env && !Memory::ParseGuardMode(guard_env, guard_mode))
+	{
+		LOG_WARN("Unknown SNG_ALLOC_GUARD \"%s\", guard stays off\n", guard_env);
+	}
+	int ticks_until_guard = ServerSettings::kAllocGuardWarmupSeconds * loop_tick_rate;
+
+	LOG_INFO("Game running...\n");
+	while (room_running.load(std::memory_order_relaxed))
 	{
+		// the room closes once every player has left
+		if (finished_clients.load(std::memory_order_relaxed) > 0 && ReapClients() == 0)
+		{
+			LOG_INFO("All players left\n");
+			break;
+		}
+
+		// the tick period may have been changed through the admin socket
+		if (tick_rate.load(std::memory_order_relaxed) != loop_tick_rate)
+		{
+			loop_tick_rate = tick_rate.load();
+			tick_seconds = 1.0f / loop_tick_rate;
+			tick_nanoseconds = 1000000000L / loop_tick_rate;
+			stats_interval_ticks = ServerSettings::kQueueStatsIntervalSeconds * loop_tick_rate;
+			ticks_until_stats = std::min(ticks_until_stats, stats_interval_ticks);
+			governor.SetTickRate(loop_tick_rate);
+			LOG_INFO("Tick rate changed to %d Hz\n", loop_tick_rate);
+		}
 
+		next_tick.tv_nsec += tick_nanoseconds;
+		if (next_tick.tv_nsec >= 1000000000L)
+		{
+			next_tick.tv_nsec -= 1000000000L;
+			next_tick.tv_sec++;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next_tick, nullptr);
+		TRACE_SPAN("tick");
+
+		int64_t work_start_ns = MonotonicNowNs();
+		bool send_frame = governor.ShouldSendFrame();
+
+		game->Tick(tick_seconds, send_frame || !governor.ShedLowPriorityWork());
+		if (send_frame)
+		{
+			std::shared_ptr<RespondMessage> frame = frame_pool.Acquire();
+			size_t frame_length = game->EncodeProjectiles(frame->GetMessage(), frame->GetCapacity(),
+														  governor.CompactEncoding());
+			if (frame_length > 0)
+			{
+				frame->Refill(frame_length);
+				BroadcastResponse(frame);
+			}
+			if (frame_pool.FallbackCount() != frame_fallbacks)
+			{
+				Metrics::Add(Metrics::Counter::tick_frame_allocations,
+							 frame_pool.FallbackCount() - frame_fallbacks);
+				frame_fallbacks = frame_pool.FallbackCount();
+			}
+		}
+
+		if (guard_mode != Memory::GuardMode::off && --ticks_until_guard == 0)
+		{
+			LOG_INFO("Hot path allocation guard armed\n");
+			Memory::SetAllocationGuard(guard_mode);
+		}
+
+		if (--ticks_until_stats == 0)
+		{
+			if (!governor.ShedLowPriorityWork()) PrintConnectionStats();
+			ticks_until_stats = stats_interval_ticks;
+		}
+
+		int64_t work_ns = MonotonicNowNs() - work_start_ns;
+		Metrics::Record(Metrics::Histogram::tick_duration, work_ns);
+		governor.EndTick(work_ns, global_queued_bytes.load());
 	}
 
-	// Cleanup - wait for all receive and respond threads to finish
+	// Cleanup - disconnect everyone and wait for all receive and respond
+	// threads to finish
+	LOG_INFO("Closing room...\n");
+	connected_clients_mutex.Lock();
 	for (auto& client_ptr : connected_clients)
 	{
-		void* thread_return_status;
-		Pthread_join(client_ptr->receive_tid, &thread_return_status);
-		Pthread_join(client_ptr->respond_tid, &thread_return_status);
-		Close(client_ptr->connfd);
-
-		delete client_ptr;
+		client_ptr->client_mutex.Lock();
+		client_ptr->client_connected.store(false);
+		client_ptr->message_queue.Clear();
+		client_ptr->transport->Shutdown();
+		client_ptr->client_mutex.Unlock();
 	}
+	pthread_cond_broadcast(&client_cond_respond);
+	std::vector<Client*> clients;
+	clients.swap(connected_clients);
+	connected_clients_mutex.Unlock();
+
+	for (auto& client_ptr : clients) FreeClient(client_ptr);
+	finished_clients.store(0);
 
-	printf("Closing server socket...");
+	connected_clients_mutex.Lock();
 	delete game;
-	Close(listenfd);
+	game = nullptr;
+	connected_clients_mutex.Unlock();
+	if (room_journal.IsOpen())
+	{
+		LOG_INFO("Match journal closed after %llu records\n",
+				 (unsigned long long)room_journal.RecordCount());
+		room_journal.Close();
+	}
+	Memory::CloseOwner(room_memory_owner);
 }
+
+// ServeRoom() on an already listening TCP socket, one room after another:
+// once all players of a room have left, the next room takes new players.
+// Used directly, and by every shard process; never returns.
+void ServeSocketRoom(int listenfd, const char* port, int allowed_connections)
+{
+	// SNG_SOCKET_TIMESTAMPS=1 measures wire-to-wire latency with kernel
+	// timestamps on every connection
+	const char* timestamps_env = getenv("SNG_SOCKET_TIMESTAMPS");
+	const bool socket_timestamps = timestamps_env && strcmp(timestamps_env, "1") == 0;
+
+	char name[64];
+	snprintf(name, sizeof(name), "port %s", port);
+	SocketListener listener(listenfd, socket_timestamps, RecordWireToWire);
+
+	// SNG_CAPTURE=1 records what every client sends, for tools/wirereplay
+	const char* capture_env = getenv("SNG_CAPTURE");
+	if (capture_env && strcmp(capture_env, "1") == 0)
+	{
+		static WireCapture capture;
+		char capture_path[108];
+		snprintf(capture_path, sizeof(capture_path), ServerSettings::kCaptureFileFormat,
+				 (int)getpid());
+		if (capture.Open(capture_path))
+		{
+			LOG_INFO("Capturing client traffic to %s\n", capture_path);
+			RecordingListener recording_listener(listener, capture);
+			while (true) ServeRoom(recording_listener, name, allowed_connections);
+		}
+	}
+	while (true) ServeRoom(listener, name, allowed_connections);
+}
+
+
+//
+// SHARDING
+// `supervisor_fds` are the listen sockets the supervisor holds; the child
+// closes all but its own, so a shard's socket leaves the reuseport group as
+// soon as that shard exits.
+pid_t SpawnShard(int listenfd, const std::vector<int>& supervisor_fds,
+				 const char* port, int allowed_connections)
+{
+	// or the child would print the supervisor's buffered output again
+	fflush(stdout);
+	pid_t pid = Fork();
+	if (pid == 0)
+	{
+		for (int fd : supervisor_fds)
+		{
+			if (fd != listenfd) Close(fd);
+		}
+		StartDiagnostics();
+		ServeSocketRoom(listenfd, port, allowed_connections);
+		exit(0);
+	}
+	return pid;
+}
+
+// Runs `shard_count` room processes, each with its own SO_REUSEPORT socket
+// on `port`, and restarts any shard that exits. A crashed shard only takes
+// its own room down; the kernel keeps routing new connections to the others.
+// The supervisor prints directly: if it used the logger, its writer thread
+// would not survive the fork into the shards.
+void RunShards(const char* port, int allowed_connections,
+			   unsigned int shard_count, bool steer)
+{
+	// Bind every socket up front so each shard's position in the reuseport
+	// group (which the steering program indexes) matches its shard number.
+	std::vector<int> listenfds(shard_count);
+	for (unsigned int i = 0; i < shard_count; i++)
+	{
+		listenfds[i] = OpenReuseportListener(port);
+		if (listenfds[i] < 0) exit(1);
+	}
+	if (steer && !AttachShardSteering(listenfds[0], shard_count))
+	{
+		fprintf(stderr, "Steering unavailable, falling back to kernel hashing\n");
+	}
+
+	std::vector<pid_t> shard_pids(shard_count);
+	for (unsigned int i = 0; i < shard_count; i++)
+	{
+		shard_pids[i] = SpawnShard(listenfds[i], listenfds, port, allowed_connections);
+		printf("Started shard %u as process %d\n", i, (int)shard_pids[i]);
+	}
+	// the shards own their sockets now; a shard's socket must close with it
+	for (int listenfd : listenfds) Close(listenfd);
+
+	while (true)
+	{
+		int status;
+		pid_t pid = wait(&status);
+		if (pid < 0)
+		{
+			if (errno == EINTR) continue;
+			break;
+		}
+
+		for (unsigned int i = 0; i < shard_count; i++)
+		{
+			if (shard_pids[i] != pid) continue;
+
+			// NOTE: when the crashed shard's socket closed, the kernel moved the
+			// group's last socket into its slot; the restarted socket is
+			// appended at the end. So this shard and the previously last one
+			// swap steering indices (none change if this shard was last).
+			printf("Shard %u (process %d) exited with status %d, restarting\n",
+				   i, (int)pid, status);
+			int listenfd = OpenReuseportListener(port);
+			if (listenfd < 0)
+			{
+				fprintf(stderr, "Shard %u cannot listen again, not restarting it\n", i);
+				shard_pids[i] = -1;
+				break;
+			}
+			// every other socket was closed after the first spawn
+			shard_pids[i] = SpawnShard(listenfd, {}, port, allowed_connections);
+			Close(listenfd);
+			break;
+		}
+	}
+
+	// wait() only fails once no shard is left to restart
+	fprintf(stderr, "No shard left running: %s\n", strerror(errno));
+	exit(1);
+}
+
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "transport.hpp"
+
+// Process-wide server setup, see server.cpp.
+
+// Metrics exporter, admin socket and (with SNG_TRACE) the trace file, named
+// after the process id. Once per process.
+void StartDiagnostics();
+
+// Hosts one room: waits for `allowed_connections` clients from `listener`,
+// then runs the game loop until every player has left or StopRoom() is
+// called. `name` is only for the log. A process hosts one room at a time.
+void ServeRoom(TransportListener& listener, const char* name, int allowed_connections);
+
+// Ends the game loop of the running room after its current tick; ServeRoom()
+// then disconnects every client and returns.
+void StopRoom();
+
+// ServeRoom() over TCP on an already listening socket, one room after
+// another; never returns.
+void ServeSocketRoom(int listenfd, const char* port, int allowed_connections);
+
+// Runs `shard_count` room processes on a shared SO_REUSEPORT `port`; never
+// returns, and exits with an error once no shard can be restarted. `steer`
+// routes connections by source address.
+void RunShards(const char* port, int allowed_connections,
+			   unsigned int shard_count, bool steer);
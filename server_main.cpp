@@ -0,0 +1,39 @@
+/*
+ * Server
+ *
+ * usage: server <port> [players] [shards] [steer]
+ */
+
+#include "csapp.h"
+#include "server.hpp"
+
+
+int main(int argc, char **argv)
+{
+	if (argc < 2 || argc > 5) {
+		fprintf(stderr, "usage: %s <port> [players] [shards] [steer]\n", argv[0]);
+		exit(0);
+	}
+
+	// the room policy (and so the specialized Game) is picked by room size
+	const int allowed_connections = (argc >= 3) ? atoi(argv[2]) : 2;
+	if (allowed_connections < 1) {
+		fprintf(stderr, "players must be at least 1\n");
+		exit(0);
+	}
+
+	// shards > 1 runs one room process per shard on a shared SO_REUSEPORT
+	// port; steer = 1 routes connections by source address
+	const int shard_count = (argc >= 4) ? atoi(argv[3]) : 1;
+	const bool steer = (argc >= 5) && atoi(argv[4]) != 0;
+	if (shard_count > 1)
+	{
+		RunShards(argv[1], allowed_connections, shard_count, steer);
+		return 0;
+	}
+
+	StartDiagnostics();
+	int listenfd = Open_listenfd(argv[1]); // TODO: error checking
+	ServeSocketRoom(listenfd, argv[1], allowed_connections);
+	return 0;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstddef>
+#include "game_settings.hpp"
+#include "protocol.hpp"
+
+class ServerSettings
+{
+public:
+	// Outbound queue budgets. A client whose queue stays above the soft
+	// budget for kSlowClientGraceMs, or that would exceed its hard or entry
+	// limit, is disconnected as a slow consumer. The global budget caps the
+	// bytes queued across all clients of the process; a message that would
+	// exceed it is shed for that client instead. Both client budgets are
+	// counted in the largest tick frames (every projectile plus an expire
+	// notice for each): a client one full frame behind is not yet slow.
+	static constexpr size_t kMaxTickFrameBytes =
+		2 * GameSettings::kMaxProjectiles * Protocol::kMaxMessageLength;
+	static constexpr size_t kClientQueueSoftBytes = 2 * kMaxTickFrameBytes;
+	static constexpr size_t kClientQueueHardBytes = 4 * kMaxTickFrameBytes;
+	static constexpr size_t kClientQueueMaxEntries = 4096;
+	static constexpr size_t kGlobalQueueBytes = 16 * 1024 * 1024;
+	static constexpr long kSlowClientGraceMs = 2000;
+	// projectile frames the tick loop reuses; a frame is free again once
+	// every client has written it
+	static constexpr size_t kTickFramePoolSize = 4;
+	// move responses each receive thread reuses, per player of the room: a
+	// player's moves are coalesced, so every client holds at most one in
+	// its queue and one being written
+	static constexpr size_t kMoveResponsesPerPlayer = 2;
+
+	// Default input rate limits per client, as (requests per second, burst).
+	// Every request also draws from the client's overall bucket. Both can
+	// be changed at runtime through RateLimits.
+	static constexpr float kClientRequestRate = 100.0f;
+	static constexpr float kClientRequestBurst = 40.0f;
+	static constexpr float kMoveRequestRate = 60.0f;
+	static constexpr float kMoveRequestBurst = 20.0f;
+	static constexpr float kFireRequestRate = 10.0f;
+	static constexpr float kFireRequestBurst = 5.0f;
+	static constexpr float kControlRequestRate = 2.0f; // start, pause, quit
+	static constexpr float kControlRequestBurst = 4.0f;
+	static constexpr float kUnknownRequestRate = 5.0f;
+	static constexpr float kUnknownRequestBurst = 5.0f;
+
+	// Load shedding. The governor evaluates load every kGovernorWindowTicks
+	// and steps one shed level up when the room is overloaded, or one level
+	// down after kGovernorRecoverWindows calm windows in a row. A room is
+	// overloaded when tick work exceeds kTickBudgetHigh of the tick period,
+	// queued bytes exceed kQueueBudgetHigh of the global budget, or the
+	// process uses more than kCpuBudgetCores.
+	static constexpr int kGovernorWindowTicks = 15;
+	static constexpr int kGovernorRecoverWindows = 4;
+	static constexpr float kTickBudgetHigh = 0.5f;
+	static constexpr float kTickBudgetLow = 0.2f;
+	static constexpr float kQueueBudgetHigh = 0.5f;
+	static constexpr float kQueueBudgetLow = 0.1f;
+	static constexpr float kCpuBudgetCores = 1.0f;
+	static constexpr float kCpuBudgetLow = 0.6f; // fraction of kCpuBudgetCores
+
+	// Prometheus metrics are served on this Unix socket (%d is the pid, so
+	// every shard gets its own)
+	static constexpr const char* kMetricsSocketFormat = "/tmp/simple-network-game-%d.metrics";
+
+	// admin commands (see admin.hpp) are taken on this Unix socket, one per
+	// room process like the metrics
+	static constexpr const char* kAdminSocketFormat = "/tmp/simple-network-game-%d.admin";
+	// the range the tick rate can be changed to at runtime
+	static constexpr int kMinTickRate = 1;
+	static constexpr int kMaxTickRate = 1000;
+
+	// timeline written by builds with tracing (make TRACE=1), see trace.hpp
+	static constexpr const char* kTraceFileFormat = "/tmp/simple-network-game-%d.trace.json";
+
+	// match journal of each room, written with SNG_JOURNAL=1 (see
+	// journal.hpp); %d is the pid, %u counts the process's rooms
+	static constexpr const char* kJournalFileFormat = "/tmp/simple-network-game-%d-%u.journal";
+
+	// inbound traffic of every connection, written with SNG_CAPTURE=1 (see
+	// wire_capture.hpp); %d is the pid
+	static constexpr const char* kCaptureFileFormat = "/tmp/simple-network-game-%d.capture";
+
+	// the hot path allocation guard (SNG_ALLOC_GUARD) is armed after this
+	// long in the game loop, so start-up allocations do not count
+	static constexpr int kAllocGuardWarmupSeconds = 5;
+
+	// how often the server prints queue and rate limit statistics
+	static constexpr int kQueueStatsIntervalSeconds = 10;
+};
+
+static_assert(ServerSettings::kClientQueueSoftBytes >= ServerSettings::kMaxTickFrameBytes &&
+			  ServerSettings::kClientQueueHardBytes > ServerSettings::kClientQueueSoftBytes,
+			  "the soft budget must hold a full tick frame, and the hard limit more than that");
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <cstdint>
+
+// Generational handles, shared by server and client.
+//
+// The low kSlotIndexBits of a handle select a slot; the high bits carry the
+// generation the slot had when the handle was issued. Freeing a slot bumps
+// its generation, so old handles go stale instead of silently referring to
+// whatever reuses the slot. Generation 0 is never issued, which keeps 0
+// available as the invalid handle.
+typedef uint32_t SlotHandle;
+constexpr SlotHandle kInvalidSlotHandle = 0;
+constexpr unsigned int kSlotIndexBits = 16;
+constexpr uint32_t kSlotIndexMask = (1u << kSlotIndexBits) - 1;
+
+inline uint32_t SlotHandleIndex(SlotHandle handle) { return handle & kSlotIndexMask; }
+inline uint32_t SlotHandleGeneration(SlotHandle handle) { return handle >> kSlotIndexBits; }
+inline SlotHandle MakeSlotHandle(uint32_t index, uint32_t generation)
+{
+	return (generation << kSlotIndexBits) | index;
+}
+
+
+// Issues generational handles and maps them onto a dense index range
+// [0, Size()), so the owner can keep its data packed in plain arrays (one
+// array per field, if it likes). Removing swaps the last dense element into
+// the hole; the owner must mirror that move in its own arrays.
+//
+// All storage is inline: no allocation after construction.
+template <unsigned int Capacity>
+class SlotIndex
+{
+	static_assert(Capacity > 0 && Capacity <= kSlotIndexMask,
+				  "slot capacity exceeds handle index bits");
+
+public:
+	SlotIndex()
+	{
+		mSize = 0;
+		mFreeCount = Capacity;
+		for (unsigned int i = 0; i < Capacity; i++)
+		{
+			// pop order is ascending slot index
+			mFreeSlots[i] = Capacity - 1 - i;
+			mGeneration[i] = 1;
+			mSlotToDense[i] = 0;
+		}
+	}
+
+	// Returns kInvalidSlotHandle if full. The new element's dense index is
+	// Size() - 1 after the call.
+	SlotHandle Insert()
+	{
+		if (mFreeCount == 0) return kInvalidSlotHandle;
+
+		uint32_t slot = mFreeSlots[--mFreeCount];
+		unsigned int dense = mSize++;
+		mSlotToDense[slot] = dense;
+		mDenseToSlot[dense] = slot;
+		return MakeSlotHandle(slot, mGeneration[slot]);
+	}
+
+	bool Contains(SlotHandle handle) const
+	{
+		uint32_t slot = SlotHandleIndex(handle);
+		if (slot >= Capacity) return false;
+		if (SlotHandleGeneration(handle) != mGeneration[slot]) return false;
+
+		unsigned int dense = mSlotToDense[slot];
+		return dense < mSize && mDenseToSlot[dense] == slot;
+	}
+
+	// returns -1 if the handle is stale
+	int DenseIndex(SlotHandle handle) const
+	{
+		return Contains(handle) ? (int)mSlotToDense[SlotHandleIndex(handle)] : -1;
+	}
+
+	SlotHandle HandleAt(unsigned int dense) const
+	{
+		uint32_t slot = mDenseToSlot[dense];
+		return MakeSlotHandle(slot, mGeneration[slot]);
+	}
+
+	// Frees the element at `dense`. The element previously at `moved_from`
+	// (the last dense index) now lives at `dense`; if the two are equal
+	// nothing moved.
+	void RemoveDense(unsigned int dense, unsigned int& moved_from)
+	{
+		uint32_t slot = mDenseToSlot[dense];
+		if (++mGeneration[slot] == 0) mGeneration[slot] = 1;
+		mFreeSlots[mFreeCount++] = slot;
+
+		moved_from = --mSize;
+		if (dense != moved_from)
+		{
+			mDenseToSlot[dense] = mDenseToSlot[moved_from];
+			mSlotToDense[mDenseToSlot[dense]] = dense;
+		}
+	}
+
+	unsigned int Size() const { return mSize; }
+
+private:
+	uint32_t mDenseToSlot[Capacity];
+	unsigned int mSize;
+
+	uint32_t mSlotToDense[Capacity];
+	uint16_t mGeneration[Capacity];
+	uint32_t mFreeSlots[Capacity];
+	unsigned int mFreeCount;
+};
+
+
+// Dense slot map of values: O(1) insert, lookup and removal by handle, and
+// contiguous iteration over the live values.
+template <typename T, unsigned int Capacity>
+class SlotMap
+{
+public:
+	// returns kInvalidSlotHandle if full
+	SlotHandle Insert(const T& value)
+	{
+		SlotHandle handle = mIndex.Insert();
+		if (handle != kInvalidSlotHandle) mValues[mIndex.Size() - 1] = value;
+		return handle;
+	}
+
+	// returns nullptr if the handle is stale
+	T* Get(SlotHandle handle)
+	{
+		int dense = mIndex.DenseIndex(handle);
+		return dense < 0 ? nullptr : &mValues[dense];
+	}
+
+	// returns false if the handle is stale
+	bool Remove(SlotHandle handle)
+	{
+		int dense = mIndex.DenseIndex(handle);
+		if (dense < 0) return false;
+
+		unsigned int moved_from;
+		mIndex.RemoveDense(dense, moved_from);
+		if ((unsigned int)dense != moved_from) mValues[dense] = mValues[moved_from];
+		return true;
+	}
+
+	bool Contains(SlotHandle handle) const { return mIndex.Contains(handle); }
+	SlotHandle HandleAt(unsigned int dense) const { return mIndex.HandleAt(dense); }
+	unsigned int Size() const { return mIndex.Size(); }
+
+	T* begin() { return mValues; }
+	T* end() { return mValues + mIndex.Size(); }
+	const T* begin() const { return mValues; }
+	const T* end() const { return mValues + mIndex.Size(); }
+
+private:
+	SlotIndex<Capacity> mIndex;
+	T mValues[Capacity];
+};
+
+
+// Lookup table for handles issued by someone else, eg. the client's view of
+// server-issued player ids. Values live at their handle's slot index, so
+// lookup is a single array access plus a generation check.
+template <typename T, unsigned int Capacity>
+class SlotMirror
+{
+public:
+	SlotMirror()
+	{
+		for (auto& handle : mHandles) handle = kInvalidSlotHandle;
+	}
+
+	// Claims the handle's slot, evicting any older generation living there,
+	// and returns the reset value. Returns nullptr if the handle is invalid,
+	// out of range or already present.
+	T* Insert(SlotHandle handle)
+	{
+		uint32_t slot = SlotHandleIndex(handle);
+		if (handle == kInvalidSlotHandle || slot >= Capacity) return nullptr;
+		if (mHandles[slot] == handle) return nullptr;
+
+		mHandles[slot] = handle;
+		mValues[slot] = T();
+		return &mValues[slot];
+	}
+
+	// returns nullptr if the handle is unknown or stale
+	T* Find(SlotHandle handle)
+	{
+		uint32_t slot = SlotHandleIndex(handle);
+		if (handle == kInvalidSlotHandle || slot >= Capacity) return nullptr;
+		return mHandles[slot] == handle ? &mValues[slot] : nullptr;
+	}
+
+	bool Remove(SlotHandle handle)
+	{
+		if (Find(handle) == nullptr) return false;
+		mHandles[SlotHandleIndex(handle)] = kInvalidSlotHandle;
+		return true;
+	}
+
+private:
+	SlotHandle mHandles[Capacity];
+	T mValues[Capacity];
+};
@@ -0,0 +1,163 @@
+#include "socket_timestamps.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+
+
+bool EnableSocketTimestamps(int fd)
+{
+	int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_TX_SOFTWARE |
+		SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+	return setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == 0;
+}
+
+int64_t RealtimeNowNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Returns the software timestamp of a control message list, or 0.
+static int64_t SoftwareTimestamp(struct msghdr* msg)
+{
+	for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg))
+	{
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING)
+		{
+			struct scm_timestamping stamps;
+			memcpy(&stamps, CMSG_DATA(cmsg), sizeof(stamps));
+			return (int64_t)stamps.ts[0].tv_sec * 1000000000 + stamps.ts[0].tv_nsec;
+		}
+	}
+	return 0;
+}
+
+
+TimestampedLineReader::TimestampedLineReader(int fd)
+{
+	mFd = fd;
+	mNext = mBuffer;
+	mCount = 0;
+	mLastRxNs = 0;
+}
+
+ssize_t TimestampedLineReader::Fill()
+{
+	char control[CMSG_SPACE(sizeof(struct scm_timestamping))];
+	struct iovec iov = { mBuffer, sizeof(mBuffer) };
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	ssize_t count;
+	do
+	{
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		count = recvmsg(mFd, &msg, 0);
+	} while (count < 0 && errno == EINTR);
+	if (count <= 0) return count;
+
+	int64_t rx_ns = SoftwareTimestamp(&msg);
+	if (rx_ns) mLastRxNs = rx_ns;
+	mNext = mBuffer;
+	mCount = count;
+	return count;
+}
+
+ssize_t TimestampedLineReader::ReadLine(char* buf, size_t maxlen, int64_t* kernel_rx_ns)
+{
+	size_t n = 0;
+	while (n + 1 < maxlen)
+	{
+		if (mCount == 0)
+		{
+			ssize_t filled = Fill();
+			if (filled < 0) return -1;
+			if (filled == 0)
+			{
+				if (n == 0) return 0; // EOF, no data read
+				break;
+			}
+		}
+
+		char c = *mNext++;
+		mCount--;
+		buf[n++] = c;
+		if (c == '\n') break;
+	}
+	buf[n] = '\0';
+	*kernel_rx_ns = mLastRxNs;
+	return n;
+}
+
+
+TxTimestampTracker::TxTimestampTracker(int fd)
+{
+	mFd = fd;
+	mBytesSent = 0;
+	mHead = mTail = 0;
+}
+
+void TxTimestampTracker::Sent(size_t length, int64_t rx_ns)
+{
+	mBytesSent += length;
+	if (rx_ns == 0 || length == 0) return;
+
+	// the oldest entry gives way if timestamps stop arriving
+	if (mTail - mHead == kMaxPending) mHead++;
+	mPending[mTail % kMaxPending] = Pending{ (uint32_t)(mBytesSent - 1), rx_ns };
+	mTail++;
+}
+
+void TxTimestampTracker::Poll(void (*on_latency)(int64_t wire_ns))
+{
+	char control[512];
+	char data[64];
+	struct iovec iov = { data, sizeof(data) };
+	struct msghdr msg;
+
+	while (true)
+	{
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(mFd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) return;
+
+		int64_t tx_ns = SoftwareTimestamp(&msg);
+		const struct sock_extended_err* error = nullptr;
+		for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+		{
+			if ((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+				(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+			{
+				error = (const struct sock_extended_err*)CMSG_DATA(cmsg);
+			}
+		}
+		if (tx_ns == 0 || error == nullptr ||
+			error->ee_origin != SO_EE_ORIGIN_TIMESTAMPING) continue;
+
+		// Writes without a request behind them have no entry, and a write
+		// split by the kernel yields a stamp per part; skip entries the
+		// stamp has already passed.
+		const uint32_t key = error->ee_data;
+		while (mHead != mTail && (int32_t)(mPending[mHead % kMaxPending].key - key) < 0)
+		{
+			mHead++;
+		}
+		if (mHead != mTail && mPending[mHead % kMaxPending].key == key)
+		{
+			on_latency(tx_ns - mPending[mHead % kMaxPending].rx_ns);
+			mHead++;
+		}
+	}
+}
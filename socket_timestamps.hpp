@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+
+// Kernel software timestamps (SO_TIMESTAMPING) on TCP connections, so
+// latency can be measured from the moment a request reached the socket to
+// the moment the resulting broadcast left it, including the time both spent
+// in socket buffers. Software timestamps work on any device, loopback too.
+//
+// All timestamps are CLOCK_REALTIME nanoseconds, like the kernel's.
+
+// Turns on software RX and TX timestamps for `fd`. TX timestamps are keyed
+// by byte offset (SOF_TIMESTAMPING_OPT_ID) and carry no payload.
+bool EnableSocketTimestamps(int fd);
+
+int64_t RealtimeNowNs();
+
+
+// Buffered line reader with the contract of rio_readlineb, but it reads with
+// recvmsg so it can report when the kernel received each line.
+class TimestampedLineReader
+{
+public:
+	explicit TimestampedLineReader(int fd);
+
+	// `kernel_rx_ns` gets the receive timestamp of the segment that completed
+	// the line, or 0 if the socket delivered none.
+	ssize_t ReadLine(char* buf, size_t maxlen, int64_t* kernel_rx_ns);
+
+private:
+	// returns the byte count of the refill, 0 on EOF, -1 on error
+	ssize_t Fill();
+
+	int mFd;
+	char mBuffer[8192];
+	char* mNext;
+	size_t mCount;
+	int64_t mLastRxNs;
+};
+
+
+// Matches TX timestamps from a socket's error queue to the messages written
+// to it. Used only by the thread writing to the socket.
+class TxTimestampTracker
+{
+public:
+	explicit TxTimestampTracker(int fd);
+
+	// Call after every successful write of `length` bytes. `rx_ns` is the
+	// kernel receive time of the request behind them, or 0 if there is none.
+	void Sent(size_t length, int64_t rx_ns);
+
+	// Reads any pending TX timestamps without blocking and reports the
+	// wire-to-wire latency of every matched message.
+	void Poll(void (*on_latency)(int64_t wire_ns));
+
+private:
+	struct Pending
+	{
+		uint32_t key; // OPT_ID: offset of the message's last byte
+		int64_t rx_ns;
+	};
+	static constexpr unsigned int kMaxPending = 256;
+
+	int mFd;
+	uint64_t mBytesSent;
+	Pending mPending[kMaxPending];
+	unsigned int mHead;
+	unsigned int mTail;
+};
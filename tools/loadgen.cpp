@@ -0,0 +1,612 @@
+/*
+ * Headless load generator
+ *
+ * Opens many connections to a server and drives each one as a bot that
+ * speaks the real protocol: it waits for its player, sends CLT_REQ_START,
+ * moves in a pattern at a fixed rate once the game starts, optionally pauses
+ * and unpauses the game, and sends CLT_REQ_QUIT when its time is up. No
+ * window or GL is needed, so it runs on any CI box.
+ *
+ * A room starts only once it is full and every player is ready, so the bot
+ * count must fill the rooms exactly. With a port range the bots are split
+ * evenly over the ports, eg. 1000 bots in 20 rooms of 50:
+ *
+ *   for port in $(seq 7000 7019); do server $port 50 & done
+ *   loadgen 127.0.0.1 7000-7019 -c 1000
+ *
+ * (Shards on one port do not work here: the kernel spreads connections over
+ * them by hash, so the rooms do not fill evenly.)
+ *
+ * Latency is measured from sending a move until the bot reads its own
+ * SRV_RES_MOVE. The server may coalesce queued moves of one player, so each
+ * echo acknowledges every move sent before it and is timed from the oldest
+ * of them. Bots mirror the arena bounds so no move is rejected; keep the
+ * move rate under the server's move rate limit (60/s) or dropped moves show
+ * up as unacknowledged.
+ *
+ * usage: loadgen <host> <port[-last_port]> [-c bots] [-t threads] [-d seconds] [-r moves/s]
+ *                [-m still|line|circle|random] [-s step] [-p pause_every_seconds]
+ *                [-j join_timeout_seconds]
+ */
+
+#include "hdr_histogram.hpp"
+#include "protocol.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+#include <netdb.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+
+enum class Pattern { still, line, circle, random };
+
+struct Options
+{
+	const char* host;
+	int first_port;
+	int port_count = 1;
+	unsigned int bots = 100;
+	unsigned int threads = 1;
+	double duration_seconds = 10.0;
+	double move_rate = 20.0;
+	Pattern pattern = Pattern::circle;
+	float step = 0.005f;
+	double pause_every_seconds = 0.0; // 0 disables pausing
+	double join_timeout_seconds = 10.0;
+};
+
+static constexpr float kArenaMin = -1.0f;
+static constexpr float kArenaMax = 1.0f;
+// how long a bot keeps the game paused
+static constexpr int64_t kPauseNs = 200 * 1000000L;
+
+static int64_t NowNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+enum class BotState { connecting, joining, ready, playing, paused, done, failed };
+
+struct Bot
+{
+	int fd = -1;
+	const struct addrinfo* address;
+	BotState state = BotState::connecting;
+	PlayerId player_id = kInvalidPlayerId;
+	uint32_t rng;
+
+	// position as the server computes it, so moves stay inside the arena
+	float posX = 0.0f;
+	float posY = 0.0f;
+	float dirX = 1.0f; // for the line pattern
+	float angle = 0.0f;
+
+	int64_t start_ns = 0;
+	int64_t next_move_ns = 0;
+	int64_t oldest_unacked_ns = 0; // valid while unacked > 0
+	unsigned int unacked = 0;
+
+	int64_t next_pause_ns = 0;
+	int64_t pause_requested_ns = 0;
+	int64_t paused_at_ns = 0; // only set while this bot holds the pause
+
+	char buffer[8192];
+	size_t buffered = 0;
+};
+
+struct WorkerStats
+{
+	HdrHistogram latency; // ns
+	uint64_t moves_sent = 0;
+	uint64_t moves_echoed = 0;  // moves acknowledged by an echo
+	uint64_t moves_skipped = 0; // socket buffer full
+	uint64_t moves_lost = 0;    // unacknowledged when the game paused or ended
+	uint64_t messages_received = 0;
+	uint64_t bytes_received = 0;
+	uint64_t pauses = 0;
+	unsigned int started = 0;
+	unsigned int not_admitted = 0;
+	unsigned int failed = 0;
+	int64_t first_start_ns = 0;
+	int64_t last_done_ns = 0;
+};
+
+struct Worker
+{
+	const Options* options;
+	std::vector<Bot> bots;
+	WorkerStats stats;
+	pthread_t tid;
+};
+
+
+static uint32_t NextRandom(uint32_t& state)
+{
+	// xorshift32: repeatable per bot, no shared state between threads
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+static bool SendLine(Bot& bot, const char* line)
+{
+	size_t length = strlen(line);
+	ssize_t n = send(bot.fd, line, length, MSG_NOSIGNAL);
+	return n == (ssize_t)length;
+}
+
+static void Finish(Worker& worker, Bot& bot, BotState state)
+{
+	if (bot.unacked > 0) worker.stats.moves_lost += bot.unacked;
+	bot.unacked = 0;
+	if (bot.fd >= 0) close(bot.fd);
+	bot.fd = -1;
+
+	if (state == BotState::failed) worker.stats.failed++;
+	if (bot.state == BotState::connecting || bot.state == BotState::joining ||
+		bot.state == BotState::ready)
+	{
+		if (state != BotState::failed) worker.stats.not_admitted++;
+	}
+	else
+	{
+		worker.stats.last_done_ns = std::max(worker.stats.last_done_ns, NowNs());
+	}
+	bot.state = state;
+}
+
+// Picks the next step of the bot's pattern and reflects it off the arena
+// walls, using the same float arithmetic as Game::MovePlayer.
+static void NextStep(const Options& options, Bot& bot, float& stepX, float& stepY)
+{
+	switch (options.pattern)
+	{
+	case Pattern::still:
+		stepX = stepY = 0.0f;
+		return;
+	case Pattern::line:
+		stepX = options.step * bot.dirX;
+		stepY = 0.0f;
+		break;
+	case Pattern::circle:
+		bot.angle += 0.1f;
+		stepX = options.step * cosf(bot.angle);
+		stepY = options.step * sinf(bot.angle);
+		break;
+	case Pattern::random:
+		stepX = options.step * ((NextRandom(bot.rng) % 2001) / 1000.0f - 1.0f);
+		stepY = options.step * ((NextRandom(bot.rng) % 2001) / 1000.0f - 1.0f);
+		break;
+	}
+
+	float newX = bot.posX + stepX;
+	float newY = bot.posY + stepY;
+	if (newX > kArenaMax || newX < kArenaMin)
+	{
+		stepX = -stepX;
+		bot.dirX = -bot.dirX;
+	}
+	if (newY > kArenaMax || newY < kArenaMin) stepY = -stepY;
+	bot.posX += stepX;
+	bot.posY += stepY;
+}
+
+static void SendMove(Worker& worker, Bot& bot, int64_t now_ns)
+{
+	const Options& options = *worker.options;
+	float stepX = 0.0f, stepY = 0.0f;
+	NextStep(options, bot, stepX, stepY);
+	bot.next_move_ns += (int64_t)(1e9 / options.move_rate);
+	if (bot.next_move_ns < now_ns) bot.next_move_ns = now_ns; // fell behind
+
+	char line[Protocol::kMaxMessageLength];
+	Protocol::CreateMoveRequest(line, stepX, stepY);
+	if (!SendLine(bot, line))
+	{
+		// undo the prediction, the server never saw this move
+		bot.posX -= stepX;
+		bot.posY -= stepY;
+		worker.stats.moves_skipped++;
+		return;
+	}
+	worker.stats.moves_sent++;
+	if (bot.unacked++ == 0) bot.oldest_unacked_ns = now_ns;
+}
+
+static void StartPlaying(Worker& worker, Bot& bot, int64_t now_ns)
+{
+	const Options& options = *worker.options;
+	bot.state = BotState::playing;
+	bot.start_ns = now_ns;
+	worker.stats.started++;
+	if (worker.stats.first_start_ns == 0 || now_ns < worker.stats.first_start_ns)
+	{
+		worker.stats.first_start_ns = now_ns;
+	}
+
+	// spread the bots' moves over the whole interval
+	bot.next_move_ns = now_ns + NextRandom(bot.rng) % (int64_t)(1e9 / options.move_rate);
+	if (options.pause_every_seconds > 0)
+	{
+		bot.next_pause_ns = now_ns + (int64_t)(options.pause_every_seconds * 1e9) +
+			NextRandom(bot.rng) % (int64_t)(options.pause_every_seconds * 1e9);
+	}
+}
+
+static void HandleLine(Worker& worker, Bot& bot, const char* line, int64_t now_ns)
+{
+	worker.stats.messages_received++;
+
+	if (strncmp(line, "SRV_RES_MOVE ", 13) == 0)
+	{
+		char* end;
+		PlayerId subject = (PlayerId)strtoul(line + 13, &end, 10);
+		if (subject == bot.player_id && bot.unacked > 0)
+		{
+			worker.stats.latency.Record(now_ns - bot.oldest_unacked_ns);
+			worker.stats.moves_echoed += bot.unacked;
+			bot.unacked = 0;
+		}
+	}
+	else if (strncmp(line, "SRV_RES_YOUR_NEW_PLAYER ", 24) == 0)
+	{
+		if (sscanf(line + 24, "%u %f %f", &bot.player_id, &bot.posX, &bot.posY) != 3 ||
+			!SendLine(bot, Protocol::CLIENT_REQUEST_START))
+		{
+			Finish(worker, bot, BotState::failed);
+			return;
+		}
+		// the position is rounded to 6 decimals; good enough to stay inside
+		// the arena, which is all it is used for
+		bot.state = BotState::ready;
+	}
+	else if (strcmp(line, "SRV_RES_START") == 0)
+	{
+		if (bot.state == BotState::ready) StartPlaying(worker, bot, now_ns);
+	}
+	else if (strcmp(line, "SRV_RES_PAUSE") == 0)
+	{
+		// moves are rejected while paused, so nothing outstanding is echoed
+		worker.stats.moves_lost += bot.unacked;
+		bot.unacked = 0;
+		// the broadcast does not say who paused; assume the bot that asked
+		if (bot.pause_requested_ns != 0)
+		{
+			bot.paused_at_ns = now_ns;
+			worker.stats.pauses++;
+		}
+		bot.pause_requested_ns = 0;
+		if (bot.state == BotState::playing) bot.state = BotState::paused;
+	}
+	else if (strcmp(line, "SRV_RES_UNPAUSE") == 0)
+	{
+		bot.paused_at_ns = 0;
+		if (bot.state == BotState::paused)
+		{
+			bot.state = BotState::playing;
+			bot.next_move_ns = now_ns;
+		}
+	}
+	else if (strcmp(line, "SRV_RES_END_GAME") == 0)
+	{
+		// somebody in the room quit, which ends the game for everyone
+		if (bot.state == BotState::playing || bot.state == BotState::paused)
+		{
+			SendLine(bot, Protocol::CLIENT_REQUEST_QUIT);
+			Finish(worker, bot, BotState::done);
+		}
+	}
+}
+
+static void HandleReadable(Worker& worker, Bot& bot)
+{
+	while (bot.fd >= 0)
+	{
+		ssize_t n = recv(bot.fd, bot.buffer + bot.buffered,
+						 sizeof(bot.buffer) - 1 - bot.buffered, 0);
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+		if (n <= 0)
+		{
+			bool in_game = bot.state == BotState::playing || bot.state == BotState::paused;
+			Finish(worker, bot, in_game ? BotState::failed : BotState::done);
+			return;
+		}
+		worker.stats.bytes_received += n;
+		bot.buffered += n;
+
+		int64_t now_ns = NowNs();
+		char* line = bot.buffer;
+		char* newline;
+		while (bot.fd >= 0 &&
+			   (newline = (char*)memchr(line, '\n', bot.buffer + bot.buffered - line)))
+		{
+			*newline = '\0';
+			HandleLine(worker, bot, line, now_ns);
+			line = newline + 1;
+		}
+		if (bot.fd < 0) return;
+		bot.buffered = bot.buffer + bot.buffered - line;
+		memmove(bot.buffer, line, bot.buffered);
+		if (bot.buffered == sizeof(bot.buffer) - 1) bot.buffered = 0; // garbage, drop it
+	}
+}
+
+static bool Connect(Bot& bot, int epollfd)
+{
+	const struct addrinfo* address = bot.address;
+	bot.fd = socket(address->ai_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (bot.fd < 0) return false;
+
+	int one = 1;
+	setsockopt(bot.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	if (connect(bot.fd, address->ai_addr, address->ai_addrlen) != 0 && errno != EINPROGRESS)
+	{
+		return false;
+	}
+
+	struct epoll_event event;
+	event.events = EPOLLIN | EPOLLOUT;
+	event.data.ptr = &bot;
+	return epoll_ctl(epollfd, EPOLL_CTL_ADD, bot.fd, &event) == 0;
+}
+
+static void* WorkerThread(void* workerPtr)
+{
+	Worker& worker = *(Worker*)workerPtr;
+	const Options& options = *worker.options;
+	const int64_t join_deadline_ns = NowNs() + (int64_t)(options.join_timeout_seconds * 1e9);
+	const int64_t duration_ns = (int64_t)(options.duration_seconds * 1e9);
+
+	int epollfd = epoll_create1(0);
+	for (Bot& bot : worker.bots)
+	{
+		if (!Connect(bot, epollfd)) Finish(worker, bot, BotState::failed);
+	}
+
+	std::vector<struct epoll_event> events(256);
+	unsigned int active = worker.bots.size();
+	while (active > 0)
+	{
+		int count = epoll_wait(epollfd, events.data(), events.size(), 1);
+		for (int i = 0; i < count; i++)
+		{
+			Bot& bot = *(Bot*)events[i].data.ptr;
+			if (bot.fd < 0) continue;
+
+			if (bot.state == BotState::connecting)
+			{
+				int error = 0;
+				socklen_t length = sizeof(error);
+				getsockopt(bot.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+				if (error != 0)
+				{
+					Finish(worker, bot, BotState::failed);
+					continue;
+				}
+				// connected: from now on only reads are interesting
+				struct epoll_event event;
+				event.events = EPOLLIN;
+				event.data.ptr = &bot;
+				epoll_ctl(epollfd, EPOLL_CTL_MOD, bot.fd, &event);
+				bot.state = BotState::joining;
+			}
+			if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) HandleReadable(worker, bot);
+		}
+
+		// timers: moves, pauses, the end of each bot's run and the join timeout
+		int64_t now_ns = NowNs();
+		active = 0;
+		for (Bot& bot : worker.bots)
+		{
+			if (bot.fd < 0) continue;
+
+			if (bot.state == BotState::playing || bot.state == BotState::paused)
+			{
+				if (now_ns - bot.start_ns >= duration_ns)
+				{
+					SendLine(bot, Protocol::CLIENT_REQUEST_QUIT);
+					Finish(worker, bot, BotState::done);
+					continue;
+				}
+				if (bot.state == BotState::playing && options.pattern != Pattern::still)
+				{
+					while (bot.fd >= 0 && bot.next_move_ns <= now_ns) SendMove(worker, bot, now_ns);
+				}
+				if (bot.state == BotState::playing && bot.next_pause_ns != 0 &&
+					bot.next_pause_ns <= now_ns && bot.pause_requested_ns == 0)
+				{
+					if (SendLine(bot, Protocol::CLIENT_REQUEST_TOGGLE_PAUSE))
+					{
+						bot.pause_requested_ns = now_ns;
+					}
+					bot.next_pause_ns = now_ns + (int64_t)(options.pause_every_seconds * 1e9);
+				}
+				if (bot.state == BotState::paused && bot.paused_at_ns != 0 &&
+					now_ns - bot.paused_at_ns >= kPauseNs)
+				{
+					// only the pausing player can unpause; send it once
+					SendLine(bot, Protocol::CLIENT_REQUEST_TOGGLE_PAUSE);
+					bot.paused_at_ns = 0;
+				}
+				// somebody else paused first, so this bot's request was ignored
+				if (bot.pause_requested_ns != 0 && now_ns - bot.pause_requested_ns > kPauseNs)
+				{
+					bot.pause_requested_ns = 0;
+				}
+			}
+			else if (now_ns > join_deadline_ns)
+			{
+				Finish(worker, bot, BotState::done);
+				continue;
+			}
+			active++;
+		}
+	}
+	close(epollfd);
+	return nullptr;
+}
+
+
+static bool ParsePattern(const char* name, Pattern& pattern)
+{
+	static const char* kNames[] = { "still", "line", "circle", "random" };
+	for (int i = 0; i < 4; i++)
+	{
+		if (strcmp(name, kNames[i]) == 0)
+		{
+			pattern = (Pattern)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+static void Usage(const char* program)
+{
+	fprintf(stderr,
+			"usage: %s <host> <port[-last_port]> [-c bots] [-t threads] [-d seconds] [-r moves/s]\n"
+			"       [-m still|line|circle|random] [-s step] [-p pause_every_seconds]\n"
+			"       [-j join_timeout_seconds]\n", program);
+	exit(1);
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	int opt;
+	while ((opt = getopt(argc, argv, "c:t:d:r:m:s:p:j:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'c': options.bots = atoi(optarg); break;
+		case 't': options.threads = atoi(optarg); break;
+		case 'd': options.duration_seconds = atof(optarg); break;
+		case 'r': options.move_rate = atof(optarg); break;
+		case 'm': if (!ParsePattern(optarg, options.pattern)) Usage(argv[0]); break;
+		case 's': options.step = atof(optarg); break;
+		case 'p': options.pause_every_seconds = atof(optarg); break;
+		case 'j': options.join_timeout_seconds = atof(optarg); break;
+		default: Usage(argv[0]);
+		}
+	}
+	if (argc - optind != 2 || options.bots < 1 || options.threads < 1 ||
+		options.move_rate <= 0 || options.duration_seconds <= 0) Usage(argv[0]);
+	options.host = argv[optind];
+	int last_port;
+	switch (sscanf(argv[optind + 1], "%d-%d", &options.first_port, &last_port))
+	{
+	case 1: break;
+	case 2: options.port_count = last_port - options.first_port + 1; break;
+	default: Usage(argv[0]);
+	}
+	if (options.port_count < 1) Usage(argv[0]);
+	options.threads = std::min(options.threads, options.bots);
+
+	// every bot is a file descriptor
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+	{
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < options.bots + 16)
+	{
+		fprintf(stderr, "warning: only %lu file descriptors for %u bots\n",
+				(unsigned long)limit.rlim_cur, options.bots);
+	}
+
+	std::vector<struct addrinfo*> addresses(options.port_count);
+	for (int i = 0; i < options.port_count; i++)
+	{
+		struct addrinfo hints;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_socktype = SOCK_STREAM;
+		char port[16];
+		snprintf(port, sizeof(port), "%d", options.first_port + i);
+		int status = getaddrinfo(options.host, port, &hints, &addresses[i]);
+		if (status != 0)
+		{
+			fprintf(stderr, "%s:%s: %s\n", options.host, port, gai_strerror(status));
+			return 1;
+		}
+	}
+
+	std::vector<Worker> workers(options.threads);
+	for (unsigned int i = 0; i < options.threads; i++)
+	{
+		Worker& worker = workers[i];
+		worker.options = &options;
+		unsigned int first = (uint64_t)options.bots * i / options.threads;
+		unsigned int last = (uint64_t)options.bots * (i + 1) / options.threads;
+		worker.bots.resize(last - first);
+		for (unsigned int j = 0; j < worker.bots.size(); j++)
+		{
+			unsigned int index = first + j;
+			worker.bots[j].rng = 2463534242u + 7919u * index;
+			// consecutive bots share a port, so each room fills up
+			worker.bots[j].address = addresses[(uint64_t)index * options.port_count / options.bots];
+		}
+	}
+	for (Worker& worker : workers) pthread_create(&worker.tid, nullptr, WorkerThread, &worker);
+	for (Worker& worker : workers) pthread_join(worker.tid, nullptr);
+	for (struct addrinfo* address : addresses) freeaddrinfo(address);
+
+	WorkerStats total;
+	for (Worker& worker : workers)
+	{
+		const WorkerStats& stats = worker.stats;
+		total.latency.Merge(stats.latency);
+		total.moves_sent += stats.moves_sent;
+		total.moves_echoed += stats.moves_echoed;
+		total.moves_skipped += stats.moves_skipped;
+		total.moves_lost += stats.moves_lost;
+		total.messages_received += stats.messages_received;
+		total.bytes_received += stats.bytes_received;
+		total.pauses += stats.pauses;
+		total.started += stats.started;
+		total.not_admitted += stats.not_admitted;
+		total.failed += stats.failed;
+		if (stats.first_start_ns != 0 &&
+			(total.first_start_ns == 0 || stats.first_start_ns < total.first_start_ns))
+		{
+			total.first_start_ns = stats.first_start_ns;
+		}
+		total.last_done_ns = std::max(total.last_done_ns, stats.last_done_ns);
+	}
+
+	double seconds = (total.last_done_ns - total.first_start_ns) * 1e-9;
+	if (total.started == 0 || seconds <= 0) seconds = 1.0;
+	printf("bots: %u started, %u not admitted, %u failed\n",
+		   total.started, total.not_admitted, total.failed);
+	printf("moves: %lu sent (%.0f/s), %lu echoed, %lu lost, %lu skipped (socket full), "
+		   "%lu pauses\n",
+		   (unsigned long)total.moves_sent, total.moves_sent / seconds,
+		   (unsigned long)total.moves_echoed, (unsigned long)total.moves_lost,
+		   (unsigned long)total.moves_skipped, (unsigned long)total.pauses);
+	printf("received: %lu messages (%.0f/s), %.2f MB (%.2f MB/s)\n",
+		   (unsigned long)total.messages_received, total.messages_received / seconds,
+		   total.bytes_received / 1e6, total.bytes_received / 1e6 / seconds);
+	printf("move echo latency (us): p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f  "
+		   "(%lu samples)\n",
+		   total.latency.ValueAtPercentile(50) / 1e3, total.latency.ValueAtPercentile(90) / 1e3,
+		   total.latency.ValueAtPercentile(99) / 1e3, total.latency.ValueAtPercentile(99.9) / 1e3,
+		   total.latency.Max() / 1e3, (unsigned long)total.latency.Count());
+	return total.started > 0 && total.failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,496 @@
+/*
+ * Network impairment proxy
+ *
+ * Sits between clients (or loadgen bots) and a server and makes the link
+ * look like a real one: each direction of every connection gets a one-way
+ * latency with jitter, an optional bandwidth cap, and simulated packet
+ * loss. No root and no tc netem needed:
+ *
+ *   server 7000 4 &
+ *   netproxy 7100 127.0.0.1 7000 -l 40 -j 10 -b 2000 -L 1 &
+ *   loadgen 127.0.0.1 7100 -c 4
+ *
+ * The game runs over TCP, which never shows loss or reordering to the
+ * application: a lost segment holds up everything behind it until it is
+ * retransmitted. So loss here delays a chunk, and everything after it on
+ * that connection, by the retransmission time (-R, the kernel's 200 ms
+ * minimum RTO by default), and jitter never reorders bytes.
+ *
+ * Data is forwarded in the chunks it is read in. A direction stops reading
+ * once kMaxQueuedBytes are in flight, so a bandwidth cap pushes back on the
+ * sender like a full link would.
+ *
+ * usage: netproxy <listen_port> <server_host> <server_port> [-l latency_ms]
+ *                 [-j jitter_ms] [-b kbit/s] [-L loss_percent]
+ *                 [-R retransmit_ms] [-S seed]
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <queue>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+
+
+static constexpr size_t kReadBytes = 16 * 1024;
+static constexpr size_t kMaxQueuedBytes = 1024 * 1024;
+
+struct Options
+{
+	const char* listen_port;
+	const char* server_host;
+	const char* server_port;
+	int64_t latency_ns = 0;
+	int64_t jitter_ns = 0;
+	int64_t bits_per_second = 0; // 0 is unlimited
+	double loss = 0.0;
+	int64_t retransmit_ns = 200000000;
+	unsigned int seed = 1;
+};
+
+static int64_t NowNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+struct Chunk
+{
+	int64_t due_ns;
+	std::string data;
+	size_t written;
+};
+
+// One direction of a proxied connection.
+struct Direction
+{
+	int from;
+	int to;
+	std::deque<Chunk> queue;
+	size_t queued_bytes = 0;
+	int64_t last_due_ns = 0;
+	int64_t link_free_ns = 0; // when the capped link finishes the last chunk
+	bool read_closed = false;
+	bool write_blocked = false; // `to` returned EAGAIN, waiting for EPOLLOUT
+	bool shut = false;          // `to` got SHUT_WR after the last chunk
+
+	uint64_t bytes = 0;
+	uint64_t lost = 0;
+};
+
+struct Link
+{
+	int id;
+	int client_fd;
+	int server_fd;
+	Direction up;   // client to server
+	Direction down; // server to client
+	bool failed = false;
+};
+
+// epoll user data: which link and which socket
+static uint64_t EndpointKey(int link_id, bool server_side)
+{
+	return ((uint64_t)link_id << 1) | (server_side ? 1 : 0);
+}
+
+// a direction whose front chunk is due at `due_ns`
+struct Deadline
+{
+	int64_t due_ns;
+	int link_id;
+	bool up;
+	bool operator>(const Deadline& other) const { return due_ns > other.due_ns; }
+};
+
+static Options options;
+static std::mt19937_64 rng;
+static int epfd;
+static int timerfd;
+static std::unordered_map<int, Link*> links;
+static std::priority_queue<Deadline, std::vector<Deadline>, std::greater<Deadline>> deadlines;
+
+static void SetNonBlocking(int fd)
+{
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+static int ConnectServer()
+{
+	struct addrinfo hints, *list;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(options.server_host, options.server_port, &hints, &list) != 0) return -1;
+
+	int fd = -1;
+	for (struct addrinfo* p = list; p; p = p->ai_next)
+	{
+		fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+		if (fd < 0) continue;
+		// blocking: the proxy is meant for nearby servers
+		if (connect(fd, p->ai_addr, p->ai_addrlen) == 0) break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(list);
+	return fd;
+}
+
+static int OpenListener(const char* port)
+{
+	struct addrinfo hints, *list;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE | AI_ADDRCONFIG | AI_NUMERICSERV;
+	if (getaddrinfo(nullptr, port, &hints, &list) != 0) return -1;
+
+	int fd = -1;
+	for (struct addrinfo* p = list; p; p = p->ai_next)
+	{
+		fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+		if (fd < 0) continue;
+		int one = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (bind(fd, p->ai_addr, p->ai_addrlen) == 0 && listen(fd, 1024) == 0) break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(list);
+	return fd;
+}
+
+// Reads on a direction's source only while its queue has room.
+static void UpdateInterest(Link* link)
+{
+	auto events = [](const Direction& reading, const Direction& writing)
+	{
+		uint32_t events = 0;
+		if (!reading.read_closed && reading.queued_bytes < kMaxQueuedBytes) events |= EPOLLIN;
+		if (writing.write_blocked) events |= EPOLLOUT;
+		return events;
+	};
+	struct epoll_event event;
+	event.events = events(link->up, link->down);
+	event.data.u64 = EndpointKey(link->id, false);
+	epoll_ctl(epfd, EPOLL_CTL_MOD, link->client_fd, &event);
+	event.events = events(link->down, link->up);
+	event.data.u64 = EndpointKey(link->id, true);
+	epoll_ctl(epfd, EPOLL_CTL_MOD, link->server_fd, &event);
+}
+
+// When a chunk read now arrives at the other end.
+static int64_t DueTime(Direction& direction, size_t bytes, int64_t now_ns)
+{
+	int64_t sent_ns = now_ns;
+	if (options.bits_per_second > 0)
+	{
+		direction.link_free_ns = std::max(direction.link_free_ns, now_ns) +
+			(int64_t)bytes * 8 * 1000000000 / options.bits_per_second;
+		sent_ns = direction.link_free_ns;
+	}
+
+	int64_t due_ns = sent_ns + options.latency_ns;
+	if (options.jitter_ns > 0)
+	{
+		std::uniform_int_distribution<int64_t> jitter(-options.jitter_ns, options.jitter_ns);
+		due_ns = std::max(sent_ns, due_ns + jitter(rng));
+	}
+	if (options.loss > 0 && std::uniform_real_distribution<double>(0, 1)(rng) < options.loss)
+	{
+		due_ns += options.retransmit_ns;
+		direction.lost++;
+	}
+
+	// a TCP stream arrives in order, whatever the jitter
+	due_ns = std::max(due_ns, direction.last_due_ns);
+	direction.last_due_ns = due_ns;
+	return due_ns;
+}
+
+static void Read(Link* link, Direction& direction, bool up)
+{
+	char buffer[kReadBytes];
+	while (direction.queued_bytes < kMaxQueuedBytes)
+	{
+		ssize_t n = read(direction.from, buffer, sizeof(buffer));
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0 && errno == EAGAIN) return;
+		if (n <= 0)
+		{
+			direction.read_closed = true;
+			if (n < 0) link->failed = true;
+			// the shutdown waits behind the queued data
+			if (direction.queue.empty()) deadlines.push({ NowNs(), link->id, up });
+			return;
+		}
+
+		int64_t due_ns = DueTime(direction, n, NowNs());
+		if (direction.queue.empty()) deadlines.push({ due_ns, link->id, up });
+		direction.queue.push_back(Chunk{ due_ns, std::string(buffer, n), 0 });
+		direction.queued_bytes += n;
+		direction.bytes += n;
+	}
+}
+
+// Writes every chunk that is due; queues the next deadline.
+static void Flush(Link* link, Direction& direction, bool up)
+{
+	const int64_t now_ns = NowNs();
+	while (!direction.queue.empty() && !direction.write_blocked)
+	{
+		Chunk& chunk = direction.queue.front();
+		if (chunk.due_ns > now_ns)
+		{
+			deadlines.push({ chunk.due_ns, link->id, up });
+			return;
+		}
+
+		ssize_t n = write(direction.to, chunk.data.data() + chunk.written,
+						  chunk.data.size() - chunk.written);
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0 && errno == EAGAIN)
+		{
+			direction.write_blocked = true;
+			return;
+		}
+		if (n < 0)
+		{
+			link->failed = true;
+			return;
+		}
+		chunk.written += n;
+		if (chunk.written < chunk.data.size()) continue;
+		direction.queued_bytes -= chunk.data.size();
+		direction.queue.pop_front();
+	}
+
+	if (direction.queue.empty() && direction.read_closed && !direction.shut)
+	{
+		shutdown(direction.to, SHUT_WR);
+		direction.shut = true;
+	}
+}
+
+static void CloseLink(Link* link)
+{
+	printf("connection %d closed: %lu bytes up (%lu lost), %lu bytes down (%lu lost)\n",
+		   link->id, (unsigned long)link->up.bytes, (unsigned long)link->up.lost,
+		   (unsigned long)link->down.bytes, (unsigned long)link->down.lost);
+	fflush(stdout);
+	close(link->client_fd);
+	close(link->server_fd);
+	links.erase(link->id);
+	delete link;
+}
+
+static void Accept(int listenfd)
+{
+	static int next_id = 1;
+	while (true)
+	{
+		int client_fd = accept(listenfd, nullptr, nullptr);
+		if (client_fd < 0) return;
+
+		int server_fd = ConnectServer();
+		if (server_fd < 0)
+		{
+			fprintf(stderr, "cannot connect to %s:%s: %s\n", options.server_host,
+					options.server_port, strerror(errno));
+			close(client_fd);
+			continue;
+		}
+		SetNonBlocking(client_fd);
+		SetNonBlocking(server_fd);
+
+		Link* link = new Link();
+		link->id = next_id++;
+		link->client_fd = client_fd;
+		link->server_fd = server_fd;
+		link->up.from = link->down.to = client_fd;
+		link->up.to = link->down.from = server_fd;
+		links[link->id] = link;
+
+		struct epoll_event event;
+		event.events = EPOLLIN;
+		event.data.u64 = EndpointKey(link->id, false);
+		epoll_ctl(epfd, EPOLL_CTL_ADD, client_fd, &event);
+		event.data.u64 = EndpointKey(link->id, true);
+		epoll_ctl(epfd, EPOLL_CTL_ADD, server_fd, &event);
+		printf("connection %d opened\n", link->id);
+		fflush(stdout);
+	}
+}
+
+// Flushes or closes `link` after anything changed on it.
+static void Settle(Link* link)
+{
+	bool done = link->up.shut && link->down.shut;
+	if (link->failed || done)
+	{
+		CloseLink(link);
+		return;
+	}
+	UpdateInterest(link);
+}
+
+static void ArmTimer()
+{
+	struct itimerspec spec;
+	memset(&spec, 0, sizeof(spec));
+	if (!deadlines.empty())
+	{
+		// 0 would disarm the timer
+		int64_t due_ns = std::max<int64_t>(deadlines.top().due_ns, 1);
+		spec.it_value.tv_sec = due_ns / 1000000000;
+		spec.it_value.tv_nsec = due_ns % 1000000000;
+	}
+	timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+static void RunDeadlines()
+{
+	const int64_t now_ns = NowNs();
+	while (!deadlines.empty() && deadlines.top().due_ns <= now_ns)
+	{
+		Deadline deadline = deadlines.top();
+		deadlines.pop();
+		auto found = links.find(deadline.link_id);
+		if (found == links.end()) continue;
+		Link* link = found->second;
+		Flush(link, deadline.up ? link->up : link->down, deadline.up);
+		Settle(link);
+	}
+}
+
+static bool ParseOptions(int argc, char** argv)
+{
+	int opt;
+	while ((opt = getopt(argc, argv, "l:j:b:L:R:S:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'l': options.latency_ns = (int64_t)(atof(optarg) * 1e6); break;
+		case 'j': options.jitter_ns = (int64_t)(atof(optarg) * 1e6); break;
+		case 'b': options.bits_per_second = (int64_t)(atof(optarg) * 1e3); break;
+		case 'L': options.loss = atof(optarg) / 100.0; break;
+		case 'R': options.retransmit_ns = (int64_t)(atof(optarg) * 1e6); break;
+		case 'S': options.seed = strtoul(optarg, nullptr, 10); break;
+		default: return false;
+		}
+	}
+	if (argc - optind != 3) return false;
+	options.listen_port = argv[optind];
+	options.server_host = argv[optind + 1];
+	options.server_port = argv[optind + 2];
+	return options.latency_ns >= 0 && options.jitter_ns >= 0 && options.bits_per_second >= 0 &&
+		options.loss >= 0 && options.loss <= 1 && options.retransmit_ns >= 0;
+}
+
+int main(int argc, char** argv)
+{
+	if (!ParseOptions(argc, argv))
+	{
+		fprintf(stderr,
+			"usage: %s <listen_port> <server_host> <server_port> [-l latency_ms]\n"
+			"       [-j jitter_ms] [-b kbit/s] [-L loss_percent] [-R retransmit_ms] [-S seed]\n",
+			argv[0]);
+		return 1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+	rng.seed(options.seed);
+
+	int listenfd = OpenListener(options.listen_port);
+	if (listenfd < 0)
+	{
+		fprintf(stderr, "cannot listen on port %s\n", options.listen_port);
+		return 1;
+	}
+	fcntl(listenfd, F_SETFL, fcntl(listenfd, F_GETFL) | O_NONBLOCK);
+
+	epfd = epoll_create1(0);
+	timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	// links use ids from 1, so these keys cannot clash with theirs
+	const uint64_t kListenKey = EndpointKey(0, false);
+	const uint64_t kTimerKey = EndpointKey(0, true);
+	struct epoll_event event;
+	event.events = EPOLLIN;
+	event.data.u64 = kListenKey;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &event);
+	event.data.u64 = kTimerKey;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, timerfd, &event);
+
+	char bandwidth[32] = "unlimited";
+	if (options.bits_per_second > 0)
+	{
+		snprintf(bandwidth, sizeof(bandwidth), "%.0f kbit/s", options.bits_per_second / 1e3);
+	}
+	printf("proxying port %s to %s:%s: latency %.1f ms, jitter %.1f ms, bandwidth %s, "
+		   "loss %.2f%%\n", options.listen_port, options.server_host, options.server_port,
+		   options.latency_ns / 1e6, options.jitter_ns / 1e6, bandwidth, options.loss * 100);
+	fflush(stdout);
+
+	struct epoll_event events[256];
+	while (true)
+	{
+		RunDeadlines();
+		ArmTimer();
+		int count = epoll_wait(epfd, events, 256, -1);
+		if (count < 0 && errno != EINTR) break;
+
+		for (int i = 0; i < count; i++)
+		{
+			uint64_t key = events[i].data.u64;
+			if (key == kListenKey)
+			{
+				Accept(listenfd);
+				continue;
+			}
+			if (key == kTimerKey)
+			{
+				uint64_t expirations;
+				while (read(timerfd, &expirations, sizeof(expirations)) > 0) {}
+				continue;
+			}
+
+			// the link may have closed earlier in this batch
+			auto found = links.find((int)(key >> 1));
+			if (found == links.end()) continue;
+			Link* link = found->second;
+			const bool server_side = key & 1;
+			Direction& reading = server_side ? link->down : link->up;
+			Direction& writing = server_side ? link->up : link->down;
+
+			if (events[i].events & EPOLLOUT)
+			{
+				writing.write_blocked = false;
+				Flush(link, writing, !server_side);
+			}
+			if (events[i].events & EPOLLERR) link->failed = true;
+			if ((events[i].events & (EPOLLIN | EPOLLHUP)) && !reading.read_closed)
+			{
+				Read(link, reading, !server_side);
+			}
+			Settle(link);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,245 @@
+/*
+ * Match replay
+ *
+ * Re-simulates a match from its journal (a server run with SNG_JOURNAL=1
+ * writes one per room, see journal.hpp): a fresh room of the same policy
+ * and seed gets every recorded input in the recorded order, with no
+ * sockets, threads or tick pacing, so it runs as fast as the simulation
+ * allows. Every input must be accepted again, every joining player must
+ * get the recorded id, and the state checksums must match; the first
+ * divergence is reported with its record and fails the replay.
+ *
+ * -n replays the match that many times (to profile Game under a real input
+ * stream), -d prints every record as it is applied.
+ *
+ * usage: replay [-n repeats] [-d] <journal>
+ */
+
+#include "game.hpp"
+#include "journal.hpp"
+#include "log.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <unistd.h>
+
+
+static int64_t NowNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static const char* RecordName(JournalRecordType type)
+{
+	switch (type)
+	{
+	case JournalRecordType::join: return "join";
+	case JournalRecordType::leave: return "leave";
+	case JournalRecordType::ready: return "ready";
+	case JournalRecordType::start: return "start";
+	case JournalRecordType::quit: return "quit";
+	case JournalRecordType::pause: return "pause";
+	case JournalRecordType::unpause: return "unpause";
+	case JournalRecordType::move: return "move";
+	case JournalRecordType::fire: return "fire";
+	case JournalRecordType::tick: return "tick";
+	case JournalRecordType::checksum: return "checksum";
+	}
+	return "unknown";
+}
+
+static void PrintRecord(uint64_t index, const JournalRecord& record)
+{
+	printf("%8llu  tick %-7u %-8s", (unsigned long long)index, record.tick,
+		   RecordName(record.type));
+	if (record.player_id != kInvalidPlayerId) printf("  player %u", record.player_id);
+	if (record.type == JournalRecordType::move || record.type == JournalRecordType::fire)
+	{
+		printf("  (%f, %f)", record.x, record.y);
+	}
+	else if (record.type == JournalRecordType::tick)
+	{
+		printf("  dt %f", record.x);
+	}
+	else if (record.type == JournalRecordType::checksum)
+	{
+		printf("  %08x", record.checksum);
+	}
+	printf("\n");
+}
+
+struct ReplayResult
+{
+	int64_t wall_ns = 0;
+	uint64_t ticks = 0;
+	double game_seconds = 0.0;
+	uint64_t checksums = 0;
+};
+
+// Applies every record to a fresh room; returns false at the first
+// divergence, after printing it.
+static bool Replay(const JournalReader& journal, bool dump, ReplayResult& result)
+{
+	const JournalHeader& header = journal.Header();
+	std::unique_ptr<GameRoom> room(CreateGameRoom(header.max_players, header.seed));
+	if (!room)
+	{
+		fprintf(stderr, "No room policy fits %u players\n", header.max_players);
+		return false;
+	}
+
+	// players by the id they had in the recorded match
+	std::vector<std::unique_ptr<Player>> players;
+	std::unordered_map<PlayerId, Player*> players_by_id;
+	const JournalRecord* records = journal.Records();
+	const uint64_t count = journal.RecordCount();
+
+	const int64_t start_ns = NowNs();
+	for (uint64_t i = 0; i < count; i++)
+	{
+		const JournalRecord& record = records[i];
+		if (dump) PrintRecord(i, record);
+
+		bool applied = true;
+		const char* detail = "the room rejected it";
+		Player* player = nullptr;
+		if (record.type != JournalRecordType::join && record.player_id != kInvalidPlayerId)
+		{
+			auto it = players_by_id.find(record.player_id);
+			if (it != players_by_id.end()) player = it->second;
+			applied = player != nullptr;
+			if (!applied) detail = "unknown player";
+		}
+
+		if (applied)
+		{
+			switch (record.type)
+			{
+			case JournalRecordType::join:
+			{
+				players.emplace_back(new Player());
+				Player* joined = players.back().get();
+				applied = room->AddPlayer(joined) && joined->player_id == record.player_id;
+				if (applied) players_by_id[joined->player_id] = joined;
+				detail = "the player got a different id";
+				break;
+			}
+			case JournalRecordType::leave:
+				applied = room->RemovePlayer(player);
+				players_by_id.erase(record.player_id);
+				break;
+			case JournalRecordType::ready:
+				applied = room->PlayerSetReady(player);
+				break;
+			case JournalRecordType::start:
+				applied = room->TryStartGame();
+				break;
+			case JournalRecordType::quit:
+				applied = room->PlayerQuit(player);
+				break;
+			case JournalRecordType::pause:
+			case JournalRecordType::unpause:
+			{
+				GameStateType new_state;
+				applied = room->PauseUnpauseGame(player, new_state) &&
+					(new_state == GameStateType::paused) == (record.type == JournalRecordType::pause);
+				break;
+			}
+			case JournalRecordType::move:
+				applied = room->MovePlayer(player, record.x, record.y);
+				break;
+			case JournalRecordType::fire:
+				applied = room->FireProjectile(player, record.x, record.y) != kInvalidProjectile;
+				break;
+			case JournalRecordType::tick:
+				room->Tick(record.x);
+				result.ticks++;
+				result.game_seconds += record.x;
+				break;
+			case JournalRecordType::checksum:
+				applied = room->StateChecksum() == record.checksum;
+				result.checksums++;
+				detail = "the state checksum differs";
+				break;
+			default:
+				applied = false;
+				detail = "unknown record type";
+				break;
+			}
+		}
+
+		if (!applied)
+		{
+			fflush(stdout);
+			fprintf(stderr, "Replay diverged at record %llu (%s):\n",
+					(unsigned long long)i, detail);
+			PrintRecord(i, record);
+			return false;
+		}
+	}
+	result.wall_ns = NowNs() - start_ns;
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	int repeats = 1;
+	bool dump = false;
+	int opt;
+	while ((opt = getopt(argc, argv, "n:d")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n': repeats = atoi(optarg); break;
+		case 'd': dump = true; break;
+		default:
+			fprintf(stderr, "usage: %s [-n repeats] [-d] <journal>\n", argv[0]);
+			return 1;
+		}
+	}
+	if (optind != argc - 1 || repeats < 1)
+	{
+		fprintf(stderr, "usage: %s [-n repeats] [-d] <journal>\n", argv[0]);
+		return 1;
+	}
+
+	JournalReader journal;
+	char error[256];
+	if (!journal.Open(argv[optind], error, sizeof(error)))
+	{
+		fprintf(stderr, "%s: %s\n", argv[optind], error);
+		return 1;
+	}
+	const JournalHeader& header = journal.Header();
+	printf("%s: %llu records, room of %u players at %u Hz, seed %u\n", argv[optind],
+		   (unsigned long long)journal.RecordCount(), header.max_players, header.tick_rate,
+		   header.seed);
+
+	// rooms over two players warn about every join
+	Log::SetLevel(Log::Level::error);
+
+	int64_t best_ns = 0;
+	for (int run = 0; run < repeats; run++)
+	{
+		ReplayResult result;
+		if (!Replay(journal, dump && run == 0, result)) return 1;
+
+		const double wall_seconds = result.wall_ns / 1e9;
+		printf("run %d: %llu ticks (%.1f s of game time) in %.3f ms, %.0f ticks/s, "
+			   "%.0fx real time, %llu checksums matched\n",
+			   run + 1, (unsigned long long)result.ticks, result.game_seconds,
+			   result.wall_ns / 1e6, wall_seconds > 0 ? result.ticks / wall_seconds : 0.0,
+			   wall_seconds > 0 ? result.game_seconds / wall_seconds : 0.0,
+			   (unsigned long long)result.checksums);
+		if (run == 0 || result.wall_ns < best_ns) best_ns = result.wall_ns;
+	}
+	if (repeats > 1) printf("best run: %.3f ms\n", best_ns / 1e6);
+	return 0;
+}
@@ -0,0 +1,362 @@
+/*
+ * In-process room scenarios
+ *
+ * Runs rooms inside this process over in-memory transports (see
+ * transport.hpp) and drives them into the cases the outbound path has to
+ * get right, checking what each client reads:
+ *
+ *  coalesce   one player moves kFloodMoves times while the others do not
+ *             read; a stalled reader's pipe holds far fewer lines than that,
+ *             so it must later read that player's moves in order, fewer of
+ *             them than were made, ending with the latest
+ *  drain      the admin "drain" of a stalled reader still sends what was
+ *             queued for it, then closes the connection
+ *  kick       the admin "kick" of a stalled reader closes it, and nothing
+ *             broadcast afterwards reaches it
+ *  shutdown   StopRoom() returns, and closes every connection, while a
+ *             reader is stalled with the server blocked writing to it
+ *  slow       a reader that never reads while projectile frames pile up is
+ *             disconnected as a slow consumer; the other player is still
+ *             served
+ *
+ * A player's moves only go up, so the y of each SRV_RES_MOVE orders them.
+ * Nothing depends on timing: the slow scenario fires until the server's
+ * slow consumer count goes up, whichever budget trips it. A scenario that
+ * hangs is failed by a watchdog after kScenarioTimeoutSeconds.
+ *
+ * usage: room_scenarios
+ */
+
+#include "server.hpp"
+#include "transport.hpp"
+#include "admin.hpp"
+#include "bench_client.hpp"
+#include "protocol.hpp"
+#include "rate_limiter.hpp"
+#include "server_settings.hpp"
+#include "log.hpp"
+
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+
+
+static constexpr int kFloodMoves = 20000;
+static constexpr float kStep = 0.00001f;
+static constexpr unsigned int kScenarioTimeoutSeconds = 30;
+
+// move lines are over 32 bytes, so a flood is more than twice what a
+// stalled reader's pipe holds
+static_assert(kFloodMoves * 32 > 2 * MemoryTransport::kPipeBytes,
+			  "the flood must overflow a stalled reader's pipe");
+
+static const char* current_scenario = "";
+
+static void OnWatchdog(int)
+{
+	const char prefix[] = "FAIL: timed out in ";
+	write(STDOUT_FILENO, prefix, sizeof(prefix) - 1);
+	write(STDOUT_FILENO, current_scenario, strlen(current_scenario));
+	write(STDOUT_FILENO, "\n", 1);
+	// _exit() skips the atexit() that removes the admin socket
+	Admin::StopServer();
+	_exit(1);
+}
+
+struct Room
+{
+	MemoryListener listener;
+	int players = 0;
+	pthread_t thread;
+	std::vector<BenchClient::MemoryClient> clients;
+};
+
+static void* RoomThread(void* roomPtr)
+{
+	Room* room = (Room*)roomPtr;
+	ServeRoom(room->listener, "memory", room->players);
+	return nullptr;
+}
+
+// Starts a room of `players` and takes them all through START.
+static bool OpenRoom(Room& room, int players)
+{
+	room.players = players;
+	room.clients.resize(players);
+	pthread_create(&room.thread, nullptr, RoomThread, &room);
+	for (BenchClient::MemoryClient& client : room.clients)
+	{
+		client.transport = room.listener.Connect();
+	}
+	return BenchClient::StartGame(room.clients);
+}
+
+static void CloseRoom(Room& room)
+{
+	StopRoom();
+	pthread_join(room.thread, nullptr);
+}
+
+struct MoveLine
+{
+	PlayerId player_id;
+	float x;
+	float y;
+};
+
+static bool ParseMove(const std::string& line, MoveLine& move)
+{
+	return sscanf(line.c_str(), "SRV_RES_MOVE %u %f %f", &move.player_id, &move.x, &move.y) == 3;
+}
+
+// Reads `client` until a move of `player_id`; false on EOF.
+static bool ReadMoveOf(BenchClient::MemoryClient& client, PlayerId player_id, MoveLine& move)
+{
+	std::string line;
+	while (client.ReadLine(line))
+	{
+		if (ParseMove(line, move) && move.player_id == player_id) return true;
+	}
+	return false;
+}
+
+// What a reader got of one player's moves, up to the end of its stream.
+struct MoveStream
+{
+	int moves = 0;
+	bool ordered = true;
+	MoveLine last = { kInvalidPlayerId, 0.0f, 0.0f };
+};
+
+// Reads `client` to EOF, collecting the moves of `player_id` after `from`.
+static MoveStream ReadToEnd(BenchClient::MemoryClient& client, PlayerId player_id,
+							const MoveLine& from)
+{
+	MoveStream stream;
+	stream.last = from;
+	std::string line;
+	MoveLine move;
+	while (client.ReadLine(line))
+	{
+		if (!ParseMove(line, move) || move.player_id != player_id) continue;
+		if (move.y <= stream.last.y) stream.ordered = false;
+		stream.moves++;
+		stream.last = move;
+	}
+	return stream;
+}
+
+static bool SendMove(BenchClient::MemoryClient& client, float x, float y)
+{
+	char request[Protocol::kMaxMessageLength];
+	Protocol::CreateMoveRequest(request, x, y);
+	return client.Send(request);
+}
+
+// an admin command to this process
+static bool AdminHere(const char* command, std::string* output = nullptr)
+{
+	return BenchClient::AdminCommand(getpid(), command, output);
+}
+
+// "<command> <connection>" for `client`'s connection
+static bool AdminOn(const char* command, BenchClient::MemoryClient& client)
+{
+	char line[64];
+	snprintf(line, sizeof(line), "%s %d\n", command, client.transport->Id());
+	return AdminHere(line);
+}
+
+static bool Check(bool passed, const char* what)
+{
+	printf("%s: %s: %s\n", passed ? "PASS" : "FAIL", current_scenario, what);
+	fflush(stdout);
+	return passed;
+}
+
+static void BeginScenario(const char* name)
+{
+	current_scenario = name;
+	alarm(kScenarioTimeoutSeconds);
+}
+
+// Coalescing, drain, kick and shutdown, in one room of four: the mover, a
+// reader to drain, one to kick and one left stalled for the shutdown.
+static bool StalledReaders()
+{
+	enum { mover, drained, kicked, stalled };
+	bool ok = true;
+	Room room;
+	BeginScenario("coalesce");
+	if (!Check(OpenRoom(room, 4), "the room started")) return false;
+	BenchClient::MemoryClient& moving = room.clients[mover];
+	const PlayerId mover_id = moving.player_id;
+
+	// a move nobody is behind on yet gives every reader the same start
+	MoveLine start[4];
+	bool started = SendMove(moving, 0.0f, 0.0f);
+	for (int i = 0; i < 4; i++) started = started && ReadMoveOf(room.clients[i], mover_id, start[i]);
+	if (!Check(started, "every reader saw the first move")) return false;
+
+	// the flood goes up in y; the closing move is the only one to step x
+	bool sent = true;
+	for (int i = 0; i < kFloodMoves && sent; i++) sent = SendMove(moving, 0.0f, kStep);
+	sent = sent && SendMove(moving, kStep, kStep);
+	MoveLine closing;
+	bool closed = false;
+	while (sent && !closed && ReadMoveOf(moving, mover_id, closing)) closed = closing.x != start[mover].x;
+	if (!Check(closed, "the mover read its closing move")) return false;
+
+	// every stalled reader now has the closing move in its pipe or queue
+	BeginScenario("drain");
+	ok = Check(AdminOn("drain", room.clients[drained]), "the drain was accepted") && ok;
+	BeginScenario("kick");
+	ok = Check(AdminOn("kick", room.clients[kicked]), "the kick was accepted") && ok;
+	// nothing the mover does from here may reach either of them
+	bool later = SendMove(moving, kStep, kStep);
+	MoveLine after;
+	later = later && ReadMoveOf(moving, mover_id, after) && after.x != closing.x;
+	ok = Check(later, "the room still takes moves") && ok;
+
+	BeginScenario("coalesce");
+	MoveStream drain = ReadToEnd(room.clients[drained], mover_id, start[drained]);
+	ok = Check(drain.ordered, "a stalled reader read the moves in order") && ok;
+	ok = Check(drain.moves > 0 && drain.moves < kFloodMoves + 1,
+			   "a stalled reader read fewer moves than were made") && ok;
+	BeginScenario("drain");
+	ok = Check(drain.last.x == closing.x && drain.last.y == closing.y,
+			   "the drained reader read the last queued move, then the connection closed") && ok;
+
+	BeginScenario("kick");
+	MoveStream kick = ReadToEnd(room.clients[kicked], mover_id, start[kicked]);
+	ok = Check(kick.ordered && kick.last.x != after.x,
+			   "the kicked connection closed without later moves") && ok;
+
+	// the stalled reader's pipe is full, so its respond thread is blocked
+	// in a write when the room stops
+	BeginScenario("shutdown");
+	CloseRoom(room);
+	ok = Check(true, "StopRoom() returned with a reader stalled") && ok;
+	MoveStream stall = ReadToEnd(room.clients[stalled], mover_id, start[stalled]);
+	MoveStream rest = ReadToEnd(moving, mover_id, after);
+	ok = Check(stall.ordered && rest.moves == 0, "every connection closed") && ok;
+	return ok;
+}
+
+static unsigned long SlowClientDisconnects()
+{
+	std::string metrics;
+	unsigned long count = 0;
+	if (!AdminHere("metrics\n", &metrics)) return 0;
+	const char* line = strstr(metrics.c_str(), "\nsng_slow_client_disconnects_total ");
+	if (line) sscanf(line, "\nsng_slow_client_disconnects_total %lu", &count);
+	return count;
+}
+
+// Reads everything a client gets, counting its own moves.
+struct Drainer
+{
+	BenchClient::MemoryClient* client;
+	pthread_t thread;
+	pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+	pthread_cond_t moved = PTHREAD_COND_INITIALIZER;
+	int own_moves = 0;
+};
+
+static void* DrainThread(void* drainerPtr)
+{
+	Drainer* drainer = (Drainer*)drainerPtr;
+	std::string line;
+	MoveLine move;
+	while (drainer->client->ReadLine(line))
+	{
+		if (!ParseMove(line, move) || move.player_id != drainer->client->player_id) continue;
+		pthread_mutex_lock(&drainer->mutex);
+		drainer->own_moves++;
+		pthread_cond_broadcast(&drainer->moved);
+		pthread_mutex_unlock(&drainer->mutex);
+	}
+	return nullptr;
+}
+
+// A room of two, where the firing player reads everything and the other
+// nothing; projectile frames fill the stalled reader's pipe and queue.
+static bool SlowConsumer()
+{
+	enum { firing, slow };
+	bool ok = true;
+	Room room;
+	BeginScenario("slow");
+	if (!Check(OpenRoom(room, 2), "the room started")) return false;
+	const unsigned long before = SlowClientDisconnects();
+
+	// the firing player's own frames must not make it slow too
+	Drainer drainer;
+	drainer.client = &room.clients[firing];
+	pthread_create(&drainer.thread, nullptr, DrainThread, &drainer);
+
+	// keep the arena full of projectiles until the grace period is over
+	char request[Protocol::kMaxMessageLength];
+	unsigned long disconnects = before;
+	for (int i = 0; disconnects == before; i++)
+	{
+		for (int shot = 0; shot < 64; shot++)
+		{
+			float angle = (i * 64 + shot) * 0.1f;
+			Protocol::CreateFireRequest(request, cosf(angle), sinf(angle));
+			room.clients[firing].Send(request);
+		}
+		usleep(50000);
+		disconnects = SlowClientDisconnects();
+	}
+	ok = Check(disconnects == before + 1, "exactly one slow consumer was disconnected") && ok;
+
+	std::string line;
+	while (room.clients[slow].ReadLine(line)) {}
+	ok = Check(true, "the slow reader's connection closed") && ok;
+
+	bool served = SendMove(room.clients[firing], kStep, kStep);
+	pthread_mutex_lock(&drainer.mutex);
+	while (served && drainer.own_moves == 0) pthread_cond_wait(&drainer.moved, &drainer.mutex);
+	pthread_mutex_unlock(&drainer.mutex);
+	ok = Check(served, "the other player can still move") && ok;
+
+	CloseRoom(room);
+	pthread_join(drainer.thread, nullptr);
+	return ok;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc != 1)
+	{
+		fprintf(stderr, "usage: %s\n", argv[0]);
+		return 1;
+	}
+
+	// the rooms log every join and every slow consumer
+	Log::SetLevel(Log::Level::error);
+	// the scenarios flood on purpose
+	rate_limits.SetClientLimit({ 0, 0 });
+	rate_limits.SetRequestLimit(Protocol::ClientRequest::move, { 0, 0 });
+	rate_limits.SetRequestLimit(Protocol::ClientRequest::fire, { 0, 0 });
+	// the admin socket of this process drains and kicks
+	StartDiagnostics();
+	signal(SIGALRM, OnWatchdog);
+
+	bool ok = StalledReaders();
+	ok = SlowConsumer() && ok;
+	alarm(0);
+
+	char path[108];
+	snprintf(path, sizeof(path), ServerSettings::kMetricsSocketFormat, (int)getpid());
+	unlink(path);
+	printf("%s\n", ok ? "all scenarios passed" : "some scenarios failed");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,273 @@
+/*
+ * Churn soak test
+ *
+ * Starts `server` as a child process and keeps players joining and leaving
+ * it for as long as asked: each cycle fills a room, plays moves, then has
+ * the players leave one at a time while the rest keep moving, so the server
+ * frees clients in the middle of a room and recycles the room once it is
+ * empty. Every interval it samples the server's RSS, open fds and thread
+ * count (from /proc, at a point where the room is full) and the move
+ * latency of that interval.
+ *
+ * At the end it compares the first and last quarter of the samples and
+ * fails if fds or threads grew at all, RSS grew by more than kRssSlack, or
+ * the p99 latency drifted by more than kLatencyDrift, so a server that
+ * leaks per connection or per room fails a long enough run.
+ *
+ * usage: soak [-s server_binary] [-c players] [-d seconds] [-i sample_seconds]
+ *             [-m moves_per_cycle]
+ */
+
+#include "bench_client.hpp"
+#include "hdr_histogram.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <dirent.h>
+#include <unistd.h>
+
+
+// RSS may grow by this fraction, and at least kRssSlackKb, before it counts
+// as a leak; the allocator keeps some of what a room frees
+static constexpr double kRssSlack = 0.25;
+static constexpr long kRssSlackKb = 8 * 1024;
+// the late p99 may be this many times the early one, and at least
+// kLatencyDriftNs more, before it counts as drift
+static constexpr double kLatencyDrift = 3.0;
+static constexpr int64_t kLatencyDriftNs = 1000000;
+
+struct ProcessSample
+{
+	double elapsed_s;
+	unsigned long cycles;
+	long rss_kb;
+	int fds;
+	int threads;
+	int64_t p50_ns;
+	int64_t p99_ns;
+};
+
+// Reads RSS and thread count from /proc/<pid>/status and counts open fds.
+static bool SampleProcess(pid_t pid, ProcessSample& sample)
+{
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+	FILE* status = fopen(path, "r");
+	if (!status) return false;
+	sample.rss_kb = -1;
+	sample.threads = -1;
+	char line[256];
+	while (fgets(line, sizeof(line), status))
+	{
+		sscanf(line, "VmRSS: %ld", &sample.rss_kb);
+		sscanf(line, "Threads: %d", &sample.threads);
+	}
+	fclose(status);
+
+	snprintf(path, sizeof(path), "/proc/%d/fd", (int)pid);
+	DIR* fds = opendir(path);
+	if (!fds) return false;
+	sample.fds = 0;
+	while (struct dirent* entry = readdir(fds))
+	{
+		if (entry->d_name[0] != '.') sample.fds++;
+	}
+	closedir(fds);
+	return sample.rss_kb >= 0 && sample.threads >= 0;
+}
+
+template <typename Value>
+static Value Median(std::vector<Value> values)
+{
+	std::sort(values.begin(), values.end());
+	return values[values.size() / 2];
+}
+
+// Compares the first and last quarter of `samples`; returns false if
+// anything grew past its slack.
+static bool Judge(const std::vector<ProcessSample>& samples)
+{
+	const size_t quarter = samples.size() / 4;
+	if (quarter < 1)
+	{
+		printf("too few samples to judge growth, run longer or sample more often\n");
+		return true;
+	}
+
+	std::vector<long> early_rss, late_rss;
+	std::vector<int> early_fds, late_fds, early_threads, late_threads;
+	std::vector<int64_t> early_p99, late_p99;
+	for (size_t i = 0; i < quarter; i++)
+	{
+		const ProcessSample& early = samples[i];
+		const ProcessSample& late = samples[samples.size() - quarter + i];
+		early_rss.push_back(early.rss_kb);
+		late_rss.push_back(late.rss_kb);
+		early_fds.push_back(early.fds);
+		late_fds.push_back(late.fds);
+		early_threads.push_back(early.threads);
+		late_threads.push_back(late.threads);
+		early_p99.push_back(early.p99_ns);
+		late_p99.push_back(late.p99_ns);
+	}
+
+	// growth must hold for the whole last quarter, not just one sample
+	bool ok = true;
+	const int fds_before = *std::max_element(early_fds.begin(), early_fds.end());
+	const int fds_after = *std::min_element(late_fds.begin(), late_fds.end());
+	if (fds_after > fds_before)
+	{
+		printf("FAIL: open fds grew from %d to %d\n", fds_before, fds_after);
+		ok = false;
+	}
+	const int threads_before = *std::max_element(early_threads.begin(), early_threads.end());
+	const int threads_after = *std::min_element(late_threads.begin(), late_threads.end());
+	if (threads_after > threads_before)
+	{
+		printf("FAIL: threads grew from %d to %d\n", threads_before, threads_after);
+		ok = false;
+	}
+	const long rss_before = *std::max_element(early_rss.begin(), early_rss.end());
+	const long rss_after = *std::min_element(late_rss.begin(), late_rss.end());
+	if (rss_after > rss_before + std::max((long)(rss_before * kRssSlack), kRssSlackKb))
+	{
+		printf("FAIL: RSS grew from %ld KB to %ld KB\n", rss_before, rss_after);
+		ok = false;
+	}
+	const int64_t p99_before = Median(early_p99);
+	const int64_t p99_after = Median(late_p99);
+	if (p99_after > p99_before * kLatencyDrift && p99_after > p99_before + kLatencyDriftNs)
+	{
+		printf("FAIL: p99 move latency drifted from %.1f us to %.1f us\n",
+			   p99_before / 1e3, p99_after / 1e3);
+		ok = false;
+	}
+	if (ok) printf("PASS: no growth in fds, threads, RSS or latency\n");
+	return ok;
+}
+
+int main(int argc, char** argv)
+{
+	const char* server = "./server";
+	unsigned int player_count = 8;
+	int duration_s = 3600;
+	int interval_s = 60;
+	int moves_per_cycle = 50;
+	int opt;
+	while ((opt = getopt(argc, argv, "s:c:d:i:m:")) != -1)
+	{
+		switch (opt)
+		{
+		case 's': server = optarg; break;
+		case 'c': player_count = atoi(optarg); break;
+		case 'd': duration_s = atoi(optarg); break;
+		case 'i': interval_s = atoi(optarg); break;
+		case 'm': moves_per_cycle = atoi(optarg); break;
+		default:
+			fprintf(stderr, "usage: %s [-s server_binary] [-c players] [-d seconds] "
+					"[-i sample_seconds] [-m moves_per_cycle]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (player_count < 2 || player_count > (unsigned int)GameSettings::kMaxPlayers ||
+		interval_s < 1 || moves_per_cycle < 1)
+	{
+		fprintf(stderr, "need 2 to %d players, and a positive interval and move count\n",
+				GameSettings::kMaxPlayers);
+		return 1;
+	}
+
+	const int port = BenchClient::FreeLoopbackPort();
+	const pid_t pid = BenchClient::StartServer(server, port, player_count);
+
+	// lift the input rate limits, once the admin socket is up
+	bool lifted = false;
+	for (int attempt = 0; attempt < 200 && !lifted; attempt++)
+	{
+		lifted = BenchClient::AdminCommand(pid, "rate-limit client 0 0\n") &&
+			BenchClient::AdminCommand(pid, "rate-limit move 0 0\n");
+		if (!lifted) usleep(10000);
+	}
+	if (!lifted)
+	{
+		fprintf(stderr, "server did not come up\n");
+		BenchClient::StopServer(pid);
+		return 1;
+	}
+
+	printf("%u players per room, %d s, sampled every %d s\n", player_count, duration_s,
+		   interval_s);
+	printf("  elapsed   cycles     rss_kb   fds  threads   p50_us    p99_us\n");
+	fflush(stdout);
+
+	std::vector<ProcessSample> samples;
+	HdrHistogram window;
+	const int64_t start_ns = BenchClient::NowNs();
+	const int64_t end_ns = start_ns + (int64_t)duration_s * 1000000000;
+	int64_t next_sample_ns = start_ns + (int64_t)interval_s * 1000000000;
+	unsigned long cycles = 0;
+	unsigned long lost = 0;
+	bool ok = true;
+	std::vector<BenchClient::Connection> players(player_count);
+
+	while (BenchClient::NowNs() < end_ns)
+	{
+		if (!BenchClient::JoinGame(players, port))
+		{
+			printf("FAIL: room %lu did not start (server stopped taking players)\n", cycles);
+			ok = false;
+			break;
+		}
+
+		// the room is full here, so every sample sees the same connections
+		if (BenchClient::NowNs() >= next_sample_ns)
+		{
+			ProcessSample sample;
+			if (!SampleProcess(pid, sample))
+			{
+				printf("FAIL: server exited\n");
+				ok = false;
+				break;
+			}
+			sample.elapsed_s = (BenchClient::NowNs() - start_ns) / 1e9;
+			sample.cycles = cycles;
+			sample.p50_ns = window.ValueAtPercentile(50);
+			sample.p99_ns = window.ValueAtPercentile(99);
+			window.Reset();
+			samples.push_back(sample);
+			printf("%9.0f  %7lu  %9ld  %4d  %7d  %7.1f  %8.1f\n", sample.elapsed_s,
+				   sample.cycles, sample.rss_kb, sample.fds, sample.threads,
+				   sample.p50_ns / 1e3, sample.p99_ns / 1e3);
+			fflush(stdout);
+			next_sample_ns += (int64_t)interval_s * 1000000000;
+		}
+
+		// play, then leave one at a time while the rest keep moving
+		size_t active = player_count;
+		for (int i = 0; active > 0; i++)
+		{
+			if (i >= moves_per_cycle && i % 4 == 0) players[--active].Close();
+			if (active == 0) break;
+
+			// alternate directions so the movers stay inside the arena
+			float step = ((i / player_count) & 1) ? -0.001f : 0.001f;
+			int64_t sample_ns = BenchClient::Sample(players, active, i % active, step);
+			if (sample_ns < 0) lost++;
+			else window.Record(sample_ns);
+		}
+		for (BenchClient::Connection& player : players) player.Close();
+		cycles++;
+	}
+
+	BenchClient::StopServer(pid);
+	printf("%lu rooms, %lu moves lost\n", cycles, lost);
+	if (lost > 0)
+	{
+		printf("FAIL: moves were lost\n");
+		ok = false;
+	}
+	if (ok) ok = Judge(samples);
+	return ok ? 0 : 1;
+}
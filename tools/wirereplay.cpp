@@ -0,0 +1,308 @@
+/*
+ * Captured session replayer
+ *
+ * Replays a wire capture (a server run with SNG_CAPTURE=1 writes one per
+ * process, see wire_capture.hpp) against a server: every captured session
+ * gets its own TCP connection, opened, fed its bytes and closed on the
+ * captured timeline, so the server sees the real protocol mix, odd message
+ * sequences included. Responses are read and discarded.
+ *
+ * -x scales the timeline: 1 replays in real time, 10 ten times faster, and
+ * 0 (or "max") sends as fast as the server takes it. Lag is how late each
+ * send was against its scaled schedule; a lagging replay is not reaching
+ * the requested speed.
+ *
+ * Rooms start when they are full, so replay against a server with the room
+ * size of the captured one.
+ *
+ * usage: wirereplay [-x speed|max] <capture> <host> <port>
+ */
+
+#include "hdr_histogram.hpp"
+#include "wire_capture.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <unordered_map>
+#include <vector>
+#include <netdb.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+
+static int64_t NowNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+struct Event
+{
+	WireCaptureRecord record;
+	// offset of the record's bytes in the capture
+	size_t data_offset;
+};
+
+// a session the server closed keeps fd -1; the rest of it is dropped
+struct Session
+{
+	int fd = -1;
+};
+
+struct Stats
+{
+	uint64_t sessions = 0;
+	uint64_t messages = 0;
+	uint64_t bytes_sent = 0;
+	uint64_t bytes_received = 0;
+	uint64_t closed_by_server = 0;
+	uint64_t dropped_bytes = 0;
+	uint64_t connect_failures = 0;
+	HdrHistogram lag;
+};
+
+// Reads the capture into `data` and indexes its records; a partial last
+// record (the server crashed) is dropped.
+static bool LoadCapture(const char* path, std::vector<char>& data, std::vector<Event>& events)
+{
+	FILE* file = fopen(path, "rb");
+	if (file == nullptr)
+	{
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return false;
+	}
+	char chunk[64 * 1024];
+	size_t n;
+	while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) data.insert(data.end(), chunk, chunk + n);
+	fclose(file);
+
+	WireCaptureHeader header;
+	if (data.size() < sizeof(header))
+	{
+		fprintf(stderr, "%s: too short for a capture header\n", path);
+		return false;
+	}
+	memcpy(&header, data.data(), sizeof(header));
+	if (memcmp(header.magic, kWireCaptureMagic, sizeof(header.magic)) != 0 ||
+		header.version != kWireCaptureVersion)
+	{
+		fprintf(stderr, "%s: not a capture of a supported version\n", path);
+		return false;
+	}
+
+	size_t offset = sizeof(header);
+	while (offset + sizeof(WireCaptureRecord) <= data.size())
+	{
+		Event event;
+		memcpy(&event.record, data.data() + offset, sizeof(event.record));
+		event.data_offset = offset + sizeof(event.record);
+		if (event.data_offset + event.record.length > data.size()) break;
+		events.push_back(event);
+		offset = event.data_offset + event.record.length;
+	}
+	return true;
+}
+
+static int Connect(const char* host, const char* port)
+{
+	struct addrinfo hints, *list;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
+	if (getaddrinfo(host, port, &hints, &list) != 0) return -1;
+
+	int fd = -1;
+	for (struct addrinfo* p = list; p; p = p->ai_next)
+	{
+		fd = socket(p->ai_family, p->ai_socktype | SOCK_CLOEXEC, p->ai_protocol);
+		if (fd < 0) continue;
+		if (connect(fd, p->ai_addr, p->ai_addrlen) == 0) break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(list);
+	if (fd < 0) return -1;
+
+	// each captured read goes out as it was scheduled
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return fd;
+}
+
+static void CloseSession(int epfd, Session& session)
+{
+	if (session.fd < 0) return;
+	epoll_ctl(epfd, EPOLL_CTL_DEL, session.fd, nullptr);
+	close(session.fd);
+	session.fd = -1;
+}
+
+// Reads and discards whatever the server sent, for up to `timeout_ms`.
+static void Drain(int epfd, std::unordered_map<uint32_t, Session>& sessions, int timeout_ms,
+				  Stats& stats)
+{
+	struct epoll_event ready[64];
+	int n = epoll_wait(epfd, ready, 64, timeout_ms);
+	for (int i = 0; i < n; i++)
+	{
+		Session& session = sessions[ready[i].data.u32];
+		if (session.fd < 0) continue;
+
+		char buf[64 * 1024];
+		ssize_t got;
+		while ((got = recv(session.fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+		{
+			stats.bytes_received += got;
+		}
+		if (got == 0 || (got < 0 && errno != EAGAIN && errno != EINTR))
+		{
+			stats.closed_by_server++;
+			CloseSession(epfd, session);
+		}
+	}
+}
+
+// Waits until `due_ns`, reading responses meanwhile.
+static void WaitUntil(int64_t due_ns, int epfd, std::unordered_map<uint32_t, Session>& sessions,
+					  Stats& stats)
+{
+	while (true)
+	{
+		int64_t remaining_ns = due_ns - NowNs();
+		if (remaining_ns <= 0) return;
+		// epoll_wait only has millisecond timeouts, and may oversleep by
+		// about as much; the last stretch is an exact sleep
+		if (remaining_ns < 2000000)
+		{
+			struct timespec due = { (time_t)(due_ns / 1000000000), (long)(due_ns % 1000000000) };
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, nullptr);
+			return;
+		}
+		Drain(epfd, sessions, (int)(remaining_ns / 1000000) - 1, stats);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	double speed = 1.0;
+	int opt;
+	while ((opt = getopt(argc, argv, "x:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'x': speed = strcmp(optarg, "max") == 0 ? 0.0 : atof(optarg); break;
+		default:
+			fprintf(stderr, "usage: %s [-x speed|max] <capture> <host> <port>\n", argv[0]);
+			return 1;
+		}
+	}
+	if (argc - optind != 3 || speed < 0)
+	{
+		fprintf(stderr, "usage: %s [-x speed|max] <capture> <host> <port>\n", argv[0]);
+		return 1;
+	}
+	const char* path = argv[optind];
+	const char* host = argv[optind + 1];
+	const char* port = argv[optind + 2];
+
+	std::vector<char> data;
+	std::vector<Event> events;
+	if (!LoadCapture(path, data, events)) return 1;
+	// the timeline starts with the first session, not with the server
+	const int64_t first_ns = events.empty() ? 0 : events.front().record.time_ns;
+	const int64_t capture_ns = events.empty() ? 0 : events.back().record.time_ns - first_ns;
+	char pace[32];
+	if (speed > 0) snprintf(pace, sizeof(pace), "%gx", speed);
+	else snprintf(pace, sizeof(pace), "max speed");
+	printf("%s: %zu records over %.1f s, replaying at %s\n", path, events.size(),
+		   capture_ns / 1e9, pace);
+	fflush(stdout);
+
+	int epfd = epoll_create1(EPOLL_CLOEXEC);
+	std::unordered_map<uint32_t, Session> sessions;
+	Stats stats;
+
+	const int64_t start_ns = NowNs();
+	for (const Event& event : events)
+	{
+		const WireCaptureRecord& record = event.record;
+		if (speed > 0)
+		{
+			int64_t due_ns = start_ns + (int64_t)((record.time_ns - first_ns) / speed);
+			WaitUntil(due_ns, epfd, sessions, stats);
+			if (record.type == WireCaptureRecordType::data) stats.lag.Record(NowNs() - due_ns);
+		}
+		else
+		{
+			Drain(epfd, sessions, 0, stats);
+		}
+
+		Session& session = sessions[record.session];
+		switch (record.type)
+		{
+		case WireCaptureRecordType::open:
+		{
+			session.fd = Connect(host, port);
+			if (session.fd < 0)
+			{
+				stats.connect_failures++;
+				break;
+			}
+			struct epoll_event ev;
+			ev.events = EPOLLIN;
+			ev.data.u32 = record.session;
+			epoll_ctl(epfd, EPOLL_CTL_ADD, session.fd, &ev);
+			stats.sessions++;
+			break;
+		}
+		case WireCaptureRecordType::data:
+			if (session.fd < 0)
+			{
+				stats.dropped_bytes += record.length;
+				break;
+			}
+			if (send(session.fd, data.data() + event.data_offset, record.length, MSG_NOSIGNAL) < 0)
+			{
+				stats.dropped_bytes += record.length;
+				stats.closed_by_server++;
+				CloseSession(epfd, session);
+				break;
+			}
+			stats.messages++;
+			stats.bytes_sent += record.length;
+			break;
+		case WireCaptureRecordType::close:
+			CloseSession(epfd, session);
+			break;
+		}
+	}
+	const int64_t elapsed_ns = NowNs() - start_ns;
+	// sessions the capture ended in the middle of
+	for (auto& entry : sessions) CloseSession(epfd, entry.second);
+	close(epfd);
+
+	const double seconds = elapsed_ns / 1e9;
+	printf("sessions %llu (%llu connect failures, %llu closed by the server)\n",
+		   (unsigned long long)stats.sessions, (unsigned long long)stats.connect_failures,
+		   (unsigned long long)stats.closed_by_server);
+	printf("sent %llu reads, %llu bytes in %.3f s: %.0f reads/s, %.1fx the captured pace\n",
+		   (unsigned long long)stats.messages, (unsigned long long)stats.bytes_sent, seconds,
+		   seconds > 0 ? stats.messages / seconds : 0.0,
+		   seconds > 0 ? capture_ns / 1e9 / seconds : 0.0);
+	printf("received %llu bytes, dropped %llu bytes of closed sessions\n",
+		   (unsigned long long)stats.bytes_received, (unsigned long long)stats.dropped_bytes);
+	if (speed > 0 && stats.lag.Count() > 0)
+	{
+		printf("send lag, microseconds: p50 %.1f  p99 %.1f  max %.1f\n",
+			   stats.lag.ValueAtPercentile(50) / 1e3, stats.lag.ValueAtPercentile(99) / 1e3,
+			   stats.lag.Max() / 1e3);
+	}
+	return stats.connect_failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,263 @@
+#include "trace.hpp"
+#include "memory_accounting.hpp"
+
+#include <atomic>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+namespace Trace
+{
+	constexpr unsigned int kRingEvents = 1 << 14; // per thread
+	constexpr long kFlushIntervalMs = 100;
+
+	struct Event
+	{
+		const char* name;
+		uint64_t start_ns;
+		uint64_t duration_ns;
+		uint64_t flow_id;
+		char phase;
+	};
+
+	// Single-producer (the owning thread), single-consumer (the flusher).
+	struct ThreadBuffer
+	{
+		Event events[kRingEvents];
+		std::atomic<uint64_t> head{0};
+		std::atomic<uint64_t> tail{0};
+		std::atomic<uint64_t> dropped{0};
+		uint64_t reported_dropped = 0; // flusher only
+
+		int tid = 0;
+		char name[64] = "";
+		std::atomic<bool> name_changed{false};
+		std::atomic<bool> retired{false};
+	};
+
+	static std::atomic<bool> running(false);
+	static std::atomic<uint64_t> next_flow_id(1);
+	static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+	static std::vector<ThreadBuffer*> registry;
+
+	static uint64_t NowNs()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	}
+
+	// registers on first use; the flusher frees the buffer after the thread
+	// exits and its last events are written
+	struct ThreadSlot
+	{
+		ThreadBuffer* buffer = nullptr;
+
+		ThreadBuffer* Get()
+		{
+			if (buffer == nullptr && running.load(std::memory_order_relaxed))
+			{
+				Memory::Scope scope(Memory::Tag::diagnostics);
+				buffer = new ThreadBuffer; // the event ring is written before it is read
+				buffer->tid = (int)syscall(SYS_gettid);
+				pthread_mutex_lock(&registry_mutex);
+				registry.push_back(buffer);
+				pthread_mutex_unlock(&registry_mutex);
+			}
+			return buffer;
+		}
+
+		~ThreadSlot()
+		{
+			if (buffer) buffer->retired.store(true, std::memory_order_release);
+		}
+	};
+	static thread_local ThreadSlot thread_slot;
+
+	static void Push(const Event& event)
+	{
+		ThreadBuffer* buffer = thread_slot.Get();
+		if (buffer == nullptr) return;
+
+		uint64_t head = buffer->head.load(std::memory_order_relaxed);
+		if (head - buffer->tail.load(std::memory_order_acquire) >= kRingEvents)
+		{
+			buffer->dropped.store(buffer->dropped.load(std::memory_order_relaxed) + 1,
+								  std::memory_order_relaxed);
+			return;
+		}
+		buffer->events[head % kRingEvents] = event;
+		buffer->head.store(head + 1, std::memory_order_release);
+	}
+
+	void Complete(const char* name, uint64_t start_ns, uint64_t end_ns, uint64_t flow_id)
+	{
+		Push(Event{ name, start_ns, end_ns - start_ns, flow_id, 'X' });
+	}
+
+	void Flow(char phase, const char* name, uint64_t flow_id)
+	{
+		Push(Event{ name, NowNs(), 0, flow_id, phase });
+	}
+
+	uint64_t NewFlowId()
+	{
+		return next_flow_id.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void SetThreadName(const char* format, ...)
+	{
+		ThreadBuffer* buffer = thread_slot.Get();
+		if (buffer == nullptr) return;
+
+		// published to the flusher by name_changed
+		va_list args;
+		va_start(args, format);
+		vsnprintf(buffer->name, sizeof(buffer->name), format, args);
+		va_end(args);
+		buffer->name_changed.store(true, std::memory_order_release);
+	}
+
+	ScopedSpan::ScopedSpan(const char* name, uint64_t flow_id)
+	{
+		mName = name;
+		mFlowId = flow_id;
+		mStartNs = NowNs();
+	}
+
+	ScopedSpan::~ScopedSpan()
+	{
+		Complete(mName, mStartNs, NowNs(), mFlowId);
+	}
+
+
+	struct Writer
+	{
+		FILE* file;
+		int pid;
+		bool first = true;
+
+		// Chrome accepts a JSON array without the closing bracket, so the
+		// file stays loadable however the process ends
+		void Separator()
+		{
+			fputs(first ? "[\n" : ",\n", file);
+			first = false;
+		}
+
+		void Write(const ThreadBuffer& buffer, const Event& event)
+		{
+			Separator();
+			double ts_us = event.start_ns / 1000.0;
+			if (event.phase == 'X')
+			{
+				fprintf(file, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+						"\"ts\":%.3f,\"dur\":%.3f", event.name, pid, buffer.tid,
+						ts_us, event.duration_ns / 1000.0);
+				if (event.flow_id)
+				{
+					fprintf(file, ",\"args\":{\"flow\":%lu}", (unsigned long)event.flow_id);
+				}
+				fputs("}", file);
+			}
+			else
+			{
+				// bind to the enclosing span rather than the next one
+				fprintf(file, "{\"name\":\"%s\",\"cat\":\"request\",\"ph\":\"%c\","
+						"\"bp\":\"e\",\"id\":%lu,\"pid\":%d,\"tid\":%d,\"ts\":%.3f}",
+						event.name, event.phase, (unsigned long)event.flow_id,
+						pid, buffer.tid, ts_us);
+			}
+		}
+
+		void WriteMetadata(ThreadBuffer& buffer)
+		{
+			if (buffer.name_changed.exchange(false, std::memory_order_acquire))
+			{
+				Separator();
+				fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+						"\"args\":{\"name\":\"%s\"}}", pid, buffer.tid, buffer.name);
+			}
+
+			uint64_t dropped = buffer.dropped.load(std::memory_order_relaxed);
+			if (dropped != buffer.reported_dropped)
+			{
+				buffer.reported_dropped = dropped;
+				Separator();
+				fprintf(file, "{\"name\":\"trace_dropped_events\",\"ph\":\"C\",\"pid\":%d,"
+						"\"tid\":%d,\"ts\":%.3f,\"args\":{\"dropped\":%lu}}",
+						pid, buffer.tid, NowNs() / 1000.0, (unsigned long)dropped);
+			}
+		}
+
+		void Drain(ThreadBuffer& buffer)
+		{
+			WriteMetadata(buffer);
+			uint64_t tail = buffer.tail.load(std::memory_order_relaxed);
+			uint64_t head = buffer.head.load(std::memory_order_acquire);
+			for (; tail != head; tail++)
+			{
+				Write(buffer, buffer.events[tail % kRingEvents]);
+			}
+			buffer.tail.store(tail, std::memory_order_release);
+		}
+	};
+
+	static void* FlushThread(void* writerPtr)
+	{
+		Writer* writer = (Writer*)writerPtr;
+		struct timespec interval = { 0, kFlushIntervalMs * 1000000 };
+
+		while (true)
+		{
+			nanosleep(&interval, nullptr);
+
+			pthread_mutex_lock(&registry_mutex);
+			for (size_t i = 0; i < registry.size();)
+			{
+				ThreadBuffer* buffer = registry[i];
+				// check before draining, so no event can slip in after
+				bool retired = buffer->retired.load(std::memory_order_acquire);
+				writer->Drain(*buffer);
+				if (retired)
+				{
+					registry[i] = registry.back();
+					registry.pop_back();
+					delete buffer;
+				}
+				else
+				{
+					i++;
+				}
+			}
+			pthread_mutex_unlock(&registry_mutex);
+			fflush(writer->file);
+		}
+		return nullptr;
+	}
+
+	bool Start(const char* path)
+	{
+		if (running.load()) return false;
+
+		FILE* file = fopen(path, "w");
+		if (file == nullptr) return false;
+
+		Writer* writer = new Writer{ file, (int)getpid() };
+		pthread_t tid;
+		if (pthread_create(&tid, nullptr, FlushThread, writer) != 0)
+		{
+			fclose(file);
+			delete writer;
+			return false;
+		}
+		pthread_detach(tid);
+		running.store(true);
+		return true;
+	}
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+
+// Timeline tracing in Chrome trace-event format (chrome://tracing, Perfetto).
+//
+// Compiled in only with -DSNG_TRACE (make TRACE=1); otherwise every TRACE_*
+// macro expands to nothing. Each thread records into its own lock-free ring,
+// and a background thread drains the rings into a JSON file, so recording
+// is a few stores and never blocks. A full ring drops events (counted in the
+// trace's metadata) instead of stalling the traced thread.
+//
+// Span and flow names must be string literals: only the pointer is stored.
+namespace Trace
+{
+	// starts the flush thread; events recorded before this are discarded
+	bool Start(const char* path);
+
+	// names the calling thread in the timeline (printf-style)
+	void SetThreadName(const char* format, ...) __attribute__((format(printf, 1, 2)));
+
+	// unique id to tie one request's spans together across threads
+	uint64_t NewFlowId();
+
+	void Complete(const char* name, uint64_t start_ns, uint64_t end_ns, uint64_t flow_id);
+	void Flow(char phase, const char* name, uint64_t flow_id);
+
+	class ScopedSpan
+	{
+	public:
+		ScopedSpan(const char* name, uint64_t flow_id = 0);
+		~ScopedSpan();
+
+	private:
+		const char* mName;
+		uint64_t mStartNs;
+		uint64_t mFlowId;
+	};
+}
+
+#ifdef SNG_TRACE
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SPAN(name) Trace::ScopedSpan TRACE_CONCAT(trace_span_, __LINE__)(name)
+#define TRACE_SPAN_FLOW(name, flow_id) \
+	Trace::ScopedSpan TRACE_CONCAT(trace_span_, __LINE__)(name, flow_id)
+// a flow starts inside one span and continues in later spans, eg. on the
+// threads writing the response
+#define TRACE_FLOW_BEGIN(name, flow_id) Trace::Flow('s', name, flow_id)
+#define TRACE_FLOW_STEP(name, flow_id) Trace::Flow('t', name, flow_id)
+#define TRACE_THREAD_NAME(...) Trace::SetThreadName(__VA_ARGS__)
+#define TRACE_NEW_FLOW_ID() Trace::NewFlowId()
+#else
+#define TRACE_SPAN(name) do {} while (0)
+#define TRACE_SPAN_FLOW(name, flow_id) do { (void)(flow_id); } while (0)
+#define TRACE_FLOW_BEGIN(name, flow_id) do { (void)(flow_id); } while (0)
+#define TRACE_FLOW_STEP(name, flow_id) do { (void)(flow_id); } while (0)
+#define TRACE_THREAD_NAME(...) do {} while (0)
+#define TRACE_NEW_FLOW_ID() ((uint64_t)0)
+#endif
@@ -0,0 +1,258 @@
+#include "transport.hpp"
+#include "csapp.h"
+#include "log.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+
+//
+// SOCKETS
+
+SocketTransport::SocketTransport(int fd, bool timestamps, void (*on_wire_latency)(int64_t wire_ns))
+	: mReader(fd), mTxTimestamps(fd)
+{
+	mFd = fd;
+	mTimestamps = timestamps && EnableSocketTimestamps(fd);
+	mOnWireLatency = on_wire_latency;
+	if (timestamps && !mTimestamps)
+	{
+		LOG_WARN("client[%i]: could not enable socket timestamps\n", fd);
+	}
+}
+
+SocketTransport::~SocketTransport()
+{
+	close(mFd);
+}
+
+ssize_t SocketTransport::ReadLine(char* buf, size_t maxlen, int64_t* rx_ns)
+{
+	return mReader.ReadLine(buf, maxlen, rx_ns);
+}
+
+ssize_t SocketTransport::Write(const char* data, size_t length, int64_t request_rx_ns)
+{
+	ssize_t written = rio_writen(mFd, (void*)data, length);
+	if (written > 0 && mTimestamps)
+	{
+		mTxTimestamps.Sent(length, request_rx_ns);
+		mTxTimestamps.Poll(mOnWireLatency);
+	}
+	return written;
+}
+
+void SocketTransport::ShutdownRead()
+{
+	shutdown(mFd, SHUT_RD);
+}
+
+void SocketTransport::Shutdown()
+{
+	shutdown(mFd, SHUT_RDWR);
+}
+
+
+SocketListener::SocketListener(int listenfd, bool timestamps, void (*on_wire_latency)(int64_t wire_ns))
+{
+	mListenFd = listenfd;
+	mTimestamps = timestamps;
+	mOnWireLatency = on_wire_latency;
+}
+
+Transport* SocketListener::Accept(char* peer, size_t peer_length)
+{
+	struct sockaddr_storage clientaddr;
+	socklen_t clientlen = sizeof(clientaddr);
+	int connfd;
+	do
+	{
+		clientlen = sizeof(clientaddr);
+		connfd = accept(mListenFd, (SA*)&clientaddr, &clientlen);
+	} while (connfd < 0 && (errno == EINTR || errno == ECONNABORTED));
+	if (connfd < 0)
+	{
+		LOG_ERROR("Accept error: %s\n", strerror(errno));
+		return nullptr;
+	}
+	// the respond thread writes each response as soon as it is dequeued,
+	// one write per message; Nagle would hold a small write back while an
+	// earlier one waits for the peer's delayed ACK
+	int one = 1;
+	if (setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0)
+	{
+		LOG_WARN("client[%i]: could not disable Nagle: %s\n", connfd, strerror(errno));
+	}
+
+	char hostname[MAXLINE], port[MAXLINE];
+	if (getnameinfo((SA*)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE, 0) == 0)
+	{
+		snprintf(peer, peer_length, "%s, %s", hostname, port);
+	}
+	else
+	{
+		snprintf(peer, peer_length, "unknown");
+	}
+	return new SocketTransport(connfd, mTimestamps, mOnWireLatency);
+}
+
+
+//
+// IN MEMORY
+
+// One direction of an in-memory connection: a bounded ring of bytes.
+struct MemoryPipe
+{
+	pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+	pthread_cond_t changed = PTHREAD_COND_INITIALIZER;
+	char buffer[MemoryTransport::kPipeBytes];
+	size_t head = 0; // total bytes read
+	size_t tail = 0; // total bytes written
+	// the reading end shut down: reads return EOF, writes fail
+	bool read_closed = false;
+	// the writing end shut down: reads return EOF once the pipe is empty
+	bool write_closed = false;
+
+	void Close(bool read, bool write)
+	{
+		pthread_mutex_lock(&mutex);
+		read_closed = read_closed || read;
+		write_closed = write_closed || write;
+		pthread_cond_broadcast(&changed);
+		pthread_mutex_unlock(&mutex);
+	}
+};
+
+MemoryTransport::MemoryTransport(int id, std::shared_ptr<MemoryPipe> in,
+								 std::shared_ptr<MemoryPipe> out)
+	: mId(id), mIn(std::move(in)), mOut(std::move(out))
+{
+}
+
+void MemoryTransport::CreatePair(int id, std::unique_ptr<MemoryTransport>& a,
+								 std::unique_ptr<MemoryTransport>& b)
+{
+	auto a_to_b = std::make_shared<MemoryPipe>();
+	auto b_to_a = std::make_shared<MemoryPipe>();
+	a.reset(new MemoryTransport(id, b_to_a, a_to_b));
+	b.reset(new MemoryTransport(id, a_to_b, b_to_a));
+}
+
+MemoryTransport::~MemoryTransport()
+{
+	Shutdown();
+}
+
+ssize_t MemoryTransport::ReadLine(char* buf, size_t maxlen, int64_t* rx_ns)
+{
+	MemoryPipe& pipe = *mIn;
+	size_t n = 0;
+	*rx_ns = 0;
+
+	pthread_mutex_lock(&pipe.mutex);
+	while (n + 1 < maxlen)
+	{
+		if (pipe.read_closed) break;
+		if (pipe.head == pipe.tail)
+		{
+			if (pipe.write_closed) break;
+			pthread_cond_wait(&pipe.changed, &pipe.mutex);
+			continue;
+		}
+
+		char c = pipe.buffer[pipe.head++ % MemoryTransport::kPipeBytes];
+		buf[n++] = c;
+		if (c == '\n') break;
+	}
+	// a blocked writer may fit now
+	pthread_cond_broadcast(&pipe.changed);
+	pthread_mutex_unlock(&pipe.mutex);
+
+	buf[n] = '\0';
+	return n;
+}
+
+ssize_t MemoryTransport::Write(const char* data, size_t length, int64_t)
+{
+	MemoryPipe& pipe = *mOut;
+	size_t written = 0;
+
+	pthread_mutex_lock(&pipe.mutex);
+	while (written < length)
+	{
+		if (pipe.read_closed || pipe.write_closed)
+		{
+			pthread_mutex_unlock(&pipe.mutex);
+			errno = EPIPE;
+			return -1;
+		}
+		size_t space = MemoryTransport::kPipeBytes - (pipe.tail - pipe.head);
+		if (space == 0)
+		{
+			pthread_cond_wait(&pipe.changed, &pipe.mutex);
+			continue;
+		}
+
+		size_t chunk = std::min(space, length - written);
+		for (size_t i = 0; i < chunk; i++)
+		{
+			pipe.buffer[pipe.tail++ % MemoryTransport::kPipeBytes] = data[written++];
+		}
+		pthread_cond_broadcast(&pipe.changed);
+	}
+	pthread_mutex_unlock(&pipe.mutex);
+	return length;
+}
+
+void MemoryTransport::ShutdownRead()
+{
+	mIn->Close(true, false);
+}
+
+void MemoryTransport::Shutdown()
+{
+	mIn->Close(true, false);
+	mOut->Close(false, true);
+}
+
+
+MemoryListener::MemoryListener()
+{
+	pthread_mutex_init(&mMutex, nullptr);
+	pthread_cond_init(&mConnected, nullptr);
+	mNextId = 1;
+}
+
+MemoryListener::~MemoryListener()
+{
+	pthread_cond_destroy(&mConnected);
+	pthread_mutex_destroy(&mMutex);
+}
+
+std::unique_ptr<MemoryTransport> MemoryListener::Connect()
+{
+	std::unique_ptr<MemoryTransport> server_end, client_end;
+	pthread_mutex_lock(&mMutex);
+	MemoryTransport::CreatePair(mNextId++, server_end, client_end);
+	mPending.push_back(std::move(server_end));
+	pthread_cond_signal(&mConnected);
+	pthread_mutex_unlock(&mMutex);
+	return client_end;
+}
+
+Transport* MemoryListener::Accept(char* peer, size_t peer_length)
+{
+	pthread_mutex_lock(&mMutex);
+	while (mPending.empty()) pthread_cond_wait(&mConnected, &mMutex);
+	MemoryTransport* transport = mPending.front().release();
+	mPending.pop_front();
+	pthread_mutex_unlock(&mMutex);
+
+	snprintf(peer, peer_length, "memory, %d", transport->Id());
+	return transport;
+}
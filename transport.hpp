@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <pthread.h>
+#include <sys/types.h>
+#include "socket_timestamps.hpp"
+
+// One client connection as the server sees it. The server reads it from
+// the client's receive thread and writes it from the respond thread; any
+// thread may shut it down.
+class Transport
+{
+public:
+	virtual ~Transport() {}
+
+	// Reads one line with the contract of rio_readlineb: returns its length
+	// including the newline, 0 on end of stream, -1 on error. `rx_ns` gets
+	// the kernel receive time of the line (CLOCK_REALTIME), or 0.
+	virtual ssize_t ReadLine(char* buf, size_t maxlen, int64_t* rx_ns) = 0;
+
+	// Writes all of `data`; returns `length`, or -1 on error. `request_rx_ns`
+	// is the receive time of the request that caused the write, or 0.
+	virtual ssize_t Write(const char* data, size_t length, int64_t request_rx_ns) = 0;
+
+	// Blocked and later reads return end of stream; the peer can still read
+	// what was written.
+	virtual void ShutdownRead() = 0;
+	// Reads return end of stream and writes fail, in both directions.
+	virtual void Shutdown() = 0;
+
+	// identifies the connection in logs, metrics and admin commands
+	virtual int Id() const = 0;
+};
+
+// Hands out the connections of a room.
+class TransportListener
+{
+public:
+	virtual ~TransportListener() {}
+
+	// Blocks until the next client connects. `peer` gets a printable name.
+	virtual Transport* Accept(char* peer, size_t peer_length) = 0;
+};
+
+
+// A TCP connection. With `timestamps`, kernel RX/TX timestamps are enabled
+// and the time from receiving a request to sending its result is reported
+// to `on_wire_latency` (see socket_timestamps.hpp).
+class SocketTransport final : public Transport
+{
+public:
+	SocketTransport(int fd, bool timestamps, void (*on_wire_latency)(int64_t wire_ns));
+	~SocketTransport() override;
+
+	ssize_t ReadLine(char* buf, size_t maxlen, int64_t* rx_ns) override;
+	ssize_t Write(const char* data, size_t length, int64_t request_rx_ns) override;
+	void ShutdownRead() override;
+	void Shutdown() override;
+	int Id() const override { return mFd; }
+
+	bool TimestampsEnabled() const { return mTimestamps; }
+
+private:
+	int mFd;
+	bool mTimestamps;
+	void (*mOnWireLatency)(int64_t wire_ns);
+	TimestampedLineReader mReader;
+	TxTimestampTracker mTxTimestamps;
+};
+
+class SocketListener final : public TransportListener
+{
+public:
+	// `listenfd` stays owned by the caller
+	SocketListener(int listenfd, bool timestamps, void (*on_wire_latency)(int64_t wire_ns));
+
+	Transport* Accept(char* peer, size_t peer_length) override;
+
+private:
+	int mListenFd;
+	bool mTimestamps;
+	void (*mOnWireLatency)(int64_t wire_ns);
+};
+
+
+// In-memory connections, for running a whole room inside one process
+// without sockets: each direction is a bounded byte pipe, so a client that
+// does not read eventually blocks the server's writes, like a full socket
+// buffer would.
+struct MemoryPipe;
+
+class MemoryTransport final : public Transport
+{
+public:
+	static constexpr size_t kPipeBytes = 256 * 1024;
+
+	// a connected pair; what one end writes, the other reads
+	static void CreatePair(int id, std::unique_ptr<MemoryTransport>& a,
+						   std::unique_ptr<MemoryTransport>& b);
+	~MemoryTransport() override;
+
+	ssize_t ReadLine(char* buf, size_t maxlen, int64_t* rx_ns) override;
+	ssize_t Write(const char* data, size_t length, int64_t request_rx_ns) override;
+	void ShutdownRead() override;
+	void Shutdown() override;
+	int Id() const override { return mId; }
+
+private:
+	MemoryTransport(int id, std::shared_ptr<MemoryPipe> in, std::shared_ptr<MemoryPipe> out);
+
+	int mId;
+	std::shared_ptr<MemoryPipe> mIn;
+	std::shared_ptr<MemoryPipe> mOut;
+};
+
+class MemoryListener final : public TransportListener
+{
+public:
+	MemoryListener();
+	~MemoryListener() override;
+
+	// Connects a new client and returns its end; the server's end is handed
+	// out by the next Accept().
+	std::unique_ptr<MemoryTransport> Connect();
+
+	Transport* Accept(char* peer, size_t peer_length) override;
+
+private:
+	pthread_mutex_t mMutex;
+	pthread_cond_t mConnected;
+	// server ends waiting for Accept()
+	std::deque<std::unique_ptr<MemoryTransport>> mPending;
+	int mNextId;
+};
@@ -0,0 +1,138 @@
+#include "wire_capture.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+
+
+static int64_t ClockNs(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+WireCapture::WireCapture()
+	: mNextSession(1)
+{
+	mFile = nullptr;
+	mStartNs = 0;
+}
+
+WireCapture::~WireCapture()
+{
+	Close();
+}
+
+bool WireCapture::Open(const char* path)
+{
+	Close();
+	mFile = fopen(path, "wbe");
+	if (mFile == nullptr)
+	{
+		LOG_ERROR("Capture: cannot create %s: %s\n", path, strerror(errno));
+		return false;
+	}
+	setvbuf(mFile, nullptr, _IOFBF, 64 * 1024);
+
+	WireCaptureHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, kWireCaptureMagic, sizeof(header.magic));
+	header.version = kWireCaptureVersion;
+	header.start_time_ns = ClockNs(CLOCK_REALTIME);
+	mStartNs = ClockNs(CLOCK_MONOTONIC);
+	fwrite(&header, sizeof(header), 1, mFile);
+	fflush(mFile);
+	return true;
+}
+
+void WireCapture::Close()
+{
+	if (mFile == nullptr) return;
+	fclose(mFile);
+	mFile = nullptr;
+}
+
+void WireCapture::Append(uint32_t session, WireCaptureRecordType type,
+						 const char* data, size_t length)
+{
+	WireCaptureRecord record;
+	record.time_ns = ClockNs(CLOCK_MONOTONIC) - mStartNs;
+	record.session = session;
+	record.type = type;
+	record.reserved = 0;
+	record.length = length;
+
+	// the stream lock keeps the record and its bytes together
+	flockfile(mFile);
+	fwrite_unlocked(&record, sizeof(record), 1, mFile);
+	if (length > 0) fwrite_unlocked(data, length, 1, mFile);
+	if (type == WireCaptureRecordType::close) fflush_unlocked(mFile);
+	funlockfile(mFile);
+}
+
+uint32_t WireCapture::OpenSession()
+{
+	uint32_t session = mNextSession.fetch_add(1);
+	Append(session, WireCaptureRecordType::open, nullptr, 0);
+	return session;
+}
+
+void WireCapture::Data(uint32_t session, const char* data, size_t length)
+{
+	// lines are far shorter than a record can hold, but stay safe
+	while (length > 0)
+	{
+		size_t chunk = std::min(length, (size_t)UINT16_MAX);
+		Append(session, WireCaptureRecordType::data, data, chunk);
+		data += chunk;
+		length -= chunk;
+	}
+}
+
+void WireCapture::CloseSession(uint32_t session)
+{
+	Append(session, WireCaptureRecordType::close, nullptr, 0);
+}
+
+
+RecordingTransport::RecordingTransport(Transport* inner, WireCapture& capture)
+	: mInner(inner), mCapture(capture)
+{
+	mSession = mCapture.OpenSession();
+	mClosed = false;
+}
+
+RecordingTransport::~RecordingTransport()
+{
+	if (!mClosed) mCapture.CloseSession(mSession);
+	delete mInner;
+}
+
+ssize_t RecordingTransport::ReadLine(char* buf, size_t maxlen, int64_t* rx_ns)
+{
+	ssize_t n = mInner->ReadLine(buf, maxlen, rx_ns);
+	// the session ends at end of stream, or when the transport is destroyed;
+	// a failed read (a timeout, say) is not recorded
+	if (mClosed) return n;
+	if (n > 0)
+	{
+		mCapture.Data(mSession, buf, n);
+	}
+	else if (n == 0)
+	{
+		mClosed = true;
+		mCapture.CloseSession(mSession);
+	}
+	return n;
+}
+
+
+Transport* RecordingListener::Accept(char* peer, size_t peer_length)
+{
+	Transport* transport = mInner.Accept(peer, peer_length);
+	if (transport == nullptr) return nullptr;
+	return new RecordingTransport(transport, mCapture);
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include "transport.hpp"
+
+// Capture of the raw inbound byte stream of every connection, for replaying
+// real sessions against a server (see tools/wirereplay.cpp). Enabled with
+// SNG_CAPTURE=1; one file per server process, shared by all of its rooms.
+//
+// The file is a WireCaptureHeader followed by WireCaptureRecords in the
+// order they were written, each data record followed by `length` bytes.
+// Concatenating a session's data gives exactly the bytes the server read
+// from it. A file cut short by a crash ends in at most one partial record.
+
+enum class WireCaptureRecordType : uint8_t
+{
+	open,  // the server accepted the session
+	data,  // the server read `length` bytes
+	close, // end of stream, or the server dropped the session; always last
+};
+
+struct WireCaptureRecord
+{
+	// CLOCK_MONOTONIC ns since the capture started
+	int64_t time_ns;
+	// numbered from 1 in order of acceptance, never reused
+	uint32_t session;
+	WireCaptureRecordType type;
+	uint8_t reserved;
+	uint16_t length;
+};
+static_assert(sizeof(WireCaptureRecord) == 16, "capture records are part of the file format");
+
+struct WireCaptureHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	int64_t start_time_ns; // CLOCK_REALTIME
+};
+
+constexpr char kWireCaptureMagic[8] = { 'S', 'N', 'G', 'W', 'I', 'R', 'E', '\0' };
+constexpr uint32_t kWireCaptureVersion = 1;
+
+// Appends records from any thread; each record is written whole.
+class WireCapture
+{
+public:
+	WireCapture();
+	~WireCapture();
+
+	// Creates (or truncates) `path`; returns false if it cannot.
+	bool Open(const char* path);
+	void Close();
+	bool IsOpen() const { return mFile != nullptr; }
+
+	uint32_t OpenSession();
+	void Data(uint32_t session, const char* data, size_t length);
+	// also flushes, so a finished session is on disk
+	void CloseSession(uint32_t session);
+
+private:
+	void Append(uint32_t session, WireCaptureRecordType type, const char* data, size_t length);
+
+	FILE* mFile;
+	int64_t mStartNs;
+	std::atomic<uint32_t> mNextSession;
+};
+
+// Records what is read from `inner`, which it owns, as one session.
+class RecordingTransport final : public Transport
+{
+public:
+	RecordingTransport(Transport* inner, WireCapture& capture);
+	~RecordingTransport() override;
+
+	ssize_t ReadLine(char* buf, size_t maxlen, int64_t* rx_ns) override;
+	ssize_t Write(const char* data, size_t length, int64_t request_rx_ns) override
+	{
+		return mInner->Write(data, length, request_rx_ns);
+	}
+	void ShutdownRead() override { mInner->ShutdownRead(); }
+	void Shutdown() override { mInner->Shutdown(); }
+	int Id() const override { return mInner->Id(); }
+
+private:
+	Transport* mInner;
+	WireCapture& mCapture;
+	uint32_t mSession;
+	// only touched by the reading thread, and by the destructor
+	bool mClosed;
+};
+
+// Wraps every connection `inner` accepts in a RecordingTransport.
+class RecordingListener final : public TransportListener
+{
+public:
+	RecordingListener(TransportListener& inner, WireCapture& capture)
+		: mInner(inner), mCapture(capture) {}
+
+	Transport* Accept(char* peer, size_t peer_length) override;
+
+private:
+	TransportListener& mInner;
+	WireCapture& mCapture;
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include "player.hpp"
+#include "game_state.hpp"
+#include "game_settings.hpp"
+
+struct PlayerSnapshot
+{
+	PlayerId player_id;
+	float posX;
+	float posY;
+	float colorR;
+	float colorG;
+	float colorB;
+	bool is_alive;
+	bool is_ready;
+};
+
+// Immutable copy of the world, published by Game after every tick and every
+// game state transition. Readers get it through GetSnapshot() without taking
+// the game mutex.
+template <unsigned int MaxPlayers>
+struct BasicWorldSnapshot
+{
+	uint64_t tick; // simulated ticks so far
+	GameStateType game_state;
+	PlayerId paused_by_player_id;
+	unsigned int projectile_count;
+	unsigned int player_count;
+	PlayerSnapshot players[MaxPlayers];
+};
+
+// Room-independent snapshot, large enough for any room.
+typedef BasicWorldSnapshot<GameSettings::kMaxPlayers> WorldSnapshot;